@@ -4,7 +4,6 @@
 #include "base/logging.h"
 #include "base/task_util/default_task_runner_factory.h"
 #include "base/task_util/task_runner.h"
-#include "base/time_utils.h"
 #include "base/sequence_checker.h"
 
 namespace ave {
@@ -22,12 +21,13 @@ const int64_t kDefaultVideoFrameIntervalUs = 33000LL;
 const int64_t kMinAudioClockUpdatePeriodUs = 20000LL;  // 20ms
 }  // namespace
 
-AVSynchronizeRender::AVSynchronizeRender()
-    : sync_runner_(std::make_unique<base::TaskRunner>(
+AVSynchronizeRender::AVSynchronizeRender(std::shared_ptr<Clock> clock)
+    : clock_(clock != nullptr ? std::move(clock) : Clock::GetDefault()),
+      sync_runner_(std::make_unique<base::TaskRunner>(
           base::CreateDefaultTaskRunnerFactory()->CreateTaskRunner(
               "AVSync",
               base::TaskRunnerFactory::Priority::NORMAL))),
-      media_clock_(std::make_shared<MediaClock>()),
+      media_clock_(std::make_shared<MediaClock>(clock_)),
       clock_type_(ClockType::kDefault),
       audio_track_(nullptr),
       use_audio_callback_(false) {}
@@ -73,7 +73,7 @@ void AVSynchronizeRender::Resume() {
 }
 
 status_t AVSynchronizeRender::GetCurrentMediaTime(int64_t* out_media_time_us) {
-  auto ret = media_clock_->GetMediaTime(base::TimeMicros(), out_media_time_us);
+  auto ret = media_clock_->GetMediaTime(clock_->NowUs(), out_media_time_us);
   if (ret == OK) {
     return ret;
   }
@@ -81,7 +81,7 @@ status_t AVSynchronizeRender::GetCurrentMediaTime(int64_t* out_media_time_us) {
   {
 
   }
-  return media_clock_->GetMediaTime(base::TimeMicros(), out_media_time_us);
+  return media_clock_->GetMediaTime(clock_->NowUs(), out_media_time_us);
 }
 
 void AVSynchronizeRender::SetVideoFrameRate(float fps) {
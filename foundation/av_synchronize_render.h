@@ -13,6 +13,7 @@
 
 #include "base/task_util/task_runner.h"
 #include "base/thread_annotation.h"
+#include "clock.h"
 #include "media/audio/audio_track.h"
 #include "media_clock.h"
 #include "media_frame.h"
@@ -37,7 +38,8 @@ class AVSynchronizeRender : public MessageObject {
     kDefault = kAudio,
   };
 
-  AVSynchronizeRender();
+  // |clock| defaults to Clock::GetDefault(), it also drives the MediaClock
+  explicit AVSynchronizeRender(std::shared_ptr<Clock> clock = nullptr);
   ~AVSynchronizeRender() override;
 
   // no need MediaType param any more, media type can get from MediaFrame
@@ -77,6 +79,7 @@ class AVSynchronizeRender : public MessageObject {
   void DrainAudioQueue() ;
   void DrainVideoQueue();
 
+  const std::shared_ptr<Clock> clock_;
   std::unique_ptr<base::TaskRunner> sync_runner_;
 
   std::unordered_map<int32_t, Stream> streams_ GUARDED_BY(sync_runner_);
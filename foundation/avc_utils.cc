@@ -351,20 +351,31 @@ status_t getNextNALUnit(const uint8_t** _data,
   return OK;
 }
 
-static std::shared_ptr<Buffer> FindNAL(const uint8_t* data,
-                                       size_t size,
-                                       unsigned nalType) {
-  const uint8_t* nalStart = nullptr;
-  size_t nalSize = 0;
-  while (getNextNALUnit(&data, &size, &nalStart, &nalSize, true) == OK) {
-    if (nalSize > 0 && (nalStart[0] & 0x1f) == nalType) {
-      auto buffer = std::make_shared<Buffer>(nalSize);
-      memcpy(buffer->data(), nalStart, nalSize);
-      return buffer;
+static bool FindNAL(const uint8_t* data,
+                    size_t size,
+                    unsigned nalType,
+                    const uint8_t** nalStart,
+                    size_t* nalSize) {
+  while (getNextNALUnit(&data, &size, nalStart, nalSize, true) == OK) {
+    if (*nalSize > 0 && ((*nalStart)[0] & 0x1f) == nalType) {
+      return true;
     }
   }
 
-  return nullptr;
+  return false;
+}
+
+// Returns the first NAL unit of |nalType| as a slice of |accessUnit|.
+static std::shared_ptr<Buffer> FindNAL(
+    const std::shared_ptr<Buffer>& accessUnit,
+    unsigned nalType) {
+  const uint8_t* nalStart = nullptr;
+  size_t nalSize = 0;
+  if (!FindNAL(accessUnit->data(), accessUnit->size(), nalType, &nalStart,
+               &nalSize)) {
+    return nullptr;
+  }
+  return Buffer::Slice(accessUnit, nalStart - accessUnit->data(), nalSize);
 }
 
 const char* AVCProfileToString(uint8_t profile) {
@@ -396,17 +407,14 @@ std::shared_ptr<Buffer> MakeAVCCodecSpecificData(
     int32_t* height,
     int32_t* sarWidth,
     int32_t* sarHeight) {
-  const uint8_t* data = accessUnit->data();
-  size_t size = accessUnit->size();
-
-  std::shared_ptr<Buffer> seqParamSet = FindNAL(data, size, 7);
+  std::shared_ptr<Buffer> seqParamSet = FindNAL(accessUnit, 7);
   if (seqParamSet == nullptr) {
     return nullptr;
   }
 
   FindAVCDimensions(seqParamSet, width, height, sarWidth, sarHeight);
 
-  std::shared_ptr<Buffer> picParamSet = FindNAL(data, size, 8);
+  std::shared_ptr<Buffer> picParamSet = FindNAL(accessUnit, 8);
   AVE_CHECK(picParamSet != nullptr);
 
   size_t csdSize = 1 + 3 + 1 + 1 + 2 * 1 + seqParamSet->size() + 1 + 2 * 1 +
@@ -530,10 +538,12 @@ uint32_t FindAVCLayerId(const uint8_t* data, size_t size) {
   // Layer n uses reference frames from layer 0, 1, ..., n-1.
 
   auto layerId = static_cast<uint32_t>(0);
-  std::shared_ptr<Buffer> svcNAL = FindNAL(
-      data, size > kSvcNalSearchRange ? kSvcNalSearchRange : size, kSvcNalType);
-  if (svcNAL != nullptr && svcNAL->size() >= 4) {
-    layerId = static_cast<uint32_t>((*(svcNAL->data() + 3) >> 5) & 0x7);
+  const uint8_t* svcNAL = nullptr;
+  size_t svcNALSize = 0;
+  if (FindNAL(data, size > kSvcNalSearchRange ? kSvcNalSearchRange : size,
+              kSvcNalType, &svcNAL, &svcNALSize) &&
+      svcNALSize >= 4) {
+    layerId = static_cast<uint32_t>((svcNAL[3] >> 5) & 0x7);
   }
   return layerId;
 }
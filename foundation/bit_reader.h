@@ -44,7 +44,7 @@ class BitReader {
   // stream has already been over-read.
   void putBits(uint32_t x, size_t n);
 
-  size_t numBitsLeft() const;
+  virtual size_t numBitsLeft() const;
 
   const uint8_t* data() const;
 
@@ -7,9 +7,15 @@
 
 #include "buffer.h"
 
+#include <algorithm>
+#include <cstdlib>
 #include <cstring>
 #include <memory>
 
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
 #include "base/checks.h"
 
 namespace ave {
@@ -21,6 +27,8 @@ Buffer::Buffer(size_t capacity)
       capacity_(capacity),
       range_offset_(0),
       range_length_(capacity),
+      padding_(0),
+      huge_pages_(false),
       int32_data_(0),
       owns_data_(true) {}
 
@@ -29,9 +37,22 @@ Buffer::Buffer(void* data, size_t capacity)
       capacity_(capacity),
       range_offset_(0),
       range_length_(capacity),
+      padding_(0),
+      huge_pages_(false),
       int32_data_(0),
       owns_data_(false) {}
 
+Buffer::Buffer(size_t capacity, size_t padding, bool huge_pages)
+    : aligned_(AllocateAligned(capacity, padding, huge_pages)),
+      data_(aligned_.get()),
+      capacity_(capacity),
+      range_offset_(0),
+      range_length_(capacity),
+      padding_(padding),
+      huge_pages_(huge_pages),
+      int32_data_(0),
+      owns_data_(true) {}
+
 // static
 std::shared_ptr<Buffer> Buffer::CreateAsCopy(const void* data,
                                              size_t capacity) {
@@ -40,6 +61,52 @@ std::shared_ptr<Buffer> Buffer::CreateAsCopy(const void* data,
   return buffer;
 }
 
+// static
+std::shared_ptr<Buffer> Buffer::Slice(const std::shared_ptr<Buffer>& parent,
+                                      size_t offset,
+                                      size_t length) {
+  AVE_CHECK_LE(offset, parent->size());
+  AVE_CHECK_LE(length, parent->size() - offset);
+  // the deleter holds the parent
+  return std::shared_ptr<Buffer>(new Buffer(parent->data() + offset, length),
+                                 [parent](Buffer* slice) { delete slice; });
+}
+
+// static
+std::shared_ptr<Buffer> Buffer::CreateAligned(size_t capacity,
+                                              size_t padding,
+                                              bool huge_pages) {
+  return std::shared_ptr<Buffer>(new Buffer(capacity, padding, huge_pages));
+}
+
+// static
+Buffer::AlignedData Buffer::AllocateAligned(size_t capacity,
+                                            size_t padding,
+                                            bool huge_pages) {
+  size_t alignment = kAlignment;
+  if (huge_pages && capacity >= kHugePageSize) {
+    alignment = kHugePageSize;
+  }
+  // rounded up, so the padding ends on a whole vector, and never 0 for
+  // posix_memalign()
+  size_t size = (capacity + padding + alignment - 1) / alignment * alignment;
+  void* data = nullptr;
+  int err = posix_memalign(&data, alignment, std::max(size, alignment));
+  AVE_CHECK_EQ(err, 0);
+  std::memset(static_cast<uint8_t*>(data) + capacity, 0, size - capacity);
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+  if (alignment == kHugePageSize) {
+    // only a hint, the kernel may have THP off
+    madvise(data, size, MADV_HUGEPAGE);
+  }
+#endif
+  return AlignedData(static_cast<uint8_t*>(data));
+}
+
+void Buffer::AlignedDeleter::operator()(uint8_t* data) const {
+  free(data);
+}
+
 Buffer::~Buffer() = default;
 
 void Buffer::setRange(size_t offset, size_t size) {
@@ -55,7 +122,14 @@ void Buffer::ensureCapacity(size_t capacity, bool copy) {
     return;
   }
 
-  if (owns_data_) {
+  if (aligned_ != nullptr) {
+    auto new_data = AllocateAligned(capacity, padding_, huge_pages_);
+    if (copy) {
+      std::memcpy(new_data.get(), data_, range_length_);
+    }
+    aligned_ = std::move(new_data);
+    data_ = aligned_.get();
+  } else if (owns_data_) {
     auto new_buffer = std::make_unique<base::Buffer>(capacity);
     if (copy) {
       std::memcpy(new_buffer->data(), data_, range_length_);
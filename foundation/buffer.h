@@ -8,6 +8,10 @@
 #ifndef BUFFER2_H
 #define BUFFER2_H
 
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
 #include "base/buffer.h"
 #include "base/constructor_magic.h"
 
@@ -20,6 +24,14 @@ namespace media {
 
 class Buffer {
  public:
+  // alignment of aligned buffers, enough for AVX-512 loads and a cache line
+  static constexpr size_t kAlignment = 64;
+  // zeroed bytes after the capacity of aligned buffers, so readers may
+  // overrun the end, like FFmpeg's AV_INPUT_BUFFER_PADDING_SIZE
+  static constexpr size_t kDefaultPadding = 64;
+  // capacities from which huge pages are worth asking for
+  static constexpr size_t kHugePageSize = 2 * 1024 * 1024;
+
   Buffer(size_t capacity);
   Buffer(void* data, size_t capacity);
   virtual ~Buffer();
@@ -28,11 +40,31 @@ class Buffer {
   static std::shared_ptr<Buffer> CreateAsCopy(const void* data,
                                               size_t capacity);
 
+  // Creates a view of |length| bytes at |offset| into the current range of
+  // |parent|, without copying. The view keeps |parent| alive and has its own
+  // range and meta, but shares the memory, so writes show through. It cannot
+  // grow, ensureCapacity() on it aborts.
+  static std::shared_ptr<Buffer> Slice(const std::shared_ptr<Buffer>& parent,
+                                       size_t offset,
+                                       size_t length);
+
+  // Creates a buffer whose base() is kAlignment aligned, followed by
+  // |padding| zeroed bytes. With |huge_pages| a capacity of kHugePageSize
+  // or more is aligned to kHugePageSize and, on Linux, advised for
+  // transparent huge pages, which saves TLB misses on large video frames.
+  // ensureCapacity() keeps all of it.
+  static std::shared_ptr<Buffer> CreateAligned(
+      size_t capacity,
+      size_t padding = kDefaultPadding,
+      bool huge_pages = false);
+
   uint8_t* base() { return static_cast<uint8_t*>(data_); }
   uint8_t* data() { return (static_cast<uint8_t*>(data_) + range_offset_); }
   size_t capacity() const { return capacity_; }
   size_t size() const { return range_length_; }
   size_t offset() const { return range_offset_; }
+  // padding after the capacity, 0 unless the buffer is aligned
+  size_t padding() const { return padding_; }
   void setRange(size_t offset, size_t size);
   void ensureCapacity(size_t capacity, bool copy);
 
@@ -42,13 +74,29 @@ class Buffer {
   std::shared_ptr<Message>& meta();
 
  private:
+  friend class BufferPool;
+
+  struct AlignedDeleter {
+    void operator()(uint8_t* data) const;
+  };
+  using AlignedData = std::unique_ptr<uint8_t, AlignedDeleter>;
+
+  Buffer(size_t capacity, size_t padding, bool huge_pages);
+  static AlignedData AllocateAligned(size_t capacity,
+                                     size_t padding,
+                                     bool huge_pages);
+
   std::shared_ptr<Message> meta_;
   std::unique_ptr<base::Buffer> buffer_;
+  // instead of buffer_ for aligned buffers
+  AlignedData aligned_;
 
   void* data_;
   size_t capacity_;
   size_t range_offset_;
   size_t range_length_;
+  size_t padding_;
+  bool huge_pages_;
 
   int32_t int32_data_;
   bool owns_data_;
@@ -0,0 +1,145 @@
+/*
+ * buffer_chain.cc
+ * Copyright (C) 2024 youfa <vsyfar@gmail.com>
+ *
+ * Distributed under terms of the GPLv2 license.
+ */
+
+#include "buffer_chain.h"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#include "base/checks.h"
+
+namespace ave {
+namespace media {
+
+BufferChain::BufferChain() : size_(0) {}
+
+BufferChain::~BufferChain() = default;
+
+BufferChain::BufferChain(BufferChain&& other) noexcept
+    : fragments_(std::move(other.fragments_)), size_(other.size_) {
+  other.fragments_.clear();
+  other.size_ = 0;
+}
+
+BufferChain& BufferChain::operator=(BufferChain&& other) noexcept {
+  if (this != &other) {
+    fragments_ = std::move(other.fragments_);
+    size_ = other.size_;
+    other.fragments_.clear();
+    other.size_ = 0;
+  }
+  return *this;
+}
+
+void BufferChain::append(std::shared_ptr<Buffer> buffer) {
+  if (buffer == nullptr || buffer->size() == 0) {
+    return;
+  }
+  const uint8_t* data = buffer->data();
+  size_t size = buffer->size();
+  fragments_.push_back(Fragment{std::move(buffer), data, size});
+  size_ += size;
+}
+
+void BufferChain::append(const BufferChain& other) {
+  AVE_CHECK(&other != this);
+  fragments_.insert(fragments_.end(), other.fragments_.begin(),
+                    other.fragments_.end());
+  size_ += other.size_;
+}
+
+void BufferChain::clear() {
+  fragments_.clear();
+  size_ = 0;
+}
+
+const uint8_t* BufferChain::fragmentData(size_t index) const {
+  AVE_CHECK_LT(index, fragments_.size());
+  return fragments_[index].data;
+}
+
+size_t BufferChain::fragmentSize(size_t index) const {
+  AVE_CHECK_LT(index, fragments_.size());
+  return fragments_[index].size;
+}
+
+size_t BufferChain::toIovec(struct iovec* iov, size_t max) const {
+  size_t count = std::min(max, fragments_.size());
+  for (size_t i = 0; i < count; i++) {
+    iov[i].iov_base = const_cast<uint8_t*>(fragments_[i].data);
+    iov[i].iov_len = fragments_[i].size;
+  }
+  return count;
+}
+
+size_t BufferChain::copyTo(size_t offset, void* dest, size_t size) const {
+  auto* out = static_cast<uint8_t*>(dest);
+  size_t copied = 0;
+  for (const auto& fragment : fragments_) {
+    if (copied == size) {
+      break;
+    }
+    if (offset >= fragment.size) {
+      offset -= fragment.size;
+      continue;
+    }
+    size_t length = std::min(fragment.size - offset, size - copied);
+    std::memcpy(out + copied, fragment.data + offset, length);
+    copied += length;
+    offset = 0;
+  }
+  return copied;
+}
+
+std::shared_ptr<Buffer> BufferChain::linearize(
+    const std::shared_ptr<BufferPool>& pool) {
+  if (fragments_.empty()) {
+    return nullptr;
+  }
+
+  const Fragment& first = fragments_.front();
+  if (fragments_.size() == 1 && first.data == first.buffer->data() &&
+      first.size == first.buffer->size()) {
+    return first.buffer;
+  }
+
+  // several fragments, or the range of the only one changed since append()
+  auto buffer =
+      pool != nullptr ? pool->acquire(size_) : Buffer::CreateAligned(size_);
+  copyTo(0, buffer->data(), size_);
+  fragments_.clear();
+  fragments_.push_back(Fragment{buffer, buffer->data(), size_});
+  return buffer;
+}
+
+BufferChainBitReader::BufferChainBitReader(const BufferChain& chain)
+    : BitReader(chain.count() > 0 ? chain.fragmentData(0) : nullptr,
+                chain.count() > 0 ? chain.fragmentSize(0) : 0),
+      chain_(chain),
+      index_(0),
+      bytes_after_(chain.count() > 0 ? chain.size() - chain.fragmentSize(0)
+                                     : 0) {}
+
+BufferChainBitReader::~BufferChainBitReader() = default;
+
+size_t BufferChainBitReader::numBitsLeft() const {
+  return BitReader::numBitsLeft() + bytes_after_ * 8;
+}
+
+bool BufferChainBitReader::fillReservoir() {
+  while (mSize == 0 && index_ + 1 < chain_.count()) {
+    index_++;
+    mData = chain_.fragmentData(index_);
+    mSize = chain_.fragmentSize(index_);
+    bytes_after_ -= mSize;
+  }
+  return BitReader::fillReservoir();
+}
+
+}  // namespace media
+}  // namespace ave
@@ -0,0 +1,119 @@
+/*
+ * buffer_chain.h
+ * Copyright (C) 2024 youfa <vsyfar@gmail.com>
+ *
+ * Distributed under terms of the GPLv2 license.
+ */
+
+#ifndef BUFFER_CHAIN_H
+#define BUFFER_CHAIN_H
+
+#include <sys/uio.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "base/constructor_magic.h"
+
+#include "bit_reader.h"
+#include "buffer.h"
+#include "buffer_pool.h"
+
+namespace ave {
+namespace media {
+
+// A packet made of fragments, e.g. the NAL units of an access unit, RTP
+// fragments or container sample pieces, without copying them into one
+// Buffer first:
+//   BufferChain chain;
+//   chain.append(Buffer::Slice(rtp_payload, 2, size - 2));
+//   chain.append(next_payload);
+//   writev(fd, iov, chain.toIovec(iov, kMaxIov));
+//   BufferChainBitReader reader(chain);
+//
+// Each fragment is the range its buffer had when it was appended, the
+// chain keeps the buffer alive. Only linearize() copies, and only if there
+// is more than one fragment.
+//
+// Not thread safe.
+class BufferChain {
+ public:
+  BufferChain();
+  ~BufferChain();
+
+  BufferChain(BufferChain&& other) noexcept;
+  BufferChain& operator=(BufferChain&& other) noexcept;
+
+  // Appends the current range of |buffer|, empty ranges are skipped.
+  void append(std::shared_ptr<Buffer> buffer);
+  // Appends the fragments of |other|, sharing their buffers.
+  void append(const BufferChain& other);
+  void clear();
+
+  // bytes in all fragments
+  size_t size() const { return size_; }
+  size_t count() const { return fragments_.size(); }
+  bool empty() const { return size_ == 0; }
+
+  const uint8_t* fragmentData(size_t index) const;
+  size_t fragmentSize(size_t index) const;
+
+  // Fills up to |max| entries of |iov| with the fragments, for writev() or
+  // sendmsg(), and returns how many it filled.
+  size_t toIovec(struct iovec* iov, size_t max) const;
+
+  // Copies up to |size| bytes starting |offset| bytes into the chain to
+  // |dest|, returns the number of bytes copied.
+  size_t copyTo(size_t offset, void* dest, size_t size) const;
+
+  // Returns the chain as one contiguous buffer, and makes it the only
+  // fragment, so later calls are free. Copies into a buffer from |pool|, or
+  // an aligned one without pool, unless the chain is a single fragment that
+  // still is its buffer's range. nullptr for an empty chain.
+  std::shared_ptr<Buffer> linearize(
+      const std::shared_ptr<BufferPool>& pool = nullptr);
+
+ private:
+  struct Fragment {
+    std::shared_ptr<Buffer> buffer;
+    const uint8_t* data;
+    size_t size;
+  };
+
+  std::vector<Fragment> fragments_;
+  size_t size_;
+
+  AVE_DISALLOW_COPY_AND_ASSIGN(BufferChain);
+};
+
+// A BitReader over all fragments of a chain, as if they were one buffer.
+// The chain must outlive the reader, and not change meanwhile. data()
+// points into the fragment being read.
+class BufferChainBitReader : public BitReader {
+ public:
+  explicit BufferChainBitReader(const BufferChain& chain);
+  ~BufferChainBitReader() override;
+
+  size_t numBitsLeft() const override;
+
+ private:
+  // Like BitReader's, but moves on to the next fragment when the current
+  // one is used up. The reservoir never mixes fragments, so putBits()
+  // stays within the current one.
+  bool fillReservoir() override;
+
+  const BufferChain& chain_;
+  // fragment mData points into
+  size_t index_;
+  // bytes in the fragments after index_
+  size_t bytes_after_;
+
+  AVE_DISALLOW_COPY_AND_ASSIGN(BufferChainBitReader);
+};
+
+}  // namespace media
+}  // namespace ave
+
+#endif /* !BUFFER_CHAIN_H */
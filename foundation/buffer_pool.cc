@@ -0,0 +1,149 @@
+/*
+ * buffer_pool.cc
+ * Copyright (C) 2024 youfa <vsyfar@gmail.com>
+ *
+ * Distributed under terms of the GPLv2 license.
+ */
+
+#include "buffer_pool.h"
+
+#include <algorithm>
+
+namespace ave {
+namespace media {
+
+namespace {
+const size_t kStepsPerOctave = 4;
+
+// kMinClassSize * (1, 1.25, 1.5, 1.75, 2, 2.5, ...) up to kMaxClassSize
+const std::vector<size_t>& ClassSizes() {
+  static const std::vector<size_t> sizes = []() {
+    std::vector<size_t> result;
+    for (size_t octave = BufferPool::kMinClassSize;
+         octave < BufferPool::kMaxClassSize; octave *= 2) {
+      for (size_t step = 0; step < kStepsPerOctave; step++) {
+        result.push_back(octave + octave / kStepsPerOctave * step);
+      }
+    }
+    result.push_back(BufferPool::kMaxClassSize);
+    return result;
+  }();
+  return sizes;
+}
+}  // namespace
+
+// static
+std::shared_ptr<BufferPool> BufferPool::Create(size_t max_cached_bytes,
+                                               bool huge_pages) {
+  return std::shared_ptr<BufferPool>(
+      new BufferPool(max_cached_bytes, huge_pages));
+}
+
+// static
+const std::shared_ptr<BufferPool>& BufferPool::Default() {
+  // never destroyed, buffers may be released during static destruction
+  static auto* pool = new std::shared_ptr<BufferPool>(Create());
+  return *pool;
+}
+
+BufferPool::BufferPool(size_t max_cached_bytes, bool huge_pages)
+    : max_cached_bytes_(max_cached_bytes),
+      huge_pages_(huge_pages),
+      free_lists_(ClassSizes().size()),
+      cached_bytes_(0),
+      cached_buffers_(0),
+      hits_(0),
+      misses_(0) {}
+
+BufferPool::~BufferPool() = default;
+
+// static
+size_t BufferPool::ClassSize(size_t size) {
+  const auto& sizes = ClassSizes();
+  auto it = std::lower_bound(sizes.begin(), sizes.end(), size);
+  return it == sizes.end() ? 0 : *it;
+}
+
+// static
+int BufferPool::ClassIndexForCapacity(size_t capacity) {
+  const auto& sizes = ClassSizes();
+  auto it = std::upper_bound(sizes.begin(), sizes.end(), capacity);
+  return static_cast<int>(it - sizes.begin()) - 1;
+}
+
+std::shared_ptr<Buffer> BufferPool::acquire(size_t size) {
+  size_t class_size = ClassSize(size);
+  if (class_size == 0) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    misses_++;
+    return Buffer::CreateAligned(size, Buffer::kDefaultPadding, huge_pages_);
+  }
+
+  std::unique_ptr<Buffer> buffer;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    auto& free_list = free_lists_[ClassIndexForCapacity(class_size)];
+    if (free_list.empty()) {
+      misses_++;
+    } else {
+      hits_++;
+      buffer = std::move(free_list.back());
+      free_list.pop_back();
+      cached_bytes_ -= buffer->capacity();
+      cached_buffers_--;
+    }
+  }
+  if (buffer == nullptr) {
+    buffer.reset(new Buffer(class_size, Buffer::kDefaultPadding, huge_pages_));
+  }
+  buffer->setRange(0, size);
+
+  std::weak_ptr<BufferPool> weak_pool = weak_from_this();
+  return std::shared_ptr<Buffer>(buffer.release(), [weak_pool](Buffer* b) {
+    auto pool = weak_pool.lock();
+    if (pool != nullptr) {
+      pool->recycle(b);
+    } else {
+      delete b;
+    }
+  });
+}
+
+void BufferPool::recycle(Buffer* buffer) {
+  std::unique_ptr<Buffer> owned(buffer);
+  owned->meta_.reset();
+  owned->int32_data_ = 0;
+
+  size_t capacity = owned->capacity();
+  // grown past every class by ensureCapacity()
+  if (capacity > kMaxClassSize) {
+    return;
+  }
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (cached_bytes_ + capacity > max_cached_bytes_) {
+    return;
+  }
+  cached_bytes_ += capacity;
+  cached_buffers_++;
+  free_lists_[ClassIndexForCapacity(capacity)].push_back(std::move(owned));
+}
+
+void BufferPool::trim() {
+  std::vector<std::vector<std::unique_ptr<Buffer>>> free_lists(
+      free_lists_.size());
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    free_lists_.swap(free_lists);
+    cached_bytes_ = 0;
+    cached_buffers_ = 0;
+  }
+  // freed outside the lock
+}
+
+BufferPool::Stats BufferPool::stats() const {
+  std::lock_guard<std::mutex> guard(mutex_);
+  return Stats{hits_, misses_, cached_bytes_, cached_buffers_};
+}
+
+}  // namespace media
+}  // namespace ave
@@ -0,0 +1,101 @@
+/*
+ * buffer_pool.h
+ * Copyright (C) 2024 youfa <vsyfar@gmail.com>
+ *
+ * Distributed under terms of the GPLv2 license.
+ */
+
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "base/constructor_magic.h"
+
+#include "buffer.h"
+
+namespace ave {
+namespace media {
+
+// Recycles the memory of Buffers, so a stream of packets or frames of about
+// the same size stops going through malloc / free and page faults for every
+// one of them:
+//   auto pool = BufferPool::Create();
+//   auto packet = MediaPacket::Create(size, pool);
+//
+// Sizes are rounded up to a size class, four per power of two from
+// kMinClassSize to kMaxClassSize, which adds at most 25% to a request.
+// When the last shared_ptr to an acquired buffer drops, the buffer goes
+// back to the free list of its class, or is freed if the pool already
+// keeps |max_cached_bytes| or is gone. Larger sizes are not pooled.
+// All buffers are aligned with the default padding, see
+// Buffer::CreateAligned().
+//
+// Thread safe. Buffers may be released on any thread and outlive the pool.
+class BufferPool : public std::enable_shared_from_this<BufferPool> {
+ public:
+  static constexpr size_t kMinClassSize = 256;
+  static constexpr size_t kMaxClassSize = 64 * 1024 * 1024;
+  static constexpr size_t kDefaultMaxCachedBytes = 64 * 1024 * 1024;
+
+  // |huge_pages| is passed on to Buffer::CreateAligned(), for pools of
+  // large video frames.
+  static std::shared_ptr<BufferPool> Create(
+      size_t max_cached_bytes = kDefaultMaxCachedBytes,
+      bool huge_pages = false);
+
+  // A process wide pool with the default limit.
+  static const std::shared_ptr<BufferPool>& Default();
+
+  ~BufferPool();
+
+  // Returns a buffer with size() == |size| and a capacity of at least the
+  // size class. The contents are undefined, the range starts at 0 and the
+  // meta is empty.
+  std::shared_ptr<Buffer> acquire(size_t size);
+
+  // Frees every cached buffer, buffers in use are not affected.
+  void trim();
+
+  struct Stats {
+    // acquire() calls served from a free list
+    uint64_t hits;
+    // acquire() calls that had to allocate, including unpooled sizes
+    uint64_t misses;
+    size_t cached_bytes;
+    size_t cached_buffers;
+  };
+  Stats stats() const;
+
+  // Size class |size| is rounded up to, 0 if it is not pooled.
+  static size_t ClassSize(size_t size);
+
+ private:
+  BufferPool(size_t max_cached_bytes, bool huge_pages);
+
+  // Index of the largest class not above |capacity|, -1 if none.
+  static int ClassIndexForCapacity(size_t capacity);
+  void recycle(Buffer* buffer);
+
+  const size_t max_cached_bytes_;
+  const bool huge_pages_;
+
+  mutable std::mutex mutex_;
+  // per class, the most recently released buffer last
+  std::vector<std::vector<std::unique_ptr<Buffer>>> free_lists_;
+  size_t cached_bytes_;
+  size_t cached_buffers_;
+  uint64_t hits_;
+  uint64_t misses_;
+
+  AVE_DISALLOW_COPY_AND_ASSIGN(BufferPool);
+};
+
+}  // namespace media
+}  // namespace ave
+
+#endif /* !BUFFER_POOL_H */
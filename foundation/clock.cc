@@ -0,0 +1,100 @@
+/*
+ * clock.cc
+ * Copyright (C) 2024 youfa <vsyfar@gmail.com>
+ *
+ * Distributed under terms of the GPLv2 license.
+ */
+
+#include "clock.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include "base/checks.h"
+
+namespace ave {
+namespace media {
+
+namespace {
+// upper bound of a single timed wait, avoids overflowing the clock
+const int64_t kMaxWaitUs = 3600LL * 1000 * 1000;
+}  // namespace
+
+// static
+std::shared_ptr<Clock> Clock::GetDefault() {
+  static std::shared_ptr<Clock> clock = std::make_shared<SteadyClock>();
+  return clock;
+}
+
+int64_t SteadyClock::NowUs() const {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void SteadyClock::WaitUntil(std::unique_lock<std::mutex>& lock,
+                            std::condition_variable& condition,
+                            int64_t deadline_us) {
+  int64_t delay_us = deadline_us - NowUs();
+  if (delay_us <= 0) {
+    return;
+  }
+  condition.wait_for(lock,
+                     std::chrono::microseconds(std::min(delay_us, kMaxWaitUs)));
+}
+
+bool SteadyClock::IsSystemMonotonic() const {
+  // libstdc++ and libc++ implement steady_clock with CLOCK_MONOTONIC
+#if defined(__linux__)
+  return true;
+#else
+  return false;
+#endif
+}
+
+SimulatedClock::SimulatedClock(int64_t initial_us)
+    : now_us_(initial_us), next_wakeup_id_(1) {}
+
+int64_t SimulatedClock::NowUs() const {
+  return now_us_.load(std::memory_order_acquire);
+}
+
+void SimulatedClock::WaitUntil(std::unique_lock<std::mutex>& lock,
+                               std::condition_variable& condition,
+                               int64_t deadline_us) {
+  if (deadline_us <= NowUs()) {
+    return;
+  }
+  // woken by the owner's Wakeup once time moves
+  condition.wait(lock);
+}
+
+int32_t SimulatedClock::AddWakeup(Wakeup wakeup) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  int32_t id = next_wakeup_id_++;
+  wakeups_.emplace(id, std::move(wakeup));
+  return id;
+}
+
+void SimulatedClock::RemoveWakeup(int32_t id) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  wakeups_.erase(id);
+}
+
+void SimulatedClock::AdvanceUs(int64_t delta_us) {
+  AVE_CHECK_GE(delta_us, 0);
+  SetNowUs(NowUs() + delta_us);
+}
+
+void SimulatedClock::SetNowUs(int64_t now_us) {
+  AVE_CHECK_GE(now_us, NowUs());
+  // holding mutex_ keeps every registered owner alive during the callback
+  std::lock_guard<std::mutex> guard(mutex_);
+  now_us_.store(now_us, std::memory_order_release);
+  for (auto& wakeup : wakeups_) {
+    wakeup.second();
+  }
+}
+
+}  // namespace media
+}  // namespace ave
@@ -0,0 +1,100 @@
+/*
+ * clock.h
+ * Copyright (C) 2024 youfa <vsyfar@gmail.com>
+ *
+ * Distributed under terms of the GPLv2 license.
+ */
+
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include "base/attributes.h"
+#include "base/constructor_magic.h"
+
+namespace ave {
+namespace media {
+
+// Time source for Looper, MediaClock and AVSynchronizeRender. All times are
+// microseconds on a monotonic time base.
+class Clock {
+ public:
+  using Wakeup = std::function<void()>;
+
+  Clock() = default;
+  virtual ~Clock() = default;
+
+  // process wide SteadyClock
+  static std::shared_ptr<Clock> GetDefault();
+
+  virtual int64_t NowUs() const = 0;
+
+  // Blocks on |condition| until it is notified or NowUs() reaches
+  // |deadline_us|. |lock| must hold the mutex the notifier takes.
+  virtual void WaitUntil(std::unique_lock<std::mutex>& lock,
+                         std::condition_variable& condition,
+                         int64_t deadline_us) = 0;
+
+  // |wakeup| is called whenever time moves by other means than the passing
+  // of real time, so waiters can re-evaluate their deadlines. The callback
+  // must not call back into the clock. Returns an id for RemoveWakeup().
+  virtual int32_t AddWakeup(Wakeup wakeup AVE_MAYBE_UNUSED) { return 0; }
+  virtual void RemoveWakeup(int32_t id AVE_MAYBE_UNUSED) {}
+
+  // true if NowUs() reads CLOCK_MONOTONIC, so its deadlines can be handed
+  // to the kernel, e.g. to a timerfd
+  virtual bool IsSystemMonotonic() const { return false; }
+
+ private:
+  AVE_DISALLOW_COPY_AND_ASSIGN(Clock);
+};
+
+// std::chrono::steady_clock, unaffected by wall clock (NTP) steps.
+class SteadyClock : public Clock {
+ public:
+  SteadyClock() = default;
+  ~SteadyClock() override = default;
+
+  int64_t NowUs() const override;
+  void WaitUntil(std::unique_lock<std::mutex>& lock,
+                 std::condition_variable& condition,
+                 int64_t deadline_us) override;
+  bool IsSystemMonotonic() const override;
+};
+
+// Manually driven clock for tests. Time only moves through AdvanceUs() and
+// SetNowUs(), so timing-heavy code runs at CPU speed.
+class SimulatedClock : public Clock {
+ public:
+  explicit SimulatedClock(int64_t initial_us = 0);
+  ~SimulatedClock() override = default;
+
+  int64_t NowUs() const override;
+  void WaitUntil(std::unique_lock<std::mutex>& lock,
+                 std::condition_variable& condition,
+                 int64_t deadline_us) override;
+  int32_t AddWakeup(Wakeup wakeup) override;
+  void RemoveWakeup(int32_t id) override;
+
+  void AdvanceUs(int64_t delta_us);
+  // |now_us| must not be earlier than NowUs()
+  void SetNowUs(int64_t now_us);
+
+ private:
+  std::atomic<int64_t> now_us_;
+  std::mutex mutex_;
+  std::map<int32_t, Wakeup> wakeups_;
+  int32_t next_wakeup_id_;
+};
+
+}  // namespace media
+}  // namespace ave
+
+#endif /* !CLOCK_H */
@@ -672,13 +672,13 @@ void ColorUtils::getColorConfigFromFormat(
     int32_t* range,
     int32_t* standard,
     int32_t* transfer) {
-  if (!format->findInt32("color-range", range)) {
+  if (!format->findInt32(AVE_MESSAGE_KEY("color-range"), range)) {
     *range = static_cast<int32_t>(kColorRangeUnspecified);
   }
-  if (!format->findInt32("color-standard", standard)) {
+  if (!format->findInt32(AVE_MESSAGE_KEY("color-standard"), standard)) {
     *standard = static_cast<int32_t>(kColorStandardUnspecified);
   }
-  if (!format->findInt32("color-transfer", transfer)) {
+  if (!format->findInt32(AVE_MESSAGE_KEY("color-transfer"), transfer)) {
     *transfer = static_cast<int32_t>(kColorTransferUnspecified);
   }
 }
@@ -688,14 +688,14 @@ void ColorUtils::copyColorConfig(const std::shared_ptr<Message>& source,
                                  std::shared_ptr<Message>& target) {
   // 0 values are unspecified
   int32_t value = 0;
-  if (source->findInt32("color-range", &value)) {
-    target->setInt32("color-range", value);
+  if (source->findInt32(AVE_MESSAGE_KEY("color-range"), &value)) {
+    target->setInt32(AVE_MESSAGE_KEY("color-range"), value);
   }
-  if (source->findInt32("color-standard", &value)) {
-    target->setInt32("color-standard", value);
+  if (source->findInt32(AVE_MESSAGE_KEY("color-standard"), &value)) {
+    target->setInt32(AVE_MESSAGE_KEY("color-standard"), value);
   }
-  if (source->findInt32("color-transfer", &value)) {
-    target->setInt32("color-transfer", value);
+  if (source->findInt32(AVE_MESSAGE_KEY("color-transfer"), &value)) {
+    target->setInt32(AVE_MESSAGE_KEY("color-transfer"), value);
   }
 }
 
@@ -746,13 +746,13 @@ void ColorUtils::setColorAspectsIntoFormat(const ColorAspects& aspects,
   // (encoder input format will read back actually supported values by the
   // codec)
   if (range != 0 || force) {
-    format->setInt32("color-range", range);
+    format->setInt32(AVE_MESSAGE_KEY("color-range"), range);
   }
   if (standard != 0 || force) {
-    format->setInt32("color-standard", standard);
+    format->setInt32(AVE_MESSAGE_KEY("color-standard"), standard);
   }
   if (transfer != 0 || force) {
-    format->setInt32("color-transfer", transfer);
+    format->setInt32(AVE_MESSAGE_KEY("color-transfer"), transfer);
   }
   AVE_LOG(LS_VERBOSE) << "setting color aspects (R:" << aspects.mRange << "("
                       << asString(aspects.mRange)
@@ -825,7 +825,7 @@ void ColorUtils::setHDRStaticInfoIntoFormat(const HDRStaticInfo& info,
   uint8_t* data = infoBuffer->data();
   fillHdrStaticInfoBuffer(info, data);
 
-  format->setBuffer("hdr-static-info", infoBuffer);
+  format->setBuffer(AVE_MESSAGE_KEY("hdr-static-info"), infoBuffer);
 }
 
 // a simple method copied from Utils.cpp
@@ -838,7 +838,7 @@ bool ColorUtils::getHDRStaticInfoFromFormat(
     const std::shared_ptr<Message>& format,
     HDRStaticInfo* info) {
   std::shared_ptr<Buffer> buf;
-  if (!format->findBuffer("hdr-static-info", buf)) {
+  if (!format->findBuffer(AVE_MESSAGE_KEY("hdr-static-info"), buf)) {
     return false;
   }
 
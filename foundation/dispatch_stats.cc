@@ -0,0 +1,83 @@
+/*
+ * dispatch_stats.cc
+ * Copyright (C) 2024 youfa <vsyfar@gmail.com>
+ *
+ * Distributed under terms of the GPLv2 license.
+ */
+
+#include "dispatch_stats.h"
+
+#include <limits>
+
+namespace ave {
+namespace media {
+
+int64_t LatencyHistogram::BucketLimitUs(size_t bucket) {
+  if (bucket + 1 >= kBuckets) {
+    return std::numeric_limits<int64_t>::max();
+  }
+  return static_cast<int64_t>(1) << bucket;
+}
+
+int64_t LatencyHistogram::Snapshot::PercentileUs(double p) const {
+  if (count == 0) {
+    return 0;
+  }
+  uint64_t rank = static_cast<uint64_t>(p * static_cast<double>(count - 1));
+  uint64_t seen = 0;
+  for (size_t i = 0; i < kBuckets; i++) {
+    seen += counts[i];
+    if (seen > rank) {
+      int64_t limit = BucketLimitUs(i);
+      return limit < max_us ? limit : max_us;
+    }
+  }
+  return max_us;
+}
+
+LatencyHistogram::Snapshot LatencyHistogram::snapshot() const {
+  Snapshot snapshot;
+  for (size_t i = 0; i < kBuckets; i++) {
+    snapshot.counts[i] = counts_[i].load(std::memory_order_relaxed);
+  }
+  snapshot.count = count_.load(std::memory_order_relaxed);
+  snapshot.sum_us = sum_us_.load(std::memory_order_relaxed);
+  snapshot.max_us = max_us_.load(std::memory_order_relaxed);
+  return snapshot;
+}
+
+void LatencyHistogram::reset() {
+  for (auto& count : counts_) {
+    count.store(0, std::memory_order_relaxed);
+  }
+  count_.store(0, std::memory_order_relaxed);
+  sum_us_.store(0, std::memory_order_relaxed);
+  max_us_.store(0, std::memory_order_relaxed);
+}
+
+DispatchStats::Snapshot DispatchStats::snapshot(int64_t now_us) const {
+  Snapshot snapshot;
+  snapshot.time_us = now_us;
+  snapshot.latency = latency_.snapshot();
+  snapshot.execution = execution_.snapshot();
+  snapshot.messages = snapshot.execution.count;
+  return snapshot;
+}
+
+void DispatchStats::reset() {
+  latency_.reset();
+  execution_.reset();
+}
+
+double DispatchStats::MessagesPerSecond(const Snapshot& earlier,
+                                        const Snapshot& later) {
+  int64_t elapsed_us = later.time_us - earlier.time_us;
+  if (elapsed_us <= 0 || later.messages < earlier.messages) {
+    return 0.0;
+  }
+  return static_cast<double>(later.messages - earlier.messages) * 1000000.0 /
+         static_cast<double>(elapsed_us);
+}
+
+}  // namespace media
+}  // namespace ave
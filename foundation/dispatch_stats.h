@@ -0,0 +1,127 @@
+/*
+ * dispatch_stats.h
+ * Copyright (C) 2024 youfa <vsyfar@gmail.com>
+ *
+ * Distributed under terms of the GPLv2 license.
+ */
+
+#ifndef DISPATCH_STATS_H
+#define DISPATCH_STATS_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#include "base/constructor_magic.h"
+
+namespace ave {
+namespace media {
+
+// Histogram of durations in microseconds with power of two buckets: bucket
+// 0 counts 0us, bucket i counts [2^(i-1), 2^i) us, the last one everything
+// above. Record() is a handful of relaxed stores and must only be called by
+// one thread at a time, snapshot() may be called from any thread.
+class LatencyHistogram {
+ public:
+  static constexpr size_t kBuckets = 32;
+
+  struct Snapshot {
+    std::array<uint64_t, kBuckets> counts{};
+    uint64_t count = 0;
+    int64_t sum_us = 0;
+    int64_t max_us = 0;
+
+    // upper bound of the bucket holding the |p| quantile, p in [0, 1]
+    int64_t PercentileUs(double p) const;
+    int64_t MeanUs() const {
+      return count == 0 ? 0 : sum_us / static_cast<int64_t>(count);
+    }
+  };
+
+  LatencyHistogram() { reset(); }
+
+  void Record(int64_t us) {
+    if (us < 0) {
+      us = 0;
+    }
+    Bump(counts_[BucketFor(us)], 1);
+    Bump(count_, 1);
+    Bump(sum_us_, us);
+    if (us > max_us_.load(std::memory_order_relaxed)) {
+      max_us_.store(us, std::memory_order_relaxed);
+    }
+  }
+
+  Snapshot snapshot() const;
+  void reset();
+
+  // exclusive upper bound of |bucket|, in us
+  static int64_t BucketLimitUs(size_t bucket);
+
+ private:
+  static size_t BucketFor(int64_t us) {
+    size_t bucket = 0;
+    while (us > 0 && bucket + 1 < kBuckets) {
+      us >>= 1;
+      bucket++;
+    }
+    return bucket;
+  }
+
+  // single writer, a plain read-modify-write is enough
+  template <typename T>
+  static void Bump(std::atomic<T>& counter, std::common_type_t<T> delta) {
+    counter.store(counter.load(std::memory_order_relaxed) + delta,
+                  std::memory_order_relaxed);
+  }
+
+  std::array<std::atomic<uint64_t>, kBuckets> counts_;
+  std::atomic<uint64_t> count_;
+  std::atomic<int64_t> sum_us_;
+  std::atomic<int64_t> max_us_;
+
+  AVE_DISALLOW_COPY_AND_ASSIGN(LatencyHistogram);
+};
+
+// How messages were dispatched, kept by a Looper and by each of its
+// Handlers while Looper::enableStats() is on.
+class DispatchStats {
+ public:
+  struct Snapshot {
+    // Clock::NowUs() of the looper when the snapshot was taken
+    int64_t time_us = 0;
+    uint64_t messages = 0;
+    // dispatch time minus the time the message was due, i.e. the post
+    // time for immediate messages and the deadline for delayed ones
+    LatencyHistogram::Snapshot latency;
+    // time spent in the handler
+    LatencyHistogram::Snapshot execution;
+  };
+
+  DispatchStats() = default;
+
+  void Record(int64_t latency_us, int64_t execution_us) {
+    latency_.Record(latency_us);
+    execution_.Record(execution_us);
+  }
+
+  Snapshot snapshot(int64_t now_us) const;
+  void reset();
+
+  // messages per second dispatched between two snapshots
+  static double MessagesPerSecond(const Snapshot& earlier,
+                                  const Snapshot& later);
+
+ private:
+  LatencyHistogram latency_;
+  LatencyHistogram execution_;
+
+  AVE_DISALLOW_COPY_AND_ASSIGN(DispatchStats);
+};
+
+}  // namespace media
+}  // namespace ave
+
+#endif /* !DISPATCH_STATS_H */
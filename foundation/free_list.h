@@ -0,0 +1,164 @@
+/*
+ * free_list.h
+ * Copyright (C) 2024 youfa <vsyfar@gmail.com>
+ *
+ * Distributed under terms of the GPLv2 license.
+ */
+
+#ifndef FREE_LIST_H
+#define FREE_LIST_H
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace ave {
+namespace media {
+
+// Process wide free list of heap allocated T objects. Every thread keeps a
+// small cache, caches trade whole batches with a shared depot, so objects
+// released on a looper thread flow back to the threads that allocate them.
+// Objects put into the list must come from |new T|, objects that do not fit
+// in the depot are deleted.
+template <typename T>
+class FreeList {
+ public:
+  static constexpr size_t kCacheSize = 64;
+  static constexpr size_t kBatchSize = kCacheSize / 2;
+  static constexpr size_t kDepotSize = 4096;
+
+  // Returns a recycled object, or nullptr if there is none.
+  static T* Get() {
+    if (CacheDestroyed()) {
+      return nullptr;
+    }
+    Cache& cache = GetCache();
+    if (cache.objects.empty()) {
+      GetDepot().Take(cache.objects, kBatchSize);
+      if (cache.objects.empty()) {
+        return nullptr;
+      }
+    }
+    T* object = cache.objects.back();
+    cache.objects.pop_back();
+    return object;
+  }
+
+  static void Put(T* object) {
+    // released by another thread_local destructor after ours ran
+    if (CacheDestroyed()) {
+      delete object;
+      return;
+    }
+    Cache& cache = GetCache();
+    if (cache.objects.size() >= kCacheSize) {
+      GetDepot().Give(cache.objects, kBatchSize);
+    }
+    cache.objects.push_back(object);
+  }
+
+ private:
+  struct Depot {
+    std::mutex mutex;
+    std::vector<T*> objects;
+
+    void Take(std::vector<T*>& to, size_t count) {
+      std::lock_guard<std::mutex> guard(mutex);
+      while (count-- > 0 && !objects.empty()) {
+        to.push_back(objects.back());
+        objects.pop_back();
+      }
+    }
+
+    void Give(std::vector<T*>& from, size_t count) {
+      std::lock_guard<std::mutex> guard(mutex);
+      while (count-- > 0 && !from.empty()) {
+        if (objects.size() < kDepotSize) {
+          objects.push_back(from.back());
+        } else {
+          delete from.back();
+        }
+        from.pop_back();
+      }
+    }
+  };
+
+  struct Cache {
+    Cache() { objects.reserve(kCacheSize); }
+    // thread exit, hand everything to the depot
+    ~Cache() {
+      CacheDestroyed() = true;
+      GetDepot().Give(objects, objects.size());
+    }
+    std::vector<T*> objects;
+  };
+
+  static Cache& GetCache() {
+    thread_local Cache cache;
+    return cache;
+  }
+
+  // trivially destructible, so still valid while other thread_locals die
+  static bool& CacheDestroyed() {
+    thread_local bool destroyed = false;
+    return destroyed;
+  }
+
+  // never destroyed, objects may still be released during static destruction
+  static Depot& GetDepot() {
+    static Depot* depot = new Depot();
+    return *depot;
+  }
+};
+
+// std allocator recycling single-object allocations through FreeList, e.g.
+// for the control blocks of std::allocate_shared or pooled shared_ptrs.
+template <typename T>
+class PooledAllocator {
+ public:
+  using value_type = T;
+
+  PooledAllocator() = default;
+  template <typename U>
+  PooledAllocator(const PooledAllocator<U>& /* other */) {}  // NOLINT
+
+  T* allocate(size_t n) {
+    if (n != 1) {
+      return std::allocator<T>().allocate(n);
+    }
+    Storage* storage = FreeList<Storage>::Get();
+    if (storage == nullptr) {
+      storage = new Storage();
+    }
+    return reinterpret_cast<T*>(storage);
+  }
+
+  void deallocate(T* p, size_t n) {
+    if (n != 1) {
+      std::allocator<T>().deallocate(p, n);
+      return;
+    }
+    FreeList<Storage>::Put(reinterpret_cast<Storage*>(p));
+  }
+
+  template <typename U>
+  bool operator==(const PooledAllocator<U>& /* other */) const {
+    return true;
+  }
+  template <typename U>
+  bool operator!=(const PooledAllocator<U>& /* other */) const {
+    return false;
+  }
+
+ private:
+  struct Storage {
+    alignas(T) unsigned char bytes[sizeof(T)];
+  };
+};
+
+}  // namespace media
+}  // namespace ave
+
+#endif /* !FREE_LIST_H */
@@ -7,13 +7,42 @@
 
 #include "handler.h"
 
+#include "message.h"
+
 namespace ave {
 namespace media {
 
 void Handler::deliverMessage(const std::shared_ptr<Message>& message) {
-  onMessageReceived(message);
+  if (observed_.load(std::memory_order_acquire)) {
+    std::shared_ptr<MessageObserver> observer;
+    {
+      std::lock_guard<std::mutex> guard(observer_mutex_);
+      observer = observer_;
+    }
+    if (observer != nullptr) {
+      auto looper = looper_.lock();
+      observer->onMessageDelivered(*this, *message,
+                                   looper != nullptr ? looper->clock()->NowUs()
+                                                     : Looper::getNowUs());
+    }
+  }
+  if (!message->hasPayload() || !onPayloadReceived(message)) {
+    onMessageReceived(message);
+  }
   message_counter_++;
 }
 
+void Handler::setObserver(std::shared_ptr<MessageObserver> observer) {
+  std::lock_guard<std::mutex> guard(observer_mutex_);
+  observed_.store(observer != nullptr, std::memory_order_release);
+  observer_ = std::move(observer);
+}
+
+DispatchStats::Snapshot Handler::stats() const {
+  auto looper = looper_.lock();
+  return stats_.snapshot(looper != nullptr ? looper->clock()->NowUs()
+                                           : Looper::getNowUs());
+}
+
 }  // namespace media
 }  // namespace ave
@@ -8,21 +8,37 @@
 #ifndef AVE_HANDLER_H
 #define AVE_HANDLER_H
 
+#include <atomic>
 #include <memory>
+#include <mutex>
 
+#include "base/attributes.h"
 #include "base/constructor_magic.h"
 #include "looper.h"
 
 namespace ave {
 namespace media {
 
+class Handler;
 class Message;
 
+// Sees the messages delivered to a handler, see Handler::setObserver().
+class MessageObserver {
+ public:
+  virtual ~MessageObserver() = default;
+
+  // Runs on the looper thread right before |handler| gets |message|,
+  // |now_us| is the time on the looper's clock.
+  virtual void onMessageDelivered(const Handler& handler,
+                                  const Message& message,
+                                  int64_t now_us) = 0;
+};
+
 class Handler : public std::enable_shared_from_this<Handler> {
  public:
    Handler()
        : id_(static_cast<int32_t>(0)),
-         message_counter_(static_cast<uint32_t>(0)) {}
+         message_counter_(static_cast<uint32_t>(0)), observed_(false) {}
    virtual ~Handler() = default;
 
    Looper::handler_id id() const { return id_; }
@@ -31,10 +47,27 @@ class Handler : public std::enable_shared_from_this<Handler> {
 
    std::weak_ptr<Looper> getLooper() const { return looper_; }
 
+   // dispatch statistics, recorded while the looper's stats are enabled,
+   // see Looper::enableStats()
+   DispatchStats::Snapshot stats() const;
+
+   // Shows every message delivered from now on to |observer| first, e.g.
+   // a MessageRecorder. nullptr removes the observer, a delivery already
+   // under way may still reach it.
+   void setObserver(std::shared_ptr<MessageObserver> observer);
+
  protected:
   virtual void onMessageReceived(const std::shared_ptr<Message>& message) = 0;
 
+  // Offered every message carrying a payload before onMessageReceived(),
+  // returns true if it consumed the message. See TypedHandler.
+  virtual bool onPayloadReceived(
+      const std::shared_ptr<Message>& message AVE_MAYBE_UNUSED) {
+    return false;
+  }
+
  private:
+  friend class Looper;
   friend class Message;
   friend class HandlerRoster;
 
@@ -42,6 +75,12 @@ class Handler : public std::enable_shared_from_this<Handler> {
   std::weak_ptr<Looper> looper_;
 
   uint32_t message_counter_;
+  DispatchStats stats_;
+
+  // observer_ is set, checked before taking observer_mutex_
+  std::atomic<bool> observed_;
+  std::mutex observer_mutex_;
+  std::shared_ptr<MessageObserver> observer_;
 
   inline void setId(Looper::handler_id id,
                     const std::weak_ptr<Looper>& looper) {
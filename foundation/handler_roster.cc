@@ -9,6 +9,7 @@
 
 #include <memory>
 #include <mutex>
+#include <thread>
 
 #include "handler.h"
 #include "looper.h"
@@ -17,12 +18,20 @@
 namespace ave {
 namespace media {
 
+HandlerRoster::Shard::Shard() : table_(new Table()), epoch_(0) {
+  readers_[0].store(0, std::memory_order_relaxed);
+  readers_[1].store(0, std::memory_order_relaxed);
+}
+
+HandlerRoster::Shard::~Shard() {
+  delete table_.load(std::memory_order_relaxed);
+}
+
 HandlerRoster::HandlerRoster() : next_handler_id_(static_cast<int32_t>(1)) {}
 
 Looper::handler_id
 HandlerRoster::registerHandler(const std::shared_ptr<Looper> &looper,
                                const std::shared_ptr<Handler> &handler) {
-  std::lock_guard<std::mutex> guard(mutex_);
   if (handler->id() != 0) {
     return static_cast<int32_t>(-1);
   }
@@ -30,9 +39,15 @@ HandlerRoster::registerHandler(const std::shared_ptr<Looper> &looper,
   HandlerInfo info;
   info.looper_ = looper;
   info.handler_ = handler;
-  auto handler_id = static_cast<Looper::handler_id>(
-      static_cast<int32_t>(next_handler_id_) + 1);
-  handlers_.emplace(handler_id, info);
+  auto handler_id = next_handler_id_.fetch_add(1, std::memory_order_relaxed);
+
+  Shard &shard = shardFor(handler_id);
+  {
+    std::lock_guard<std::mutex> guard(shard.mutex_);
+    auto *table = new Table(*shard.table_.load(std::memory_order_relaxed));
+    table->emplace(handler_id, info);
+    publish(shard, table);
+  }
 
   handler->setId(handler_id, looper);
 
@@ -40,18 +55,72 @@ HandlerRoster::registerHandler(const std::shared_ptr<Looper> &looper,
 }
 
 void HandlerRoster::unregisterHandler(Looper::handler_id handler_id) {
-  std::lock_guard<std::mutex> guard(mutex_);
-
-  auto it = handlers_.find(handler_id);
-  if (it != handlers_.end()) {
-    HandlerInfo info = it->second;
-    std::shared_ptr<Handler> handler = info.handler_.lock();
-    if (handler != nullptr) {
-      handler->setId(static_cast<int32_t>(0), std::weak_ptr<Looper>());
+  Shard &shard = shardFor(handler_id);
+  HandlerInfo info;
+  {
+    std::lock_guard<std::mutex> guard(shard.mutex_);
+    const Table *current = shard.table_.load(std::memory_order_relaxed);
+    auto it = current->find(handler_id);
+    if (it == current->end()) {
+      return;
     }
+    info = it->second;
+
+    auto *table = new Table(*current);
+    table->erase(handler_id);
+    publish(shard, table);
+  }
+
+  std::shared_ptr<Handler> handler = info.handler_.lock();
+  if (handler != nullptr) {
+    handler->setId(static_cast<int32_t>(0), std::weak_ptr<Looper>());
+  }
+}
 
-    handlers_.erase(it);
+std::shared_ptr<Handler>
+HandlerRoster::findHandler(Looper::handler_id handler_id) const {
+  HandlerInfo info;
+  return lookup(handler_id, info) ? info.handler_.lock() : nullptr;
+}
+
+std::shared_ptr<Looper>
+HandlerRoster::findLooper(Looper::handler_id handler_id) const {
+  HandlerInfo info;
+  return lookup(handler_id, info) ? info.looper_.lock() : nullptr;
+}
+
+HandlerRoster::Shard &
+HandlerRoster::shardFor(Looper::handler_id handler_id) const {
+  return shards_[static_cast<uint32_t>(handler_id) % kShards];
+}
+
+bool HandlerRoster::lookup(Looper::handler_id handler_id,
+                           HandlerInfo &info) const {
+  Shard &shard = shardFor(handler_id);
+  // seq_cst throughout, pairs with the epoch flips in publish()
+  uint32_t parity = shard.epoch_.load(std::memory_order_seq_cst) & 1;
+  shard.readers_[parity].fetch_add(1, std::memory_order_seq_cst);
+  const Table *table = shard.table_.load(std::memory_order_seq_cst);
+  auto it = table->find(handler_id);
+  bool found = it != table->end();
+  if (found) {
+    info = it->second;
+  }
+  shard.readers_[parity].fetch_sub(1, std::memory_order_release);
+  return found;
+}
+
+void HandlerRoster::publish(Shard &shard, const Table *table) {
+  const Table *old = shard.table_.exchange(table, std::memory_order_seq_cst);
+  // A reader may have read epoch_ before an earlier flip and counted
+  // itself under that parity only now, so wait for both parities.
+  for (int phase = 0; phase < 2; phase++) {
+    uint32_t parity = shard.epoch_.fetch_add(1, std::memory_order_seq_cst) & 1;
+    while (shard.readers_[parity].load(std::memory_order_acquire) != 0) {
+      std::this_thread::yield();
+    }
   }
+  delete old;
 }
 
 } // namespace media
@@ -8,6 +8,8 @@
 #ifndef AVE_HANDLERROSTER_H
 #define AVE_HANDLERROSTER_H
 
+#include <array>
+#include <atomic>
 #include <memory>
 #include <mutex>
 #include <unordered_map>
@@ -18,6 +20,10 @@
 namespace ave {
 namespace media {
 
+// Maps handler ids to their handler and looper. Ids are unique and
+// increase monotonically. The roster is split in kShards shards by id,
+// each publishing an immutable table: lookups never block, register and
+// unregister copy their shard's table and wait out readers of the old one.
 class HandlerRoster {
  public:
   HandlerRoster();
@@ -28,16 +34,42 @@ class HandlerRoster {
 
   void unregisterHandler(Looper::handler_id handler_id);
 
+  // wait-free, nullptr if |handler_id| is not registered or already gone
+  std::shared_ptr<Handler> findHandler(Looper::handler_id handler_id) const;
+  std::shared_ptr<Looper> findLooper(Looper::handler_id handler_id) const;
+
  private:
+  static constexpr size_t kShards = 16;
+
   struct HandlerInfo {
     std::weak_ptr<Looper> looper_;
     std::weak_ptr<Handler> handler_;
   };
 
-  std::mutex mutex_;
-  std::unordered_map<Looper::handler_id, HandlerInfo> handlers_;
+  using Table = std::unordered_map<Looper::handler_id, HandlerInfo>;
+
+  // Readers count themselves in readers_[epoch_ & 1] while they use table_.
+  // A writer swaps table_, then flips epoch_ twice, each time waiting for
+  // the readers of the previous parity, before deleting the old table.
+  struct alignas(64) Shard {
+    Shard();
+    ~Shard();
+
+    // serializes writers
+    std::mutex mutex_;
+    std::atomic<const Table *> table_;
+    std::atomic<uint32_t> epoch_;
+    std::atomic<int32_t> readers_[2];
+  };
+
+  Shard &shardFor(Looper::handler_id handler_id) const;
+  bool lookup(Looper::handler_id handler_id, HandlerInfo &info) const;
+  // publishes |table| and deletes the old one, called with mutex_ held
+  static void publish(Shard &shard, const Table *table);
+
+  mutable std::array<Shard, kShards> shards_;
 
-  Looper::handler_id next_handler_id_;
+  std::atomic<Looper::handler_id> next_handler_id_;
 
   AVE_DISALLOW_COPY_AND_ASSIGN(HandlerRoster);
 };
@@ -29,31 +29,54 @@ static const uint8_t kHevcNalUnitTypes[8] = {
 HevcParameterSets::HevcParameterSets() : mInfo(kInfoNone) {}
 
 status_t HevcParameterSets::addNalUnit(const uint8_t* data, size_t size) {
+  uint8_t nalUnitType = 0;
+  status_t err = parseNalUnit(data, size, &nalUnitType);
+  if (err != OK) {
+    return err;
+  }
+  mNalUnits.push_back({media::Buffer::CreateAsCopy(data, size), nalUnitType});
+  return OK;
+}
+
+status_t HevcParameterSets::addNalUnit(
+    const std::shared_ptr<media::Buffer>& nalUnit) {
+  uint8_t nalUnitType = 0;
+  status_t err = parseNalUnit(nalUnit->data(), nalUnit->size(), &nalUnitType);
+  if (err != OK) {
+    return err;
+  }
+  mNalUnits.push_back({nalUnit, nalUnitType});
+  return OK;
+}
+
+status_t HevcParameterSets::parseNalUnit(const uint8_t* data,
+                                         size_t size,
+                                         uint8_t* nalUnitType) {
   if (size < 1) {
     AVE_LOG(LS_ERROR) << "empty NAL b/35467107";
-    return ERROR_MALFORMED;
+    return media::ERROR_MALFORMED;
   }
-  uint8_t nalUnitType = (data[0] >> 1) & 0x3f;
+  *nalUnitType = (data[0] >> 1) & 0x3f;
   status_t err = OK;
-  switch (nalUnitType) {
+  switch (*nalUnitType) {
     case 32:  // VPS
       if (size < 2) {
         AVE_LOG(LS_ERROR) << "invalid NAL/VPS size b/35467107";
-        return ERROR_MALFORMED;
+        return media::ERROR_MALFORMED;
       }
       err = parseVps(data + 2, size - 2);
       break;
     case 33:  // SPS
       if (size < 2) {
         AVE_LOG(LS_ERROR) << "invalid NAL/SPS size b/35467107";
-        return ERROR_MALFORMED;
+        return media::ERROR_MALFORMED;
       }
       err = parseSps(data + 2, size - 2);
       break;
     case 34:  // PPS
       if (size < 2) {
         AVE_LOG(LS_ERROR) << "invalid NAL/PPS size b/35467107";
-        return ERROR_MALFORMED;
+        return media::ERROR_MALFORMED;
       }
       err = parsePps(data + 2, size - 2);
       break;
@@ -63,17 +86,13 @@ status_t HevcParameterSets::addNalUnit(const uint8_t* data, size_t size) {
       break;
     default:
       AVE_LOG(LS_ERROR) << "Unrecognized NAL unit type.";
-      return ERROR_MALFORMED;
+      return media::ERROR_MALFORMED;
   }
 
   if (err != OK) {
     AVE_LOG(LS_ERROR) << "error parsing VPS or SPS or PPS";
     return err;
   }
-
-  auto buffer = Buffer::CreateAsCopy(data, size);
-  buffer->setInt32Data(nalUnitType);
-  mNalUnits.push_back(buffer);
   return OK;
 }
 
@@ -120,17 +139,17 @@ size_t HevcParameterSets::getNumNalUnitsOfType(uint8_t type) {
 
 uint8_t HevcParameterSets::getType(size_t index) {
   AVE_CHECK_LT(index, mNalUnits.size());
-  return mNalUnits[index]->int32Data();
+  return mNalUnits[index].type;
 }
 
 size_t HevcParameterSets::getSize(size_t index) {
   AVE_CHECK_LT(index, mNalUnits.size());
-  return mNalUnits[index]->size();
+  return mNalUnits[index].buffer->size();
 }
 
 bool HevcParameterSets::write(size_t index, uint8_t* dest, size_t size) {
   AVE_CHECK_LT(index, mNalUnits.size());
-  const std::shared_ptr<Buffer>& nalUnit = mNalUnits[index];
+  const std::shared_ptr<media::Buffer>& nalUnit = mNalUnits[index].buffer;
   if (size < nalUnit->size()) {
     AVE_LOG(LS_ERROR) << "dest buffer size too small: " << size << " vs. "
                       << nalUnit->size() << " to be written";
@@ -142,7 +161,7 @@ bool HevcParameterSets::write(size_t index, uint8_t* dest, size_t size) {
 
 status_t HevcParameterSets::parseVps(const uint8_t* data, size_t size) {
   // See Rec. ITU-T H.265 v3 (04/2015) Chapter 7.3.2.1 for reference
-  NALBitReader reader(data, size);
+  media::NALBitReader reader(data, size);
   // Skip vps_video_parameter_set_id
   reader.skipBits(4);
   // Skip vps_base_layer_internal_flag
@@ -171,12 +190,15 @@ status_t HevcParameterSets::parseVps(const uint8_t* data, size_t size) {
     reader.skipBits(96);
   }
 
-  return reader.overRead() ? ERROR_MALFORMED : OK;
+  if (reader.overRead()) {
+    return media::ERROR_MALFORMED;
+  }
+  return OK;
 }
 
 status_t HevcParameterSets::parseSps(const uint8_t* data, size_t size) {
   // See Rec. ITU-T H.265 v3 (04/2015) Chapter 7.3.2.2 for reference
-  NALBitReader reader(data, size);
+  media::NALBitReader reader(data, size);
   // Skip sps_video_parameter_set_id
   reader.skipBits(4);
   uint8_t maxSubLayersMinus1 = reader.getBitsWithFallback(3, 0);
@@ -205,46 +227,49 @@ status_t HevcParameterSets::parseSps(const uint8_t* data, size_t size) {
     }
   }
   // Skip sps_seq_parameter_set_id
-  skipUE(&reader);
-  uint8_t chromaFormatIdc = parseUEWithFallback(&reader, 0);
+  media::skipUE(&reader);
+  uint8_t chromaFormatIdc = media::parseUEWithFallback(&reader, 0);
   mParams.emplace(kChromaFormatIdc, chromaFormatIdc);
   if (chromaFormatIdc == 3) {
     // Skip separate_colour_plane_flag
     reader.skipBits(1);
   }
   // Skip pic_width_in_luma_samples
-  skipUE(&reader);
+  media::skipUE(&reader);
   // Skip pic_height_in_luma_samples
-  skipUE(&reader);
+  media::skipUE(&reader);
   if (reader.getBitsWithFallback(1, 0) /* i.e. conformance_window_flag */) {
     // Skip conf_win_left_offset
-    skipUE(&reader);
+    media::skipUE(&reader);
     // Skip conf_win_right_offset
-    skipUE(&reader);
+    media::skipUE(&reader);
     // Skip conf_win_top_offset
-    skipUE(&reader);
+    media::skipUE(&reader);
     // Skip conf_win_bottom_offset
-    skipUE(&reader);
+    media::skipUE(&reader);
   }
-  mParams.emplace(kBitDepthLumaMinus8, parseUEWithFallback(&reader, 0));
-  mParams.emplace(kBitDepthChromaMinus8, parseUEWithFallback(&reader, 0));
+  mParams.emplace(kBitDepthLumaMinus8,
+                  media::parseUEWithFallback(&reader, 0));
+  mParams.emplace(kBitDepthChromaMinus8,
+                  media::parseUEWithFallback(&reader, 0));
 
   // log2_max_pic_order_cnt_lsb_minus4
-  size_t log2MaxPicOrderCntLsb = parseUEWithFallback(&reader, 0) + (size_t)4;
+  size_t log2MaxPicOrderCntLsb =
+      media::parseUEWithFallback(&reader, 0) + (size_t)4;
   bool spsSubLayerOrderingInfoPresentFlag = reader.getBitsWithFallback(1, 0);
   for (uint32_t i = spsSubLayerOrderingInfoPresentFlag ? 0 : maxSubLayersMinus1;
        i <= maxSubLayersMinus1; ++i) {
-    skipUE(&reader);  // sps_max_dec_pic_buffering_minus1[i]
-    skipUE(&reader);  // sps_max_num_reorder_pics[i]
-    skipUE(&reader);  // sps_max_latency_increase_plus1[i]
+    media::skipUE(&reader);  // sps_max_dec_pic_buffering_minus1[i]
+    media::skipUE(&reader);  // sps_max_num_reorder_pics[i]
+    media::skipUE(&reader);  // sps_max_latency_increase_plus1[i]
   }
 
-  skipUE(&reader);  // log2_min_luma_coding_block_size_minus3
-  skipUE(&reader);  // log2_diff_max_min_luma_coding_block_size
-  skipUE(&reader);  // log2_min_luma_transform_block_size_minus2
-  skipUE(&reader);  // log2_diff_max_min_luma_transform_block_size
-  skipUE(&reader);  // max_transform_hierarchy_depth_inter
-  skipUE(&reader);  // max_transform_hierarchy_depth_intra
+  media::skipUE(&reader);  // log2_min_luma_coding_block_size_minus3
+  media::skipUE(&reader);  // log2_diff_max_min_luma_coding_block_size
+  media::skipUE(&reader);  // log2_min_luma_transform_block_size_minus2
+  media::skipUE(&reader);  // log2_diff_max_min_luma_transform_block_size
+  media::skipUE(&reader);  // max_transform_hierarchy_depth_inter
+  media::skipUE(&reader);  // max_transform_hierarchy_depth_intra
   if (reader.getBitsWithFallback(1, 0)) {  // scaling_list_enabled_flag u(1)
     // scaling_list_data
     if (reader.getBitsWithFallback(1,
@@ -254,16 +279,16 @@ status_t HevcParameterSets::parseSps(const uint8_t* data, size_t size) {
              matrixId += (sizeId == 3) ? 3 : 1) {
           if (!reader.getBitsWithFallback(1, 1)) {
             // scaling_list_pred_mode_flag[sizeId][matrixId]
-            skipUE(
+            media::skipUE(
                 &reader);  // scaling_list_pred_matrix_id_delta[sizeId][matrixId]
           } else {
             uint32_t coefNum = std::min(64, (1 << (4 + (sizeId << 1))));
             if (sizeId > 1) {
-              skipSE(&reader);  // scaling_list_dc_coef_minus8[sizeId −
+              media::skipSE(&reader);  // scaling_list_dc_coef_minus8[sizeId −
                                 // 2][matrixId]
             }
             for (uint32_t i = 0; i < coefNum; ++i) {
-              skipSE(&reader);  // scaling_list_delta_coef
+              media::skipSE(&reader);  // scaling_list_delta_coef
             }
           }
         }
@@ -275,18 +300,18 @@ status_t HevcParameterSets::parseSps(const uint8_t* data, size_t size) {
   if (reader.getBitsWithFallback(1, 0)) {  // pcm_enabled_flag
     reader.skipBits(4);                    // pcm_sample_bit_depth_luma_minus1
     reader.skipBits(4);  // pcm_sample_bit_depth_chroma_minus1 u(4)
-    skipUE(&reader);     // log2_min_pcm_luma_coding_block_size_minus3
-    skipUE(&reader);     // log2_diff_max_min_pcm_luma_coding_block_size
+    media::skipUE(&reader);     // log2_min_pcm_luma_coding_block_size_minus3
+    media::skipUE(&reader);     // log2_diff_max_min_pcm_luma_coding_block_size
     reader.skipBits(1);  // pcm_loop_filter_disabled_flag
   }
-  uint32_t numShortTermRefPicSets = parseUEWithFallback(&reader, 0);
+  uint32_t numShortTermRefPicSets = media::parseUEWithFallback(&reader, 0);
   uint32_t numPics = 0;
   for (uint32_t i = 0; i < numShortTermRefPicSets; ++i) {
     // st_ref_pic_set(i)
     if (i != 0 && reader.getBitsWithFallback(
                       1, 0)) {  // inter_ref_pic_set_prediction_flag
       reader.skipBits(1);       // delta_rps_sign
-      skipUE(&reader);          // abs_delta_rps_minus1
+      media::skipUE(&reader);          // abs_delta_rps_minus1
       uint32_t nextNumPics = 0;
       for (uint32_t j = 0; j <= numPics; ++j) {
         if (reader.getBitsWithFallback(1, 0)        // used_by_curr_pic_flag[j]
@@ -296,31 +321,31 @@ status_t HevcParameterSets::parseSps(const uint8_t* data, size_t size) {
       }
       numPics = nextNumPics;
     } else {
-      uint32_t numNegativePics = parseUEWithFallback(&reader, 0);
-      uint32_t numPositivePics = parseUEWithFallback(&reader, 0);
+      uint32_t numNegativePics = media::parseUEWithFallback(&reader, 0);
+      uint32_t numPositivePics = media::parseUEWithFallback(&reader, 0);
       if (numNegativePics > UINT32_MAX - numPositivePics) {
-        return ERROR_MALFORMED;
+        return media::ERROR_MALFORMED;
       }
       numPics = numNegativePics + numPositivePics;
       for (uint32_t j = 0; j < numPics; ++j) {
-        skipUE(&reader);     // delta_poc_s0|1_minus1[i]
+        media::skipUE(&reader);     // delta_poc_s0|1_minus1[i]
         reader.skipBits(1);  // used_by_curr_pic_s0|1_flag[i]
         if (reader.overRead()) {
-          return ERROR_MALFORMED;
+          return media::ERROR_MALFORMED;
         }
       }
     }
     if (reader.overRead()) {
-      return ERROR_MALFORMED;
+      return media::ERROR_MALFORMED;
     }
   }
   if (reader.getBitsWithFallback(1, 0)) {  // long_term_ref_pics_present_flag
-    uint32_t numLongTermRefPicSps = parseUEWithFallback(&reader, 0);
+    uint32_t numLongTermRefPicSps = media::parseUEWithFallback(&reader, 0);
     for (uint32_t i = 0; i < numLongTermRefPicSps; ++i) {
       reader.skipBits(log2MaxPicOrderCntLsb);  // lt_ref_pic_poc_lsb_sps[i]
       reader.skipBits(1);  // used_by_curr_pic_lt_sps_flag[i]
       if (reader.overRead()) {
-        return ERROR_MALFORMED;
+        return media::ERROR_MALFORMED;
       }
     }
   }
@@ -365,16 +390,19 @@ status_t HevcParameterSets::parseSps(const uint8_t* data, size_t size) {
     }
   }
 
-  return reader.overRead() ? ERROR_MALFORMED : OK;
+  if (reader.overRead()) {
+    return media::ERROR_MALFORMED;
+  }
+  return OK;
 }
 
 void HevcParameterSets::FindHEVCDimensions(
-    const std::shared_ptr<Buffer>& SpsBuffer,
+    const std::shared_ptr<media::Buffer>& SpsBuffer,
     int32_t* width,
     int32_t* height) {
   AVE_LOG(LS_DEBUG) << "FindHEVCDimensions";
   // See Rec. ITU-T H.265 v3 (04/2015) Chapter 7.3.2.2 for reference
-  BitReader reader(SpsBuffer->data() + 1, SpsBuffer->size() - 1);
+  media::BitReader reader(SpsBuffer->data() + 1, SpsBuffer->size() - 1);
   // Skip sps_video_parameter_set_id
   reader.skipBits(4);
   uint8_t maxSubLayersMinus1 = reader.getBitsWithFallback(3, 0);
@@ -403,19 +431,19 @@ void HevcParameterSets::FindHEVCDimensions(
     }
   }
   // Skip sps_seq_parameter_set_id
-  skipUE(&reader);
-  uint8_t chromaFormatIdc = parseUEWithFallback(&reader, 0);
+  media::skipUE(&reader);
+  uint8_t chromaFormatIdc = media::parseUEWithFallback(&reader, 0);
   if (chromaFormatIdc == 3) {
     // Skip separate_colour_plane_flag
     reader.skipBits(1);
   }
-  skipUE(&reader);
-  skipUE(&reader);
+  media::skipUE(&reader);
+  media::skipUE(&reader);
 
   // pic_width_in_luma_samples
-  *width = parseUEWithFallback(&reader, 0);
+  *width = media::parseUEWithFallback(&reader, 0);
   // pic_height_in_luma_samples
-  *height = parseUEWithFallback(&reader, 0);
+  *height = media::parseUEWithFallback(&reader, 0);
 }
 
 status_t HevcParameterSets::parsePps(const uint8_t* data UNUSED_PARAM,
@@ -455,23 +483,23 @@ status_t HevcParameterSets::makeHvcc(uint8_t* hvcc,
   if (!findParam8(kGeneralProfileSpace, &generalProfileSpace) ||
       !findParam8(kGeneralTierFlag, &generalTierFlag) ||
       !findParam8(kGeneralProfileIdc, &generalProfileIdc)) {
-    return ERROR_MALFORMED;
+    return media::ERROR_MALFORMED;
   }
   uint32_t compatibilityFlags;
   uint64_t constraintIdcFlags;
   if (!findParam32(kGeneralProfileCompatibilityFlags, &compatibilityFlags) ||
       !findParam64(kGeneralConstraintIndicatorFlags, &constraintIdcFlags)) {
-    return ERROR_MALFORMED;
+    return media::ERROR_MALFORMED;
   }
   uint8_t generalLevelIdc;
   if (!findParam8(kGeneralLevelIdc, &generalLevelIdc)) {
-    return ERROR_MALFORMED;
+    return media::ERROR_MALFORMED;
   }
   uint8_t chromaFormatIdc, bitDepthLumaMinus8, bitDepthChromaMinus8;
   if (!findParam8(kChromaFormatIdc, &chromaFormatIdc) ||
       !findParam8(kBitDepthLumaMinus8, &bitDepthLumaMinus8) ||
       !findParam8(kBitDepthChromaMinus8, &bitDepthChromaMinus8)) {
-    return ERROR_MALFORMED;
+    return media::ERROR_MALFORMED;
   }
   if (size > *hvccSize) {
     return NO_MEMORY;
@@ -536,12 +564,68 @@ status_t HevcParameterSets::makeHvcc(uint8_t* hvcc,
   return OK;
 }
 
+std::shared_ptr<media::Buffer> MakeHEVCCodecSpecificData(
+    const std::shared_ptr<media::Buffer>& accessUnit,
+    int32_t* width,
+    int32_t* height) {
+  HevcParameterSets paramSets;
+  std::shared_ptr<media::Buffer> seqParamSet;
+  const uint8_t* data = accessUnit->data();
+  size_t size = accessUnit->size();
+  const uint8_t* nalStart;
+  size_t nalSize;
+  while (media::getNextNALUnit(&data, &size, &nalStart, &nalSize, true) ==
+         OK) {
+    if (nalSize == 0) {
+      continue;
+    }
+    uint8_t nalType = (nalStart[0] >> 1) & 0x3f;
+    switch (nalType) {
+      case kHevcNalUnitTypeVps:
+      case kHevcNalUnitTypeSps:
+      case kHevcNalUnitTypePps:
+      case kHevcNalUnitTypePrefixSei:
+      case kHevcNalUnitTypeSuffixSei:
+        break;
+      default:
+        continue;
+    }
+    // referenced, not copied, until makeHvcc() writes them out
+    auto nalUnit = media::Buffer::Slice(
+        accessUnit, static_cast<size_t>(nalStart - accessUnit->data()),
+        nalSize);
+    if (paramSets.addNalUnit(nalUnit) != OK) {
+      return nullptr;
+    }
+    if (nalType == kHevcNalUnitTypeSps && seqParamSet == nullptr) {
+      seqParamSet = nalUnit;
+    }
+  }
+  if (seqParamSet == nullptr) {
+    return nullptr;
+  }
+
+  paramSets.FindHEVCDimensions(seqParamSet, width, height);
+
+  // header, then at most one array per NAL unit
+  size_t csdSize = 23;
+  for (size_t i = 0; i < paramSets.getNumNalUnits(); ++i) {
+    csdSize += 3 + 2 + paramSets.getSize(i);
+  }
+  auto csd = std::make_shared<media::Buffer>(csdSize);
+  if (paramSets.makeHvcc(csd->data(), &csdSize, 4) != OK) {
+    return nullptr;
+  }
+  csd->setRange(0, csdSize);
+  return csd;
+}
+
 bool HevcParameterSets::IsHevcIDR(const uint8_t* data, size_t size) {
   bool foundIDR = false;
   const uint8_t* nalStart;
   size_t nalSize;
   while (!foundIDR &&
-         getNextNALUnit(&data, &size, &nalStart, &nalSize, true) == OK) {
+         media::getNextNALUnit(&data, &size, &nalStart, &nalSize, true) == OK) {
     if (nalSize == 0) {
       AVE_LOG(LS_ERROR) << "Encountered zero-length HEVC NAL";
       return false;
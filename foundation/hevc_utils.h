@@ -70,7 +70,11 @@ class HevcParameterSets {
 
   HevcParameterSets();
 
+  // Copies the NAL unit.
   status_t addNalUnit(const uint8_t* data, size_t size);
+  // Keeps a reference to |nalUnit| instead, e.g. a Buffer::Slice() of the
+  // access unit it was found in. |nalUnit| is not modified.
+  status_t addNalUnit(const std::shared_ptr<media::Buffer>& nalUnit);
 
   bool findParam8(uint32_t key, uint8_t* param);
   bool findParam16(uint32_t key, uint16_t* param);
@@ -84,7 +88,7 @@ class HevcParameterSets {
   // Note that this method does not write the start code.
   bool write(size_t index, uint8_t* dest, size_t size);
   status_t makeHvcc(uint8_t* hvcc, size_t* hvccSize, size_t nalSizeLength);
-  void FindHEVCDimensions(const std::shared_ptr<Buffer>& SpsBuffer,
+  void FindHEVCDimensions(const std::shared_ptr<media::Buffer>& SpsBuffer,
                           int32_t* width,
                           int32_t* height);
 
@@ -92,17 +96,34 @@ class HevcParameterSets {
   static bool IsHevcIDR(const uint8_t* data, size_t size);
 
  private:
+  // Parses the NAL unit, and returns its type in |nalUnitType|.
+  status_t parseNalUnit(const uint8_t* data,
+                        size_t size,
+                        uint8_t* nalUnitType);
   status_t parseVps(const uint8_t* data, size_t size);
   status_t parseSps(const uint8_t* data, size_t size);
   status_t parsePps(const uint8_t* data, size_t size);
 
+  struct NalUnit {
+    std::shared_ptr<media::Buffer> buffer;
+    uint8_t type;
+  };
+
   // KeyedVector<uint32_t, uint64_t> mParams;
   std::unordered_map<uint32_t, uint64_t> mParams;
-  std::vector<std::shared_ptr<Buffer>> mNalUnits;
+  std::vector<NalUnit> mNalUnits;
   Info mInfo;
 
   AVE_DISALLOW_COPY_AND_ASSIGN(HevcParameterSets);
 };
+
+// Builds an hvcC from the VPS, SPS, PPS and SEI NAL units of the Annex B
+// |accessUnit|, parsing them in place. nullptr if there is no SPS or a
+// parameter set is malformed.
+std::shared_ptr<media::Buffer> MakeHEVCCodecSpecificData(
+    const std::shared_ptr<media::Buffer>& accessUnit,
+    int32_t* width,
+    int32_t* height);
 } /* namespace ave */
 
 #endif /* !HEVC_UTILS_H */
@@ -7,15 +7,19 @@
 
 #include "looper.h"
 
+#include <algorithm>
 #include <condition_variable>
+#include <limits>
 #include <memory>
 #include <mutex>
 #include <string>
 #include <thread>
 
-#include "base/attributes.h"
 #include "base/count_down_latch.h"
+#include "base/logging.h"
+#include "handler.h"
 #include "handler_roster.h"
+#include "looper_group.h"
 #include "message.h"
 
 namespace ave {
@@ -23,11 +27,42 @@ namespace media {
 
 HandlerRoster gRoster;
 
-Looper::Looper()
-    : priority_(static_cast<int32_t>(0)), thread_(nullptr), looping_(false),
-      start_latch_(1), stopped_(false) {}
+namespace {
+// the looper whose message this thread is dispatching
+thread_local Looper* tls_dispatching_looper = nullptr;
+}  // namespace
 
-Looper::~Looper() { stop(); }
+Looper::Looper() : Looper(DelayedQueueType::kPriorityQueue) {}
+
+Looper::Looper(DelayedQueueType type,
+               int64_t tick_us,
+               std::shared_ptr<Clock> clock)
+    : clock_(clock != nullptr ? std::move(clock) : Clock::GetDefault()),
+      priority_(static_cast<int32_t>(0)), thread_(nullptr), looping_(false),
+      start_latch_(1), stopped_(false), delayed_queue_type_(type),
+      next_sequence_(0),
+      next_delayed_us_(std::numeric_limits<int64_t>::max()), parked_(false),
+      wake_poller_(nullptr),
+      group_(nullptr), scheduled_(false), pending_(0),
+      armed_timer_us_(std::numeric_limits<int64_t>::max()),
+      direct_dispatch_(false), expired_remaining_(0), next_removal_id_(0),
+      has_removals_(false), stats_enabled_(false),
+      queue_depth_(0), peak_queue_depth_(0), watchdog_enabled_(false) {
+  if (delayed_queue_type_ == DelayedQueueType::kTimingWheel) {
+    timing_wheel_ = std::make_unique<TimingWheel<Event>>(
+        tick_us, clock_->NowUs());
+  }
+  // a simulated clock jumped, delayed messages may be due now
+  clock_wakeup_id_ = clock_->AddWakeup([this]() {
+    std::lock_guard<std::mutex> guard(mutex_);
+    wakeLoopLocked();
+  });
+}
+
+Looper::~Looper() {
+  stop();
+  clock_->RemoveWakeup(clock_wakeup_id_);
+}
 
 void Looper::setName(std::string name) { name_ = name; }
 
@@ -40,12 +75,25 @@ void Looper::unregisterHandler(handler_id handler_id) {
   gRoster.unregisterHandler(handler_id);
 }
 
-int32_t Looper::start(int32_t priority AVE_MAYBE_UNUSED) {
+std::shared_ptr<Handler> Looper::findHandler(handler_id handler_id) {
+  return gRoster.findHandler(handler_id);
+}
+
+void Looper::setCpuAffinity(std::vector<int32_t> cpus) {
+  cpu_affinity_ = std::move(cpus);
+}
+
+int32_t Looper::start(int32_t priority) {
+  if (group_ != nullptr) {
+    return static_cast<int32_t>(0);
+  }
   std::lock_guard<std::mutex> guard(mutex_);
   if (thread_ != nullptr) {
     return static_cast<int32_t>(-1);
   }
 
+  priority_ = priority;
+
   thread_ = std::make_unique<std::thread>(&Looper::loop, this);
   looping_ = true;
   start_latch_.Wait();
@@ -53,103 +101,768 @@ int32_t Looper::start(int32_t priority AVE_MAYBE_UNUSED) {
 }
 
 int32_t Looper::stop() {
+  if (watchdog_enabled_.exchange(false, std::memory_order_relaxed)) {
+    // before the thread is joined, the watchdog may signal it
+    LooperWatchdog::Get().remove(this);
+  }
+
+  if (group_ != nullptr) {
+    std::unique_lock<std::mutex> l(mutex_);
+    stopped_.store(true, std::memory_order_release);
+    looping_ = false;
+    // a worker can not wait for itself, nor block the rest of the group,
+    // and nothing runs any more once the group is going away
+    if (!group_->isWorkerThread() &&
+        !group_->stopping_.load(std::memory_order_acquire)) {
+      condition_.wait(l, [this]() {
+        return !scheduled_.load(std::memory_order_seq_cst) &&
+               pending_.load(std::memory_order_relaxed) == 0 &&
+               !hasDelayedEvents();
+      });
+    }
+    return static_cast<int32_t>(0);
+  }
+
   // TODO(youfa) support stop in loop thread.
   {
     std::lock_guard<std::mutex> guard(mutex_);
-    stopped_ = true;
+    stopped_.store(true, std::memory_order_release);
     looping_ = false;
-    condition_.notify_all();
+    wakeLoopLocked();
   }
   if (thread_ != nullptr) {
     thread_->join();
-    (void)thread_.release();
+    thread_.reset();
   }
   return static_cast<int32_t>(0);
 }
 
 void Looper::post(const std::shared_ptr<Message> &message, int64_t delay_us) {
+  postEvents(&message, 1, delay_us, false);
+}
+
+void Looper::postBatch(const std::vector<std::shared_ptr<Message>> &messages,
+                       int64_t delay_us) {
+  if (!messages.empty()) {
+    postEvents(messages.data(), messages.size(), delay_us, false);
+  }
+}
+
+void Looper::postCoalesced(const std::shared_ptr<Message> &message,
+                           int64_t delay_us) {
+  {
+    std::lock_guard<std::mutex> guard(coalesce_mutex_);
+    auto result = coalesced_.try_emplace(coalesceKey(*message), message);
+    if (!result.second) {
+      // the pending event delivers the latest message, see dispatch()
+      result.first->second = message;
+      return;
+    }
+  }
+  postEvents(&message, 1, delay_us, true);
+}
+
+std::shared_ptr<Looper::PendingMessage>
+Looper::postCancellable(const std::shared_ptr<Message> &message,
+                        int64_t delay_us) {
+  auto pending = std::allocate_shared<PendingMessage>(
+      PooledAllocator<PendingMessage>());
+  pending->looper_ = weak_from_this();
+  postEvents(&message, 1, delay_us, false, pending);
+  return pending;
+}
+
+bool Looper::PendingMessage::cancel() {
+  if (!transition(kCancelled)) {
+    return false;
+  }
+  auto looper = looper_.lock();
+  if (looper != nullptr) {
+    looper->unlinkCancelled(*this);
+  }
+  return true;
+}
+
+void Looper::unlinkCancelled(PendingMessage &pending) {
+  // destroyed after the lock is released, it may hold the last reference
+  // to the message and its payload
+  Event event;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (pending.wheel_node_ != nullptr) {
+      event = timing_wheel_->Cancel(pending.wheel_node_);
+      pending.wheel_node_ = nullptr;
+    } else if (pending.heap_index_ != PendingMessage::kNotQueued) {
+      event = heapRemove(pending.heap_index_);
+    } else {
+      // immediate, or already popped: dispatch() skips it
+      return;
+    }
+    queue_depth_.fetch_sub(1, std::memory_order_relaxed);
+    // next_delayed_us_ may now be early, the loop then wakes up for
+    // nothing and looks again
+  }
+}
+
+void Looper::removeMessages(const std::shared_ptr<Handler> &handler,
+                            uint32_t what) {
+  removeEvents(handler->id(), true, what);
+}
+
+void Looper::flush(const std::shared_ptr<Handler> &handler) {
+  removeEvents(handler->id(), false, 0);
+}
+
+void Looper::removeEvents(handler_id handler_id,
+                          bool match_what,
+                          uint32_t what) {
+  Removal removal{handler_id, match_what, what, 0};
+  auto removed = [&removal](const Event &event) {
+    if (!removes(removal, *event.message_)) {
+      return false;
+    }
+    if (event.pending_ != nullptr) {
+      // no longer queued, cancel() must not unlink it again
+      event.pending_->wheel_node_ = nullptr;
+      event.pending_->heap_index_ = PendingMessage::kNotQueued;
+    }
+    return true;
+  };
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    size_t count = 0;
+    int64_t next_us = std::numeric_limits<int64_t>::max();
+    if (timing_wheel_ != nullptr) {
+      count = timing_wheel_->RemoveIf(removed);
+      next_us = timing_wheel_->NextExpiryUs();
+    } else {
+      auto end =
+          std::remove_if(event_queue_.begin(), event_queue_.end(), removed);
+      count = static_cast<size_t>(event_queue_.end() - end);
+      event_queue_.erase(end, event_queue_.end());
+      std::make_heap(event_queue_.begin(), event_queue_.end(), EventOrder());
+      for (size_t i = 0; i < event_queue_.size(); i++) {
+        heapPlaced(i);
+      }
+      if (!event_queue_.empty()) {
+        next_us = event_queue_.front().when_us_;
+      }
+    }
+    queue_depth_.fetch_sub(static_cast<int64_t>(count),
+                           std::memory_order_relaxed);
+    next_delayed_us_.store(next_us, std::memory_order_release);
+
+    removal.id_ = next_removal_id_++;
+    removals_.push_back(removal);
+    has_removals_.store(true, std::memory_order_seq_cst);
+  }
+  {
+    std::lock_guard<std::mutex> guard(coalesce_mutex_);
+    for (auto it = coalesced_.begin(); it != coalesced_.end();) {
+      it = removes(removal, *it->second) ? coalesced_.erase(it) : ++it;
+    }
+  }
+
+  // the queue is FIFO, once the loop dequeues the marker every event
+  // posted before the removal has been checked
+  if (group_ != nullptr) {
+    pending_.fetch_add(1, std::memory_order_seq_cst);
+  }
+  Event marker;
+  marker.when_us_ = clock_->NowUs();
+  marker.sequence_ = removal.id_;
+  immediate_queue_.Push(std::move(marker));
+  wakeForImmediate();
+}
+
+bool Looper::removes(const Removal &removal, const Message &message) {
+  return message.handler_id_ == removal.handler_id_ &&
+         (!removal.match_what_ || message.what_ == removal.what_);
+}
+
+// Returns true if the dequeued or direct |event| must not be dispatched: a
+// removal marker, or an event a pending removal applies to.
+bool Looper::skipImmediate(Event &event) {
+  if (!has_removals_.load(std::memory_order_acquire)) {
+    return false;
+  }
+
   std::lock_guard<std::mutex> guard(mutex_);
-  if (stopped_) {
+  if (event.message_ == nullptr) {
+    removals_.erase(std::remove_if(removals_.begin(), removals_.end(),
+                                   [&event](const Removal &removal) {
+                                     return removal.id_ == event.sequence_;
+                                   }),
+                    removals_.end());
+    has_removals_.store(!removals_.empty(), std::memory_order_release);
+    return true;
+  }
+  for (const auto &removal : removals_) {
+    if (removes(removal, *event.message_)) {
+      queue_depth_.fetch_sub(1, std::memory_order_relaxed);
+      event.message_.reset();
+      return true;
+    }
+  }
+  return false;
+}
+
+void Looper::wakeForImmediate() {
+  if (group_ != nullptr) {
+    // seq_cst pairs with the end of runSlice()
+    if (!scheduled_.exchange(true, std::memory_order_seq_cst)) {
+      group_->schedule(shared_from_this());
+    }
     return;
   }
-  int64_t whenUs = 0;
-  if (delay_us > 0) {
-    int64_t nowUs = getNowUs();
-    whenUs = (delay_us > (std::numeric_limits<int64_t>::max() - nowUs)
-                  ? std::numeric_limits<int64_t>::max()
-                  : (nowUs + delay_us));
-  } else {
-    whenUs = getNowUs();
+  wakeIfParked();
+}
+
+void Looper::postEvents(const std::shared_ptr<Message> *messages,
+                        size_t count,
+                        int64_t delay_us,
+                        bool coalesced,
+                        std::shared_ptr<PendingMessage> pending) {
+  if (stopped_.load(std::memory_order_acquire)) {
+    return;
   }
 
-  std::unique_ptr<Event> event = std::make_unique<Event>();
-  event->when_us_ = whenUs;
-  event->message_ = std::move(message);
-  event_queue_.push(std::move(event));
-  condition_.notify_all();
+  int64_t nowUs = clock_->NowUs();
+  int64_t depth = queue_depth_.fetch_add(static_cast<int64_t>(count),
+                                         std::memory_order_relaxed) +
+                  static_cast<int64_t>(count);
+  if (stats_enabled_.load(std::memory_order_relaxed) &&
+      depth > peak_queue_depth_.load(std::memory_order_relaxed)) {
+    int64_t peak = peak_queue_depth_.load(std::memory_order_relaxed);
+    while (depth > peak && !peak_queue_depth_.compare_exchange_weak(
+                               peak, depth, std::memory_order_relaxed)) {
+    }
+  }
+
+  if (delay_us <= 0) {
+    if (count == 1 && !coalesced && canPostDirect(nowUs)) {
+      direct_events_.push_back(Event{nowUs, messages[0], false, 0, pending});
+      return;
+    }
+    if (group_ != nullptr) {
+      // counted before the push so pending_ never goes negative
+      pending_.fetch_add(static_cast<int64_t>(count),
+                         std::memory_order_seq_cst);
+    }
+    for (size_t i = 0; i < count; i++) {
+      immediate_queue_.Push(Event{nowUs, messages[i], coalesced, 0, pending});
+    }
+    wakeForImmediate();
+    return;
+  }
+
+  int64_t whenUs = (delay_us > (std::numeric_limits<int64_t>::max() - nowUs)
+                        ? std::numeric_limits<int64_t>::max()
+                        : (nowUs + delay_us));
+
+  std::unique_lock<std::mutex> l(mutex_);
+  if (stopped_.load(std::memory_order_relaxed)) {
+    queue_depth_.fetch_sub(static_cast<int64_t>(count),
+                           std::memory_order_relaxed);
+    return;
+  }
+  for (size_t i = 0; i < count; i++) {
+    if (timing_wheel_ != nullptr) {
+      auto* node = timing_wheel_->Insert(
+          whenUs, Event{whenUs, messages[i], coalesced, 0, pending});
+      if (pending != nullptr) {
+        pending->wheel_node_ = node;
+      }
+    } else {
+      heapPush(
+          Event{whenUs, messages[i], coalesced, next_sequence_++, pending});
+    }
+  }
+  // the wheel rounds up to the tick it will actually fire at. Only this
+  // deadline can have moved next_delayed_us_ earlier, no need to rescan.
+  if (timing_wheel_ != nullptr) {
+    whenUs = timing_wheel_->FireTimeUs(whenUs);
+  }
+  if (whenUs < next_delayed_us_.load(std::memory_order_relaxed)) {
+    next_delayed_us_.store(whenUs, std::memory_order_release);
+    // the loop thread may be sleeping until a later deadline
+    if (parked_.load(std::memory_order_relaxed)) {
+      wakeLoopLocked();
+    }
+  }
+  whenUs = next_delayed_us_.load(std::memory_order_relaxed);
+  if (group_ != nullptr && armGroupTimer(whenUs)) {
+    l.unlock();
+    group_->scheduleAt(shared_from_this(), whenUs);
+  }
 }
 
 void Looper::loop() {
+  applyThreadPolicy();
   start_latch_.CountDown();
-  while (keepRunning()) {
-    std::shared_ptr<Message> message;
-    {
-      std::unique_lock<std::mutex> l(mutex_);
+  Event event;
+  while (true) {
+    // due delayed events go first, so a busy producer can not starve timers
+    int64_t nowUs = clock_->NowUs();
+    if (next_delayed_us_.load(std::memory_order_acquire) <= nowUs &&
+        popDelayedEvents(nowUs, expired_events_)) {
+      expired_remaining_ = expired_events_.size();
+      for (auto& expired : expired_events_) {
+        expired_remaining_--;
+        dispatchAndDrain(expired);
+      }
+      expired_events_.clear();
+      continue;
+    }
 
-      if (event_queue_.empty()) {
-        condition_.wait(l);
-        continue;
+    if (!immediate_queue_.Pop(event)) {
+      if (!waitForEvent()) {
+        break;
       }
+      continue;
+    }
+
+    if (skipImmediate(event)) {
+      continue;
+    }
+    dispatchAndDrain(event);
+    event.message_.reset();
+  }
+}
+
+void Looper::setDirectDispatch(bool enable) {
+  direct_dispatch_.store(enable, std::memory_order_relaxed);
+}
 
-      const auto &event = event_queue_.top();
-      int64_t nowUs = getNowUs();
+// Only on the dispatching thread, and only if nothing that is due may be
+// overtaken: queued immediate events, the rest of an expired batch, due
+// delayed events, or events a removal still has to check.
+bool Looper::canPostDirect(int64_t now_us) {
+  return direct_dispatch_.load(std::memory_order_relaxed) &&
+         tls_dispatching_looper == this && expired_remaining_ == 0 &&
+         !has_removals_.load(std::memory_order_relaxed) &&
+         next_delayed_us_.load(std::memory_order_relaxed) > now_us &&
+         immediate_queue_.Empty();
+}
 
-      if (event->when_us_ > nowUs) {
-        int64_t delay_us = event->when_us_ - nowUs;
-        if (delay_us > std::numeric_limits<int64_t>::max()) {
-          delay_us = std::numeric_limits<int64_t>::max();
-        }
+void Looper::dispatchAndDrain(Event& event) {
+  Looper* previous = tls_dispatching_looper;
+  tls_dispatching_looper = this;
+  dispatch(event);
+  // handlers may post more while we drain, hence the index
+  for (size_t i = 0; i < direct_events_.size(); i++) {
+    Event direct = std::move(direct_events_[i]);
+    // the handler may have removed what it posted itself
+    if (!skipImmediate(direct)) {
+      dispatch(direct);
+    }
+  }
+  direct_events_.clear();
+  tls_dispatching_looper = previous;
+}
+
+status_t Looper::addFd(int fd,
+                       uint32_t events,
+                       const std::shared_ptr<Handler> &handler,
+                       uint32_t what) {
+  if (fd < 0 || handler == nullptr ||
+      (events & (kFdInput | kFdOutput)) == 0) {
+    return BAD_VALUE;
+  }
+  if (group_ != nullptr) {
+    return INVALID_OPERATION;
+  }
 
-        condition_.wait_for(l, std::chrono::microseconds(delay_us));
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (poller_ == nullptr) {
+    auto poller = std::make_unique<Poller>();
+    status_t err = poller->initCheck();
+    if (err != OK) {
+      return err;
+    }
+    poller_ = std::move(poller);
+    wake_poller_.store(poller_.get(), std::memory_order_release);
+    // move a loop parked on condition_ over to the poller
+    condition_.notify_all();
+  }
+  status_t err = fds_.count(fd) != 0 ? poller_->modify(fd, events)
+                                     : poller_->add(fd, events);
+  if (err != OK) {
+    return err;
+  }
+  fds_[fd] = FdEntry{handler, what};
+  return OK;
+}
+
+status_t Looper::removeFd(int fd) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (fds_.erase(fd) == 0) {
+    return NAME_NOT_FOUND;
+  }
+  return poller_->remove(fd);
+}
+
+uint64_t Looper::coalesceKey(const Message &message) {
+  return (static_cast<uint64_t>(static_cast<uint32_t>(message.handler_id_))
+          << 32) |
+         message.what_;
+}
+
+void Looper::dispatch(Event& event) {
+  queue_depth_.fetch_sub(1, std::memory_order_relaxed);
+  if (event.pending_ != nullptr) {
+    bool cancelled = !event.pending_->transition(PendingMessage::kDelivered);
+    event.pending_.reset();
+    if (cancelled) {
+      return;
+    }
+  }
+  if (event.coalesced_) {
+    std::lock_guard<std::mutex> guard(coalesce_mutex_);
+    auto it = coalesced_.find(coalesceKey(*event.message_));
+    if (it == coalesced_.end()) {
+      // dropped by removeMessages() / flush()
+      return;
+    }
+    event.message_ = std::move(it->second);
+    coalesced_.erase(it);
+  }
+
+  bool watched = watchdog_enabled_.load(std::memory_order_relaxed);
+  if (watched) {
+    watch_.begin(event.message_->handler_id_, event.message_->what_);
+  }
+
+  if (!stats_enabled_.load(std::memory_order_relaxed)) {
+    event.message_->deliver();
+  } else {
+    int64_t startUs = clock_->NowUs();
+    std::shared_ptr<Handler> handler = event.message_->deliver();
+    int64_t executionUs = clock_->NowUs() - startUs;
+    int64_t latencyUs = startUs - event.when_us_;
+    stats_.Record(latencyUs, executionUs);
+    if (handler != nullptr) {
+      handler->stats_.Record(latencyUs, executionUs);
+    }
+  }
+
+  if (watched) {
+    watch_.end();
+  }
+}
+
+void Looper::enableStats(bool enable) {
+  stats_enabled_.store(enable, std::memory_order_relaxed);
+}
+
+Looper::Stats Looper::stats() const {
+  Stats stats;
+  stats.dispatch = stats_.snapshot(clock_->NowUs());
+  stats.queue_depth =
+      std::max<int64_t>(0, queue_depth_.load(std::memory_order_relaxed));
+  stats.peak_queue_depth = peak_queue_depth_.load(std::memory_order_relaxed);
+  return stats;
+}
+
+// Counters being written while resetting may keep stale values.
+void Looper::resetStats() {
+  stats_.reset();
+  peak_queue_depth_.store(queue_depth_.load(std::memory_order_relaxed),
+                          std::memory_order_relaxed);
+}
+
+void Looper::setWatchdog(int64_t threshold_us,
+                         WatchdogCallback callback,
+                         bool sample_stack) {
+  if (threshold_us <= 0 || callback == nullptr) {
+    if (watchdog_enabled_.exchange(false, std::memory_order_relaxed)) {
+      LooperWatchdog::Get().remove(this);
+    }
+    return;
+  }
+  LooperWatchdog::Get().add(this, name_, &watch_, &queue_depth_, threshold_us,
+                            sample_stack, std::move(callback));
+  watchdog_enabled_.store(true, std::memory_order_relaxed);
+}
+
+// Runs on the new looper thread, before start() returns.
+void Looper::applyThreadPolicy() {
+  SetCurrentThreadName(name_);
+  if (priority_ != kPriorityNormal) {
+    status_t err = SetCurrentThreadPriority(priority_);
+    if (err != OK) {
+      AVE_LOG(LS_WARNING) << "looper " << name_ << " can not use priority "
+                          << priority_ << ", err " << err;
+    }
+  }
+  if (SetCurrentThreadAffinity(cpu_affinity_) != OK) {
+    AVE_LOG(LS_WARNING) << "looper " << name_ << " can not set cpu affinity";
+  }
+}
+
+// Moves every delayed event due at |now_us| into |events|, in deadline
+// order.
+bool Looper::popDelayedEvents(int64_t now_us, std::vector<Event>& events) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  int64_t next_us = std::numeric_limits<int64_t>::max();
+  if (timing_wheel_ != nullptr) {
+    timing_wheel_->Expire(now_us,
+                          [&events](int64_t /* when_us */, Event&& event) {
+                            if (event.pending_ != nullptr) {
+                              event.pending_->wheel_node_ = nullptr;
+                            }
+                            events.push_back(std::move(event));
+                          });
+    next_us = timing_wheel_->NextExpiryUs();
+  } else {
+    while (!event_queue_.empty() && event_queue_.front().when_us_ <= now_us) {
+      events.push_back(heapRemove(0));
+    }
+    if (!event_queue_.empty()) {
+      next_us = event_queue_.front().when_us_;
+    }
+  }
+  next_delayed_us_.store(next_us, std::memory_order_release);
+  return !events.empty();
+}
+
+void Looper::heapPush(Event event) {
+  event_queue_.push_back(std::move(event));
+  heapSiftUp(event_queue_.size() - 1);
+}
+
+Looper::Event Looper::heapRemove(size_t index) {
+  Event event = std::move(event_queue_[index]);
+  if (event.pending_ != nullptr) {
+    event.pending_->heap_index_ = PendingMessage::kNotQueued;
+  }
+  size_t last = event_queue_.size() - 1;
+  if (index != last) {
+    event_queue_[index] = std::move(event_queue_[last]);
+  }
+  event_queue_.pop_back();
+  if (index < event_queue_.size()) {
+    // the moved event may belong above or below |index|
+    heapSiftUp(index);
+    heapSiftDown(index);
+  }
+  return event;
+}
+
+void Looper::heapSiftUp(size_t index) {
+  while (index > 0) {
+    size_t parent = (index - 1) / 2;
+    if (!EventOrder()(event_queue_[parent], event_queue_[index])) {
+      break;
+    }
+    std::swap(event_queue_[parent], event_queue_[index]);
+    heapPlaced(index);
+    index = parent;
+  }
+  heapPlaced(index);
+}
+
+void Looper::heapSiftDown(size_t index) {
+  size_t size = event_queue_.size();
+  while (true) {
+    size_t child = 2 * index + 1;
+    if (child >= size) {
+      break;
+    }
+    if (child + 1 < size &&
+        EventOrder()(event_queue_[child], event_queue_[child + 1])) {
+      child++;
+    }
+    if (!EventOrder()(event_queue_[index], event_queue_[child])) {
+      break;
+    }
+    std::swap(event_queue_[index], event_queue_[child]);
+    heapPlaced(index);
+    index = child;
+  }
+  heapPlaced(index);
+}
+
+void Looper::heapPlaced(size_t index) {
+  if (event_queue_[index].pending_ != nullptr) {
+    event_queue_[index].pending_->heap_index_ = index;
+  }
+}
+
+bool Looper::hasDelayedEvents() const {
+  return timing_wheel_ != nullptr ? !timing_wheel_->empty()
+                                  : !event_queue_.empty();
+}
+
+// Blocks until there may be work to do, returns false once the looper is
+// stopped and every queued message has been delivered.
+bool Looper::waitForEvent() {
+  std::unique_lock<std::mutex> l(mutex_);
+  // seq_cst pairs with the producer in wakeIfParked(): either it sees us
+  // parked, or we see its message here.
+  parked_.store(true, std::memory_order_seq_cst);
+  bool keep_running = true;
+  if (immediate_queue_.Empty()) {
+    if (poller_ != nullptr && (looping_ || hasDelayedEvents())) {
+      l.unlock();
+      pollFds();
+      return true;
+    }
+    if (!hasDelayedEvents()) {
+      if (looping_) {
+        condition_.wait(l);
+      } else {
+        keep_running = false;
+      }
+    } else {
+      clock_->WaitUntil(l, condition_,
+                        next_delayed_us_.load(std::memory_order_relaxed));
+    }
+  }
+  parked_.store(false, std::memory_order_relaxed);
+  return keep_running;
+}
+
+// Waits on the poller until an fd is ready, the loop is woken, or the next
+// delayed event is due, then delivers the ready fds. The timerfd only runs
+// on CLOCK_MONOTONIC, other clocks wake the loop through their Wakeup.
+void Looper::pollFds() {
+  int64_t deadlineUs = clock_->IsSystemMonotonic()
+                           ? next_delayed_us_.load(std::memory_order_acquire)
+                           : std::numeric_limits<int64_t>::max();
+  ready_fds_.clear();
+  status_t err = poller_->wait(deadlineUs, ready_fds_);
+  parked_.store(false, std::memory_order_relaxed);
+  if (err != OK) {
+    AVE_LOG(LS_WARNING) << "looper " << name_ << " poll failed, err " << err;
+  }
+
+  for (const auto &ready : ready_fds_) {
+    std::shared_ptr<Handler> handler;
+    uint32_t what = 0;
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      auto it = fds_.find(ready.fd);
+      // removed since the wait returned
+      if (it == fds_.end()) {
         continue;
       }
+      handler = it->second.handler_.lock();
+      what = it->second.what_;
+    }
+    if (handler == nullptr) {
+      continue;
+    }
+    // delivered right away, the handler consumes the readiness before the
+    // next wait
+    auto message = Message::Obtain(what, handler);
+    message->setInt32(AVE_MESSAGE_KEY("fd"), ready.fd);
+    message->setInt32(AVE_MESSAGE_KEY("events"),
+                      static_cast<int32_t>(ready.events));
+    queue_depth_.fetch_add(1, std::memory_order_relaxed);
+    Event event{clock_->NowUs(), std::move(message), false, 0, nullptr};
+    dispatchAndDrain(event);
+  }
+}
+
+void Looper::wakeIfParked() {
+  if (parked_.load(std::memory_order_seq_cst)) {
+    // the eventfd stays signalled, a wake() before the wait is not lost
+    Poller* poller = wake_poller_.load(std::memory_order_acquire);
+    if (poller != nullptr) {
+      poller->wake();
+      return;
+    }
+    // taking mutex_ guarantees the loop thread is inside wait() by now
+    std::lock_guard<std::mutex> guard(mutex_);
+    wakeLoopLocked();
+  }
+}
+
+// Called with mutex_ held.
+void Looper::wakeLoopLocked() {
+  condition_.notify_all();
+  if (poller_ != nullptr) {
+    poller_->wake();
+  }
+}
 
-      message = std::move(event->message_);
-      event_queue_.pop();
+// Runs on a group worker: delivers the due delayed events and up to
+// |max_messages| immediate ones, then hands the looper back to the group.
+void Looper::runSlice(size_t max_messages) {
+  int64_t nowUs = clock_->NowUs();
+  if (next_delayed_us_.load(std::memory_order_acquire) <= nowUs &&
+      popDelayedEvents(nowUs, expired_events_)) {
+    expired_remaining_ = expired_events_.size();
+    for (auto& expired : expired_events_) {
+      expired_remaining_--;
+      dispatchAndDrain(expired);
     }
-    message->deliver();
-    message.reset();
+    expired_events_.clear();
+  }
+
+  Event event;
+  for (size_t i = 0; i < max_messages && immediate_queue_.Pop(event); i++) {
+    pending_.fetch_sub(1, std::memory_order_relaxed);
+    if (skipImmediate(event)) {
+      continue;
+    }
+    dispatchAndDrain(event);
+    event.message_.reset();
+  }
+
+  // seq_cst pairs with post(): either the producer sees scheduled_ cleared
+  // and queues us, or we see its pending_ here
+  scheduled_.store(false, std::memory_order_seq_cst);
+  if (pending_.load(std::memory_order_seq_cst) > 0 &&
+      !scheduled_.exchange(true, std::memory_order_seq_cst)) {
+    group_->schedule(shared_from_this());
+  }
+
+  std::unique_lock<std::mutex> l(mutex_);
+  int64_t whenUs = next_delayed_us_.load(std::memory_order_relaxed);
+  bool arm = armGroupTimer(whenUs);
+  if (stopped_.load(std::memory_order_relaxed)) {
+    condition_.notify_all();
+  }
+  l.unlock();
+  if (arm) {
+    group_->scheduleAt(shared_from_this(), whenUs);
+  }
+}
+
+// A group timer armed at |when_us| fired, the next one must be armed again.
+void Looper::onGroupTimer(int64_t when_us) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (armed_timer_us_ == when_us) {
+    armed_timer_us_ = std::numeric_limits<int64_t>::max();
   }
 }
 
-bool Looper::keepRunning() {
-  std::lock_guard<std::mutex> l(mutex_);
-  return looping_ || !event_queue_.empty();
+// Returns true if a group timer at |when_us| has to be armed, i.e. it is
+// earlier than the one already armed. Called with mutex_ held.
+bool Looper::armGroupTimer(int64_t when_us) {
+  if (!hasDelayedEvents() || when_us >= armed_timer_us_) {
+    return false;
+  }
+  armed_timer_us_ = when_us;
+  return true;
 }
 
 std::shared_ptr<ReplyToken> Looper::createReplyToken() {
   return std::make_shared<ReplyToken>(shared_from_this());
 }
 
+// Replies wait on their own token, neither side touches mutex_.
 status_t Looper::awaitResponse(const std::shared_ptr<ReplyToken> &replyToken,
                                std::shared_ptr<Message> &response) {
-  std::unique_lock<std::mutex> guard(mutex_);
-  // AVE_CHECK(replyToken != NULL)
-  while (!replyToken->getReply(response)) {
-    replies_condition_.wait(guard);
-  }
-
+  replyToken->waitReply(response);
   return 0;
 }
 
 status_t Looper::postReply(const std::shared_ptr<ReplyToken> &replyToken,
                            const std::shared_ptr<Message> &reply) {
-  std::lock_guard<std::mutex> guard(mutex_);
-  status_t err = replyToken->setReply(reply);
-  if (err == 0) {
-    replies_condition_.notify_all();
-  }
-  return err;
+  return replyToken->setReply(reply);
 }
 
 } // namespace media
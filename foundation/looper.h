@@ -8,23 +8,34 @@
 #ifndef AVE_LOOPER_H
 #define AVE_LOOPER_H
 
+#include <atomic>
 #include <chrono>
 #include <condition_variable>
 #include <memory>
 #include <mutex>
-#include <queue>
 #include <string>
 #include <thread>
+#include <unordered_map>
+#include <vector>
 
 #include "base/constructor_magic.h"
 #include "base/count_down_latch.h"
 #include "base/errors.h"
 
+#include "clock.h"
+#include "dispatch_stats.h"
+#include "looper_watchdog.h"
+#include "mpsc_queue.h"
+#include "poller.h"
+#include "thread_priority.h"
+#include "timing_wheel.h"
+
 namespace ave {
 namespace media {
 
 class Message;
 class Handler;
+class LooperGroup;
 class ReplyToken;
 
 class Looper : public std::enable_shared_from_this<Looper> {
@@ -32,57 +43,303 @@ class Looper : public std::enable_shared_from_this<Looper> {
   using event_id = int32_t;
   using handler_id = int32_t;
 
+  // How delayed messages wait until they are due.
+  enum class DelayedQueueType {
+    // binary heap, O(log n) insert, exact deadlines
+    kPriorityQueue,
+    // hierarchical timing wheel, O(1) insert, deadlines rounded up to a tick
+    kTimingWheel,
+  };
+
+  static constexpr int64_t kDefaultTickUs = 1000LL;
+
   Looper();
+  // |clock| defaults to Clock::GetDefault()
+  explicit Looper(DelayedQueueType type,
+                  int64_t tick_us = kDefaultTickUs,
+                  std::shared_ptr<Clock> clock = nullptr);
   virtual ~Looper();
 
   // set looper name
   void setName(std::string name);
   handler_id registerHandler(const std::shared_ptr<Handler> &handler);
   static void unregisterHandler(handler_id handler_id);
+  // wait-free, nullptr if |handler_id| is not registered
+  static std::shared_ptr<Handler> findHandler(handler_id handler_id);
+
+  // Cpus the looper thread may run on, empty for any. Set before start().
+  void setCpuAffinity(std::vector<int32_t> cpus);
 
-  int32_t start(int32_t priority = static_cast<int32_t>(0));
+  // Starts the looper thread, named after the looper, at |priority|, one
+  // of the kPriority* values of thread_priority.h. Priorities the process
+  // is not permitted to use fall back as SetCurrentThreadPriority()
+  // describes. No-op for loopers created by a LooperGroup, they are
+  // already running.
+  int32_t start(int32_t priority = kPriorityNormal);
   int32_t stop();
   void post(const std::shared_ptr<Message> &message, int64_t delay_us);
+  // Posts |messages|, all targeting handlers of this looper, in order, with
+  // a single lock and a single wakeup.
+  void postBatch(const std::vector<std::shared_ptr<Message>> &messages,
+                 int64_t delay_us = 0);
+  // Off by default. While on, a zero-delay post from this looper's own
+  // thread, i.e. from one of its handlers, skips the queue and its wakeup:
+  // the message runs right after the current handler returns. Messages
+  // queued or due before it keep their place, in that case, and for
+  // coalesced posts, the message is queued as usual.
+  void setDirectDispatch(bool enable);
 
-  static int64_t getNowUs() {
-    auto systemClock = std::chrono::system_clock::now();
-    return std::chrono::duration_cast<std::chrono::microseconds>(
-               systemClock.time_since_epoch())
-        .count();
-  }
+  // Delivers a |what| message to |handler| on the looper thread whenever
+  // |fd| is ready for |events|, kFdInput and / or kFdOutput of poller.h.
+  // Its "fd" and "events" int32 items carry the fd and the kFd* events
+  // that are ready. Level triggered: until the handler consumes the
+  // readiness, e.g. reads to EAGAIN, it is reported again. Adding an fd
+  // again replaces its registration. The first fd moves the loop onto
+  // epoll, with a timerfd for delayed messages and an eventfd for wakeups.
+  // INVALID_OPERATION for loopers of a LooperGroup and outside Linux.
+  status_t addFd(int fd,
+                 uint32_t events,
+                 const std::shared_ptr<Handler> &handler,
+                 uint32_t what);
+  // Call before closing |fd|.
+  status_t removeFd(int fd);
 
- private:
-  friend class Message;
+  class PendingMessage;
 
+ private:
+  // ahead of PendingMessage, which keeps where its Event is queued
   struct Event {
     int64_t when_us_;
     std::shared_ptr<Message> message_;
+    // posted by postCoalesced(), the latest message is in coalesced_
+    bool coalesced_ = false;
+    // insertion order of delayed events, keeps equal deadlines FIFO. For
+    // removal markers, the id of the Removal.
+    uint64_t sequence_ = 0;
+    // set by postCancellable()
+    std::shared_ptr<PendingMessage> pending_;
+  };
+
+ public:
+  // Handle of a message posted with postCancellable().
+  class PendingMessage {
+   public:
+    PendingMessage()
+        : state_(kPending), wheel_node_(nullptr), heap_index_(kNotQueued) {}
+
+    // Keeps the message from being delivered. Returns false if it has been
+    // delivered, or cancelled, already. A delayed message is unlinked from
+    // its looper right away, O(1) on a timing wheel and O(log n) on the
+    // heap, and its Message released. An immediate one is skipped once the
+    // loop reaches it.
+    bool cancel();
+
+   private:
+    friend class Looper;
+    enum State : int32_t { kPending, kDelivered, kCancelled };
+    static constexpr size_t kNotQueued = static_cast<size_t>(-1);
+
+    bool transition(State to) {
+      int32_t expected = kPending;
+      return state_.compare_exchange_strong(expected, to,
+                                            std::memory_order_acq_rel);
+    }
+
+    std::atomic<int32_t> state_;
+    // set once by postCancellable(), empty if the looper is not owned by a
+    // shared_ptr
+    std::weak_ptr<Looper> looper_;
+    // where the delayed event is queued, guarded by the looper's mutex_:
+    // its wheel node, or its index in event_queue_
+    TimingWheel<Event>::Node* wheel_node_;
+    size_t heap_index_;
+  };
+
+  // Like post(), the returned handle cancels the message while it is
+  // pending. A cancelled message is skipped, its handler never sees it.
+  std::shared_ptr<PendingMessage> postCancellable(
+      const std::shared_ptr<Message> &message,
+      int64_t delay_us = 0);
+
+  // Drop pending messages without delivering them: those of |handler| with
+  // |what|, or all of |handler|'s. Delayed messages are unlinked at once,
+  // immediate ones as the loop reaches them. Messages posted after the call
+  // are not affected.
+  void removeMessages(const std::shared_ptr<Handler> &handler, uint32_t what);
+  void flush(const std::shared_ptr<Handler> &handler);
+
+  // Like post(), but while a message with the same handler and what posted
+  // this way is pending, |message| replaces it instead of being queued. The
+  // replacement keeps the pending message's place and deadline.
+  void postCoalesced(const std::shared_ptr<Message> &message,
+                     int64_t delay_us = 0);
+
+  // time on the default monotonic clock
+  static int64_t getNowUs() { return Clock::GetDefault()->NowUs(); }
+
+  const std::shared_ptr<Clock>& clock() const { return clock_; }
+
+  struct Stats {
+    DispatchStats::Snapshot dispatch;
+    // messages posted and not dispatched yet
+    int64_t queue_depth;
+    // highest queue_depth seen while stats were enabled
+    int64_t peak_queue_depth;
+  };
+
+  // Off by default. While on, each dispatch reads the clock twice and
+  // updates the stats of the looper and of the target handler, see
+  // Handler::stats().
+  void enableStats(bool enable);
+  Stats stats() const;
+  void resetStats();
+
+  // Off by default. While on, a dispatch still running |threshold_us|
+  // after it began is reported once to |callback|, on the watchdog thread,
+  // see LooperWatchdog. |sample_stack| adds the stack of the dispatching
+  // thread to the report, Linux with glibc only. A |threshold_us| of 0
+  // turns the watchdog off.
+  void setWatchdog(int64_t threshold_us,
+                   WatchdogCallback callback,
+                   bool sample_stack = false);
+
+ private:
+  friend class LooperGroup;
+  friend class Message;
+
+  // A removeMessages() / flush() that immediate_queue_ events posted
+  // before it still have to be checked against. The loop retires it when
+  // it dequeues the matching marker, an event without message.
+  struct Removal {
+    handler_id handler_id_;
+    bool match_what_;
+    uint32_t what_;
+    uint64_t id_;
+  };
+
+  struct FdEntry {
+    std::weak_ptr<Handler> handler_;
+    uint32_t what_;
   };
 
   struct EventOrder {
-    bool operator()(const std::unique_ptr<Event>& first,
-                    const std::unique_ptr<Event>& second) const {
-      return first->when_us_ > second->when_us_;
+    bool operator()(const Event& first, const Event& second) const {
+      return first.when_us_ != second.when_us_
+                 ? first.when_us_ > second.when_us_
+                 : first.sequence_ > second.sequence_;
     }
   };
 
   std::string name_;
+  const std::shared_ptr<Clock> clock_;
+  int32_t clock_wakeup_id_;
   int32_t priority_;
+  std::vector<int32_t> cpu_affinity_;
   std::unique_ptr<std::thread> thread_;
   bool looping_;
   base::CountDownLatch start_latch_;
-  bool stopped_;
+  std::atomic<bool> stopped_;
   std::mutex mutex_;
   std::condition_variable condition_;
-  std::priority_queue<std::unique_ptr<Event>,
-                      std::vector<std::unique_ptr<Event>>,
-                      EventOrder>
-      event_queue_;
+  // zero-delay messages, posted without taking mutex_
+  MpscQueue<Event> immediate_queue_;
+  // delayed messages, guarded by mutex_. Only one of event_queue_ and
+  // timing_wheel_ is used, depending on delayed_queue_type_.
+  const DelayedQueueType delayed_queue_type_;
+  // binary heap ordered by EventOrder, held by value to avoid an allocation
+  // per delayed post. Maintained by heapPush() and heapRemove(), which keep
+  // PendingMessage::heap_index_ up to date.
+  std::vector<Event> event_queue_;
+  uint64_t next_sequence_;
+  std::unique_ptr<TimingWheel<Event>> timing_wheel_;
+  // when_us_ of the earliest delayed event, INT64_MAX if there is none
+  std::atomic<int64_t> next_delayed_us_;
+  // true while the loop thread is blocked on condition_
+  std::atomic<bool> parked_;
+  // created by the first addFd() and kept until destruction, guarded by
+  // mutex_. Once set, the loop waits on it instead of condition_.
+  std::unique_ptr<Poller> poller_;
+  // poller_, for wakers that do not hold mutex_
+  std::atomic<Poller*> wake_poller_;
+  // registered fds, guarded by mutex_
+  std::unordered_map<int, FdEntry> fds_;
+  // only touched by the loop thread
+  std::vector<Poller::Ready> ready_fds_;
+  // due delayed events, only touched by the loop thread, or by the group
+  // worker currently running the looper
+  std::vector<Event> expired_events_;
+
+  // set if the looper runs on a LooperGroup instead of its own thread
+  LooperGroup* group_;
+  // group mode: true while queued on, or run by, a group worker
+  std::atomic<bool> scheduled_;
+  // group mode: immediate messages posted but not yet delivered
+  std::atomic<int64_t> pending_;
+  // group mode: earliest deadline armed on the group, guarded by mutex_
+  int64_t armed_timer_us_;
+
+  std::atomic<bool> direct_dispatch_;
+  // messages posted directly, only touched by the dispatching thread
+  std::vector<Event> direct_events_;
+  // expired events of the current batch still to be dispatched
+  size_t expired_remaining_;
+
+  // guarded by mutex_
+  std::vector<Removal> removals_;
+  uint64_t next_removal_id_;
+  // !removals_.empty(), read without the lock by the loop
+  std::atomic<bool> has_removals_;
 
-  std::condition_variable replies_condition_;
+  // latest message per (handler id, what) of pending coalesced events
+  std::mutex coalesce_mutex_;
+  std::unordered_map<uint64_t, std::shared_ptr<Message>> coalesced_;
+
+  std::atomic<bool> stats_enabled_;
+  // written by the thread dispatching, see LatencyHistogram
+  DispatchStats stats_;
+  std::atomic<int64_t> queue_depth_;
+  std::atomic<int64_t> peak_queue_depth_;
+
+  std::atomic<bool> watchdog_enabled_;
+  // written by the thread dispatching, read by LooperWatchdog
+  DispatchWatch watch_;
 
   void loop();
-  bool keepRunning();
+  void applyThreadPolicy();
+  bool popDelayedEvents(int64_t now_us, std::vector<Event>& events);
+  bool hasDelayedEvents() const;
+  // event_queue_ heap operations, under mutex_
+  void heapPush(Event event);
+  Event heapRemove(size_t index);
+  void heapSiftUp(size_t index);
+  void heapSiftDown(size_t index);
+  void heapPlaced(size_t index);
+  // takes a cancelled delayed event out of its queue
+  void unlinkCancelled(PendingMessage& pending);
+  bool waitForEvent();
+  void pollFds();
+  void wakeIfParked();
+  void wakeLoopLocked();
+
+  void postEvents(const std::shared_ptr<Message> *messages,
+                  size_t count,
+                  int64_t delay_us,
+                  bool coalesced,
+                  std::shared_ptr<PendingMessage> pending = nullptr);
+  void wakeForImmediate();
+  void removeEvents(handler_id handler_id, bool match_what, uint32_t what);
+  static bool removes(const Removal &removal, const Message &message);
+  bool skipImmediate(Event &event);
+  static uint64_t coalesceKey(const Message &message);
+  void dispatch(Event& event);
+  // dispatch() followed by the messages the handler posted directly
+  void dispatchAndDrain(Event& event);
+  bool canPostDirect(int64_t now_us);
+
+  // group mode
+  void runSlice(size_t max_messages);
+  void onGroupTimer(int64_t when_us);
+  bool armGroupTimer(int64_t when_us);
 
   std::shared_ptr<ReplyToken> createReplyToken();
 
@@ -0,0 +1,193 @@
+/*
+ * looper_group.cc
+ * Copyright (C) 2024 youfa <vsyfar@gmail.com>
+ *
+ * Distributed under terms of the GPLv2 license.
+ */
+
+#include "looper_group.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace ave {
+namespace media {
+
+namespace {
+thread_local const LooperGroup* tls_group = nullptr;
+thread_local size_t tls_worker_index = 0;
+}  // namespace
+
+LooperGroup::LooperGroup(size_t num_workers, std::shared_ptr<Clock> clock)
+    : clock_(clock != nullptr ? std::move(clock) : Clock::GetDefault()),
+      clock_wakeup_id_(0),
+      next_worker_(0),
+      queued_(0),
+      idle_workers_(0),
+      stopping_(false),
+      next_timer_us_(std::numeric_limits<int64_t>::max()) {
+  if (num_workers == 0) {
+    num_workers = std::max(1u, std::thread::hardware_concurrency());
+  }
+  // a simulated clock jumped, timers may be due now
+  clock_wakeup_id_ = clock_->AddWakeup([this]() {
+    std::lock_guard<std::mutex> guard(mutex_);
+    condition_.notify_all();
+  });
+
+  for (size_t i = 0; i < num_workers; i++) {
+    workers_.push_back(std::make_unique<Worker>());
+  }
+  for (size_t i = 0; i < num_workers; i++) {
+    workers_[i]->thread = std::thread(&LooperGroup::workerLoop, this, i);
+  }
+}
+
+LooperGroup::~LooperGroup() {
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    stopping_.store(true, std::memory_order_release);
+    condition_.notify_all();
+  }
+  for (auto& worker : workers_) {
+    worker->thread.join();
+  }
+  clock_->RemoveWakeup(clock_wakeup_id_);
+  // delayed messages still pending are dropped with their loopers
+  timers_.clear();
+}
+
+std::shared_ptr<Looper> LooperGroup::createLooper(
+    std::string name,
+    Looper::DelayedQueueType type) {
+  auto looper = std::make_shared<Looper>(type, Looper::kDefaultTickUs, clock_);
+  looper->setName(std::move(name));
+  looper->group_ = this;
+  looper->looping_ = true;
+  return looper;
+}
+
+bool LooperGroup::isWorkerThread() const {
+  return tls_group == this;
+}
+
+void LooperGroup::schedule(std::shared_ptr<Looper> looper) {
+  // a worker keeps the loopers it wakes, they likely share data with it
+  size_t index = isWorkerThread()
+                     ? tls_worker_index
+                     : next_worker_.fetch_add(1, std::memory_order_relaxed) %
+                           workers_.size();
+  queued_.fetch_add(1, std::memory_order_seq_cst);
+  {
+    std::lock_guard<std::mutex> guard(workers_[index]->mutex);
+    workers_[index]->runnable.push_back(std::move(looper));
+  }
+  // seq_cst pairs with waitForWork(): either a parking worker sees queued_,
+  // or we see it idle here
+  if (idle_workers_.load(std::memory_order_seq_cst) > 0) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    condition_.notify_one();
+  }
+}
+
+void LooperGroup::scheduleAt(std::shared_ptr<Looper> looper, int64_t when_us) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  timers_.push_back(Timer{when_us, std::move(looper)});
+  std::push_heap(timers_.begin(), timers_.end(), TimerOrder());
+  if (when_us < next_timer_us_.load(std::memory_order_relaxed)) {
+    next_timer_us_.store(when_us, std::memory_order_release);
+    // idle workers may sleep until a later deadline
+    condition_.notify_one();
+  }
+}
+
+void LooperGroup::workerLoop(size_t index) {
+  tls_group = this;
+  tls_worker_index = index;
+  std::shared_ptr<Looper> looper;
+  while (true) {
+    fireDueTimers();
+    if (popRunnable(index, looper)) {
+      queued_.fetch_sub(1, std::memory_order_relaxed);
+      looper->runSlice(kMaxMessagesPerSlice);
+      looper.reset();
+      continue;
+    }
+    if (!waitForWork()) {
+      break;
+    }
+  }
+  tls_group = nullptr;
+}
+
+bool LooperGroup::popRunnable(size_t index, std::shared_ptr<Looper>& looper) {
+  {
+    Worker& own = *workers_[index];
+    std::lock_guard<std::mutex> guard(own.mutex);
+    if (!own.runnable.empty()) {
+      looper = std::move(own.runnable.front());
+      own.runnable.pop_front();
+      return true;
+    }
+  }
+  // steal the most recently queued looper of another worker
+  for (size_t i = 1; i < workers_.size(); i++) {
+    Worker& victim = *workers_[(index + i) % workers_.size()];
+    std::lock_guard<std::mutex> guard(victim.mutex);
+    if (!victim.runnable.empty()) {
+      looper = std::move(victim.runnable.back());
+      victim.runnable.pop_back();
+      return true;
+    }
+  }
+  return false;
+}
+
+void LooperGroup::fireDueTimers() {
+  int64_t now_us = clock_->NowUs();
+  if (next_timer_us_.load(std::memory_order_acquire) > now_us) {
+    return;
+  }
+
+  std::vector<Timer> due;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    while (!timers_.empty() && timers_.front().when_us <= now_us) {
+      std::pop_heap(timers_.begin(), timers_.end(), TimerOrder());
+      due.push_back(std::move(timers_.back()));
+      timers_.pop_back();
+    }
+    next_timer_us_.store(timers_.empty() ? std::numeric_limits<int64_t>::max()
+                                         : timers_.front().when_us,
+                         std::memory_order_release);
+  }
+  for (auto& timer : due) {
+    timer.looper->onGroupTimer(timer.when_us);
+    // already queued or running loopers check their timers at the end of
+    // the slice
+    if (!timer.looper->scheduled_.exchange(true, std::memory_order_seq_cst)) {
+      schedule(std::move(timer.looper));
+    }
+  }
+}
+
+// Blocks until there may be work, returns false once the group is stopping
+// and no looper is queued.
+bool LooperGroup::waitForWork() {
+  std::unique_lock<std::mutex> l(mutex_);
+  idle_workers_.fetch_add(1, std::memory_order_seq_cst);
+  bool keep_running = true;
+  if (queued_.load(std::memory_order_seq_cst) == 0) {
+    if (stopping_.load(std::memory_order_relaxed)) {
+      keep_running = false;
+    } else {
+      clock_->WaitUntil(l, condition_,
+                        next_timer_us_.load(std::memory_order_relaxed));
+    }
+  }
+  idle_workers_.fetch_sub(1, std::memory_order_relaxed);
+  return keep_running;
+}
+
+}  // namespace media
+}  // namespace ave
@@ -0,0 +1,108 @@
+/*
+ * looper_group.h
+ * Copyright (C) 2024 youfa <vsyfar@gmail.com>
+ *
+ * Distributed under terms of the GPLv2 license.
+ */
+
+#ifndef LOOPER_GROUP_H
+#define LOOPER_GROUP_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "base/constructor_magic.h"
+
+#include "clock.h"
+#include "looper.h"
+
+namespace ave {
+namespace media {
+
+// Runs many Loopers on a fixed set of worker threads. A group looper has no
+// thread of its own: once it has work it is queued on a worker, which
+// delivers a slice of its messages. Idle workers steal queued loopers from
+// busy ones. A looper is run by at most one worker at a time, so the
+// messages of every looper, and so of every handler, are still delivered in
+// order. Handler and Message code does not change.
+//
+// The group must outlive the loopers it created.
+class LooperGroup {
+ public:
+  // |num_workers| 0 means one per hardware thread
+  explicit LooperGroup(size_t num_workers = 0,
+                       std::shared_ptr<Clock> clock = nullptr);
+  virtual ~LooperGroup();
+
+  // Returns a started looper running on this group.
+  std::shared_ptr<Looper> createLooper(
+      std::string name,
+      Looper::DelayedQueueType type = Looper::DelayedQueueType::kPriorityQueue);
+
+  size_t size() const { return workers_.size(); }
+
+  // true on one of this group's worker threads
+  bool isWorkerThread() const;
+
+ private:
+  friend class Looper;
+
+  // messages delivered per looper before a worker moves on to the next one
+  static constexpr size_t kMaxMessagesPerSlice = 64;
+
+  struct Worker {
+    std::mutex mutex;
+    std::deque<std::shared_ptr<Looper>> runnable;
+    std::thread thread;
+  };
+
+  struct Timer {
+    int64_t when_us;
+    std::shared_ptr<Looper> looper;
+  };
+
+  struct TimerOrder {
+    bool operator()(const Timer& first, const Timer& second) const {
+      return first.when_us > second.when_us;
+    }
+  };
+
+  // queue |looper| on a worker, the caller owns its scheduled_ flag
+  void schedule(std::shared_ptr<Looper> looper);
+  // wake |looper| once |when_us| is reached
+  void scheduleAt(std::shared_ptr<Looper> looper, int64_t when_us);
+
+  void workerLoop(size_t index);
+  bool popRunnable(size_t index, std::shared_ptr<Looper>& looper);
+  void fireDueTimers();
+  bool waitForWork();
+
+  const std::shared_ptr<Clock> clock_;
+  int32_t clock_wakeup_id_;
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::atomic<size_t> next_worker_;
+  // loopers sitting in any worker's runnable queue
+  std::atomic<int64_t> queued_;
+  std::atomic<int32_t> idle_workers_;
+
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  // written under mutex_, read by Looper::stop() without it
+  std::atomic<bool> stopping_;
+  // binary heap ordered by TimerOrder, guarded by mutex_
+  std::vector<Timer> timers_;
+  std::atomic<int64_t> next_timer_us_;
+
+  AVE_DISALLOW_COPY_AND_ASSIGN(LooperGroup);
+};
+
+}  // namespace media
+}  // namespace ave
+
+#endif /* !LOOPER_GROUP_H */
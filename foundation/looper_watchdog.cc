@@ -0,0 +1,301 @@
+/*
+ * looper_watchdog.cc
+ * Copyright (C) 2024 youfa <vsyfar@gmail.com>
+ *
+ * Distributed under terms of the GPLv2 license.
+ */
+
+#include "looper_watchdog.h"
+
+#include <algorithm>
+#include <chrono>
+#include <utility>
+
+#if defined(__linux__) && defined(__GLIBC__)
+#include <execinfo.h>
+#include <pthread.h>
+#include <signal.h>
+
+#include <cerrno>
+#define AVE_WATCHDOG_SAMPLES_STACKS 1
+#endif
+
+#include "clock.h"
+#include "thread_priority.h"
+
+namespace ave {
+namespace media {
+
+namespace {
+const int64_t kMinPeriodUs = 1000;
+const int64_t kMaxPeriodUs = 100000;
+
+// the watchdog thread outlives static destruction, Clock::GetDefault() not
+int64_t NowUs() {
+  static SteadyClock* clock = new SteadyClock();
+  return clock->NowUs();
+}
+}  // namespace
+
+DispatchWatch::DispatchWatch()
+    : sequence_(0), active_(false), handler_id_(0), what_(0), start_us_(0),
+      thread_(0) {}
+
+void DispatchWatch::begin(int32_t handler_id, uint32_t what) {
+#if defined(AVE_WATCHDOG_SAMPLES_STACKS)
+  thread_.store(static_cast<uint64_t>(pthread_self()),
+                std::memory_order_relaxed);
+#endif
+  publish(true, handler_id, what, NowUs());
+}
+
+void DispatchWatch::end() {
+  publish(false, 0, 0, 0);
+}
+
+// single writer, so plain stores are enough to move the sequence
+void DispatchWatch::publish(bool active,
+                            int32_t handler_id,
+                            uint32_t what,
+                            int64_t start_us) {
+  uint64_t sequence = sequence_.load(std::memory_order_relaxed);
+  sequence_.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  active_.store(active, std::memory_order_relaxed);
+  handler_id_.store(handler_id, std::memory_order_relaxed);
+  what_.store(what, std::memory_order_relaxed);
+  start_us_.store(start_us, std::memory_order_relaxed);
+  sequence_.store(sequence + 2, std::memory_order_release);
+}
+
+bool DispatchWatch::read(State& state) const {
+  uint64_t sequence = sequence_.load(std::memory_order_acquire);
+  if (sequence & 1) {
+    return false;
+  }
+  bool active = active_.load(std::memory_order_relaxed);
+  state.handler_id = handler_id_.load(std::memory_order_relaxed);
+  state.what = what_.load(std::memory_order_relaxed);
+  state.start_us = start_us_.load(std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (sequence_.load(std::memory_order_relaxed) != sequence) {
+    return false;
+  }
+  state.sequence = sequence;
+  return active;
+}
+
+// static
+LooperWatchdog& LooperWatchdog::Get() {
+  // never destroyed, loopers may be stopped during static destruction
+  static LooperWatchdog* watchdog = new LooperWatchdog();
+  return *watchdog;
+}
+
+LooperWatchdog::LooperWatchdog() = default;
+
+LooperWatchdog::~LooperWatchdog() = default;
+
+void LooperWatchdog::add(const void* key,
+                         std::string name,
+                         const DispatchWatch* watch,
+                         const std::atomic<int64_t>* queue_depth,
+                         int64_t threshold_us,
+                         bool sample_stack,
+                         WatchdogCallback callback) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  auto callback_ptr = std::make_shared<WatchdogCallback>(std::move(callback));
+  auto it = std::find_if(entries_.begin(), entries_.end(),
+                         [key](const Entry& entry) { return entry.key == key; });
+  if (it != entries_.end()) {
+    it->name = std::move(name);
+    it->threshold_us = threshold_us;
+    it->sample_stack = sample_stack;
+    it->callback = std::move(callback_ptr);
+  } else {
+    entries_.push_back(Entry{key, std::move(name), watch, queue_depth,
+                             threshold_us, sample_stack,
+                             std::move(callback_ptr), 0});
+  }
+  if (thread_ == nullptr) {
+    thread_ = std::make_unique<std::thread>(&LooperWatchdog::run, this);
+  }
+  // the period may have to shrink
+  condition_.notify_all();
+}
+
+void LooperWatchdog::remove(const void* key) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  entries_.erase(std::remove_if(entries_.begin(), entries_.end(),
+                                [key](const Entry& entry) {
+                                  return entry.key == key;
+                                }),
+                 entries_.end());
+}
+
+// Called with mutex_ held.
+int64_t LooperWatchdog::periodUs() const {
+  int64_t period_us = kMaxPeriodUs;
+  for (const auto& entry : entries_) {
+    period_us = std::min(period_us, entry.threshold_us / 4);
+  }
+  return std::max(period_us, kMinPeriodUs);
+}
+
+void LooperWatchdog::run() {
+  SetCurrentThreadName("LooperWatchdog");
+  std::vector<std::pair<std::shared_ptr<WatchdogCallback>, WatchdogReport>>
+      reports;
+  std::unique_lock<std::mutex> l(mutex_);
+  while (true) {
+    if (entries_.empty()) {
+      condition_.wait(l);
+      continue;
+    }
+    condition_.wait_for(l, std::chrono::microseconds(periodUs()));
+
+    int64_t now_us = NowUs();
+    for (auto& entry : entries_) {
+      DispatchWatch::State state;
+      if (!entry.watch->read(state) ||
+          state.sequence == entry.reported_sequence ||
+          now_us - state.start_us < entry.threshold_us) {
+        continue;
+      }
+      entry.reported_sequence = state.sequence;
+
+      WatchdogReport report;
+      report.looper_name = entry.name;
+      report.handler_id = state.handler_id;
+      report.what = state.what;
+      report.elapsed_us = now_us - state.start_us;
+      report.queue_depth = std::max<int64_t>(
+          0, entry.queue_depth->load(std::memory_order_relaxed));
+      if (entry.sample_stack) {
+        sampleStack(entry.watch->thread_.load(std::memory_order_relaxed),
+                    report.stack);
+        // the dispatch finished meanwhile, the stack shows something else
+        DispatchWatch::State after;
+        if (!entry.watch->read(after) || after.sequence != state.sequence) {
+          report.stack.clear();
+        }
+      }
+      reports.emplace_back(entry.callback, std::move(report));
+    }
+
+    if (reports.empty()) {
+      continue;
+    }
+    // callbacks may call back into add() / remove()
+    l.unlock();
+    for (const auto& report : reports) {
+      (*report.first)(report.second);
+    }
+    reports.clear();
+    l.lock();
+  }
+}
+
+#if defined(AVE_WATCHDOG_SAMPLES_STACKS)
+
+namespace {
+
+const int kMaxStackFrames = 64;
+const int64_t kSampleTimeoutUs = 10000;
+
+// The sample being asked for, (sequence << 1) | kWriting, 0 if none. The
+// handler of the target thread claims it by setting kWriting, so a handler
+// running late for a sample that timed out finds another sequence, or
+// none, and leaves g_frames alone.
+const uint64_t kWriting = 1;
+std::atomic<uint64_t> g_request(0);
+std::atomic<uint64_t> g_target(0);
+// sequence of the last sample written to g_frames
+std::atomic<uint64_t> g_done(0);
+void* g_frames[kMaxStackFrames];
+int g_frame_count = 0;
+
+// whatever handled SIGURG before, e.g. for socket out-of-band data
+struct sigaction g_previous_action;
+
+void OnSampleSignal(int signal, siginfo_t* info, void* context) {
+  int saved_errno = errno;
+  uint64_t request = g_request.load(std::memory_order_acquire);
+  if (request != 0 && (request & kWriting) == 0 &&
+      g_target.load(std::memory_order_relaxed) ==
+          static_cast<uint64_t>(pthread_self()) &&
+      g_request.compare_exchange_strong(request, request | kWriting,
+                                        std::memory_order_acquire)) {
+    g_frame_count = backtrace(g_frames, kMaxStackFrames);
+    g_done.store(request >> 1, std::memory_order_release);
+    g_request.store(0, std::memory_order_release);
+  }
+  errno = saved_errno;
+
+  // SIGURG is ignored by default, so only a real handler is chained
+  if (g_previous_action.sa_flags & SA_SIGINFO) {
+    if (g_previous_action.sa_sigaction != nullptr) {
+      g_previous_action.sa_sigaction(signal, info, context);
+    }
+  } else if (g_previous_action.sa_handler != SIG_DFL &&
+             g_previous_action.sa_handler != SIG_IGN) {
+    g_previous_action.sa_handler(signal);
+  }
+}
+
+bool InstallSampleHandler() {
+  // the first backtrace() loads libgcc, not something a signal handler
+  // may do
+  void* warmup[1];
+  backtrace(warmup, 1);
+
+  struct sigaction action = {};
+  action.sa_sigaction = OnSampleSignal;
+  sigemptyset(&action.sa_mask);
+  action.sa_flags = SA_RESTART | SA_SIGINFO;
+  return sigaction(SIGURG, &action, &g_previous_action) == 0;
+}
+
+}  // namespace
+
+// static
+void LooperWatchdog::sampleStack(uint64_t thread, std::vector<void*>& stack) {
+  static const bool installed = InstallSampleHandler();
+  // samples are taken one at a time, under mutex_
+  static uint64_t sequence = 0;
+  if (!installed ||
+      // the handler of a sample that timed out is still writing
+      g_request.load(std::memory_order_acquire) != 0) {
+    return;
+  }
+
+  uint64_t request = ++sequence << 1;
+  g_target.store(thread, std::memory_order_relaxed);
+  g_request.store(request, std::memory_order_release);
+  if (pthread_kill(static_cast<pthread_t>(thread), SIGURG) != 0) {
+    g_request.store(0, std::memory_order_relaxed);
+    return;
+  }
+  int64_t deadline_us = NowUs() + kSampleTimeoutUs;
+  while (g_done.load(std::memory_order_acquire) != sequence) {
+    if (NowUs() > deadline_us) {
+      // withdraw it, unless the handler already claimed it
+      g_request.compare_exchange_strong(request, 0,
+                                        std::memory_order_relaxed);
+      return;
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+  }
+  stack.assign(g_frames, g_frames + g_frame_count);
+}
+
+#else
+
+// static
+void LooperWatchdog::sampleStack(uint64_t /* thread */,
+                                 std::vector<void*>& /* stack */) {}
+
+#endif
+
+}  // namespace media
+}  // namespace ave
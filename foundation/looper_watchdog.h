@@ -0,0 +1,142 @@
+/*
+ * looper_watchdog.h
+ * Copyright (C) 2024 youfa <vsyfar@gmail.com>
+ *
+ * Distributed under terms of the GPLv2 license.
+ */
+
+#ifndef LOOPER_WATCHDOG_H
+#define LOOPER_WATCHDOG_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "base/constructor_magic.h"
+
+namespace ave {
+namespace media {
+
+// A dispatch that has been running for longer than a looper's watchdog
+// threshold.
+struct WatchdogReport {
+  std::string looper_name;
+  int32_t handler_id;
+  uint32_t what;
+  // time spent in the handler so far, it may still be running
+  int64_t elapsed_us;
+  // messages of the looper waiting behind it
+  int64_t queue_depth;
+  // return addresses of the dispatching thread when it was sampled, for
+  // backtrace_symbols() or an offline symbolizer. Empty unless stack
+  // sampling is on.
+  std::vector<void*> stack;
+};
+
+using WatchdogCallback = std::function<void(const WatchdogReport&)>;
+
+// The dispatch a looper is running, written by the dispatching thread and
+// read by the watchdog thread under a sequence lock, so the writer never
+// blocks nor does a read-modify-write.
+class DispatchWatch {
+ public:
+  DispatchWatch();
+
+  void begin(int32_t handler_id, uint32_t what);
+  void end();
+
+  struct State {
+    // identifies the dispatch, changes with every begin()
+    uint64_t sequence;
+    int32_t handler_id;
+    uint32_t what;
+    int64_t start_us;
+  };
+
+  // false while idle, or if the writer got in the way
+  bool read(State& state) const;
+
+ private:
+  void publish(bool active, int32_t handler_id, uint32_t what,
+               int64_t start_us);
+
+  // odd while the writer updates the fields below
+  std::atomic<uint64_t> sequence_;
+  std::atomic<bool> active_;
+  std::atomic<int32_t> handler_id_;
+  std::atomic<uint32_t> what_;
+  std::atomic<int64_t> start_us_;
+  // pthread_t of the dispatching thread, for stack sampling
+  std::atomic<uint64_t> thread_;
+
+  friend class LooperWatchdog;
+
+  AVE_DISALLOW_COPY_AND_ASSIGN(DispatchWatch);
+};
+
+// One process wide thread checking the DispatchWatch of every looper with a
+// watchdog, see Looper::setWatchdog(). It wakes every quarter of the
+// smallest threshold, so a stall is reported between 1x and 1.25x the
+// threshold after the dispatch began, once per dispatch. Callbacks run on
+// the watchdog thread.
+class LooperWatchdog {
+ public:
+  static LooperWatchdog& Get();
+
+  // |queue_depth| and |watch| must stay valid until remove(). Stack
+  // sampling interrupts the dispatching thread with SIGURG, see
+  // sampleStack(). A blocking call the handler is in, that is not
+  // restarted after a signal, fails with EINTR. A SIGURG handler installed
+  // before the first sample keeps being called, also for the samples, one
+  // installed later turns sampling off.
+  void add(const void* key,
+           std::string name,
+           const DispatchWatch* watch,
+           const std::atomic<int64_t>* queue_depth,
+           int64_t threshold_us,
+           bool sample_stack,
+           WatchdogCallback callback);
+  // Once it returns the watchdog no longer touches the entry, a callback
+  // already running may still finish.
+  void remove(const void* key);
+
+ private:
+  struct Entry {
+    const void* key;
+    std::string name;
+    const DispatchWatch* watch;
+    const std::atomic<int64_t>* queue_depth;
+    int64_t threshold_us;
+    bool sample_stack;
+    std::shared_ptr<WatchdogCallback> callback;
+    // sequence of the last dispatch reported
+    uint64_t reported_sequence;
+  };
+
+  LooperWatchdog();
+  ~LooperWatchdog();
+
+  void run();
+  int64_t periodUs() const;
+  // Appends the stack of |thread| to |stack|, a no-op where stack sampling
+  // is not supported.
+  static void sampleStack(uint64_t thread, std::vector<void*>& stack);
+
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  std::vector<Entry> entries_;
+  std::unique_ptr<std::thread> thread_;
+
+  AVE_DISALLOW_COPY_AND_ASSIGN(LooperWatchdog);
+};
+
+}  // namespace media
+}  // namespace ave
+
+#endif /* !LOOPER_WATCHDOG_H */
@@ -0,0 +1,148 @@
+/*
+ * mapped_file.cc
+ * Copyright (C) 2024 youfa <vsyfar@gmail.com>
+ *
+ * Distributed under terms of the GPLv2 license.
+ */
+
+#include "mapped_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include "base/logging.h"
+
+namespace ave {
+namespace media {
+
+namespace {
+size_t PageSize() {
+  static const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  return page_size;
+}
+}  // namespace
+
+// static
+std::shared_ptr<MappedFile> MappedFile::Open(const std::string& path) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    AVE_LOG(LS_WARNING) << "open " << path << " failed: " << strerror(errno);
+    return nullptr;
+  }
+  auto file = Open(fd);
+  ::close(fd);
+  return file;
+}
+
+// static
+std::shared_ptr<MappedFile> MappedFile::Open(int fd) {
+  struct stat st = {};
+  if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+    return nullptr;
+  }
+  auto size = static_cast<size_t>(st.st_size);
+  // private, so writes through a view stay in memory
+  void* data =
+      mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED) {
+    AVE_LOG(LS_WARNING) << "mmap of " << size
+                        << " bytes failed: " << strerror(errno);
+    return nullptr;
+  }
+  return std::shared_ptr<MappedFile>(
+      new MappedFile(static_cast<uint8_t*>(data), size));
+}
+
+MappedFile::MappedFile(uint8_t* data, size_t size)
+    : data_(data),
+      size_(size),
+      pattern_(AccessPattern::kNormal),
+      readahead_end_(0) {}
+
+MappedFile::~MappedFile() {
+  munmap(data_, size_);
+}
+
+std::shared_ptr<Buffer> MappedFile::view(size_t offset, size_t length) {
+  if (offset > size_ || length > size_ - offset) {
+    return nullptr;
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    size_t end = offset + length;
+    // keep kReadaheadBytes ahead, in steps of half of it
+    if (pattern_ == AccessPattern::kSequential &&
+        end + kReadaheadBytes / 2 > readahead_end_ && readahead_end_ < size_) {
+      size_t start = std::max(end, readahead_end_);
+      readahead_end_ = std::min(size_, end + kReadaheadBytes);
+      if (readahead_end_ > start) {
+        advise(start, readahead_end_ - start, MADV_WILLNEED);
+      }
+    }
+  }
+
+  // the deleter holds the mapping
+  auto self = shared_from_this();
+  return std::shared_ptr<Buffer>(new Buffer(data_ + offset, length),
+                                 [self](Buffer* buffer) { delete buffer; });
+}
+
+void MappedFile::setAccessPattern(AccessPattern pattern) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  pattern_ = pattern;
+  readahead_end_ = 0;
+  switch (pattern) {
+    case AccessPattern::kNormal:
+      advise(0, size_, MADV_NORMAL);
+      break;
+    case AccessPattern::kSequential:
+      advise(0, size_, MADV_SEQUENTIAL);
+      break;
+    case AccessPattern::kRandom:
+      advise(0, size_, MADV_RANDOM);
+      break;
+  }
+}
+
+void MappedFile::willNeed(size_t offset, size_t length) {
+  advise(offset, length, MADV_WILLNEED);
+}
+
+void MappedFile::dontNeed(size_t offset, size_t length) {
+  if (offset >= size_ || length == 0) {
+    return;
+  }
+  // Rounded in, not out: dropping a page throws away what views wrote to
+  // it, also outside the range. The last page only holds file bytes.
+  size_t start = (offset + PageSize() - 1) / PageSize() * PageSize();
+  size_t end = offset + std::min(length, size_ - offset);
+  if (end < size_) {
+    end = end / PageSize() * PageSize();
+  }
+  if (end > start) {
+    advise(start, end - start, MADV_DONTNEED);
+  }
+}
+
+void MappedFile::advise(size_t offset, size_t length, int advice) {
+  if (offset >= size_ || length == 0) {
+    return;
+  }
+  size_t end = std::min(size_, offset + std::min(length, size_ - offset));
+  // madvise() wants a page aligned start, the mapping starts on one
+  size_t start = offset / PageSize() * PageSize();
+  if (madvise(data_ + start, end - start, advice) != 0) {
+    AVE_LOG(LS_VERBOSE) << "madvise(" << advice
+                        << ") failed: " << strerror(errno);
+  }
+}
+
+}  // namespace media
+}  // namespace ave
@@ -0,0 +1,92 @@
+/*
+ * mapped_file.h
+ * Copyright (C) 2024 youfa <vsyfar@gmail.com>
+ *
+ * Distributed under terms of the GPLv2 license.
+ */
+
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "base/constructor_magic.h"
+
+#include "buffer.h"
+
+namespace ave {
+namespace media {
+
+// A whole file mapped into memory, handing out samples as Buffers that
+// point into the page cache instead of copies:
+//   auto file = MappedFile::Open("/sdcard/movie.mp4");
+//   file->setAccessPattern(MappedFile::AccessPattern::kSequential);
+//   auto sample = file->view(sample_offset, sample_size);
+//
+// Every view keeps the mapping alive, it is unmapped once the MappedFile
+// and all views are gone. The mapping is private and writable, a write
+// through a view copies the page and never reaches the file. Views cannot
+// grow, ensureCapacity() on them aborts.
+//
+// Thread safe.
+class MappedFile : public std::enable_shared_from_this<MappedFile> {
+ public:
+  enum class AccessPattern {
+    // the kernel's default readahead
+    kNormal,
+    // aggressive kernel readahead, and view() prefetches the next
+    // kReadaheadBytes as the reader moves forward
+    kSequential,
+    // no readahead, for seeking or index driven readers
+    kRandom,
+  };
+
+  // distance view() keeps prefetched ahead of a sequential reader
+  static constexpr size_t kReadaheadBytes = 4 * 1024 * 1024;
+
+  // nullptr if the file cannot be opened or mapped, e.g. it is empty.
+  static std::shared_ptr<MappedFile> Open(const std::string& path);
+  // Maps |fd|, which the caller still owns and may close afterwards.
+  static std::shared_ptr<MappedFile> Open(int fd);
+
+  ~MappedFile();
+
+  size_t size() const { return size_; }
+
+  // A view of |length| bytes at |offset|, nullptr if that is past the end.
+  std::shared_ptr<Buffer> view(size_t offset, size_t length);
+
+  // madvise() hints, rounded out to whole pages unless noted. All are best
+  // effort.
+  void setAccessPattern(AccessPattern pattern);
+  // starts reading the range in, e.g. the next sample run after a seek
+  void willNeed(size_t offset, size_t length);
+  // drops the pages of a range already consumed, views into it read the
+  // file again, writes through them are lost. Only pages wholly inside the
+  // range are dropped, or that end at the end of the file.
+  void dontNeed(size_t offset, size_t length);
+
+ private:
+  MappedFile(uint8_t* data, size_t size);
+
+  void advise(size_t offset, size_t length, int advice);
+
+  uint8_t* const data_;
+  const size_t size_;
+
+  std::mutex mutex_;
+  AccessPattern pattern_;
+  // end of the range prefetched for a sequential reader
+  size_t readahead_end_;
+
+  AVE_DISALLOW_COPY_AND_ASSIGN(MappedFile);
+};
+
+}  // namespace media
+}  // namespace ave
+
+#endif /* !MAPPED_FILE_H */
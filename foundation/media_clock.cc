@@ -13,7 +13,6 @@
 #include "base/logging.h"
 #include "base/task_util/default_task_runner_factory.h"
 #include "base/task_util/task_runner_factory.h"
-#include "base/time_utils.h"
 
 namespace ave {
 namespace media {
@@ -28,8 +27,10 @@ const int64_t kAnchorFluctuationAllowedUs = 10000LL;
 
 }  // namespace
 
-MediaClock::MediaClock()
-    : task_runner_(std::make_unique<TaskRunner>(
+MediaClock::MediaClock(std::shared_ptr<Clock> clock)
+    : clock_(clock != nullptr ? std::move(clock) : Clock::GetDefault()),
+      clock_wakeup_id_(0),
+      task_runner_(std::make_unique<TaskRunner>(
           CreateDefaultTaskRunnerFactory()->CreateTaskRunner(
               "MediaClock",
               TaskRunnerFactory::Priority::NORMAL))),
@@ -38,9 +39,13 @@ MediaClock::MediaClock()
       anchor_time_real_us_(-1),
       max_time_media_us_(INT64_MAX),
       playback_rate_(1.0),
-      notify_callback_(nullptr) {}
+      notify_callback_(nullptr) {
+  // a simulated clock jumped, timers may be due now
+  clock_wakeup_id_ = clock_->AddWakeup([this]() { PostProcessTimers(); });
+}
 
 MediaClock::~MediaClock() {
+  clock_->RemoveWakeup(clock_wakeup_id_);
   Reset();
   // wait for all timers to be processed
 }
@@ -64,7 +69,7 @@ void MediaClock::UpdateAnchor(int64_t anchor_time_media_us,
     return;
   }
   std::lock_guard<std::mutex> lock(mutex_);
-  int64_t now_us = base::TimeMicros();
+  int64_t now_us = clock_->NowUs();
   auto real_diff = static_cast<double>(now_us - anchor_time_real_us);
   auto media_diff = std::llround(real_diff * playback_rate_);
   auto now_media_us = anchor_time_media_us + media_diff;
@@ -105,7 +110,7 @@ void MediaClock::SetPlaybackRate(float rate) {
     return;
   }
 
-  int64_t now_us = base::TimeMicros();
+  int64_t now_us = clock_->NowUs();
   int64_t now_media_us =
       anchor_time_media_us_ +
       std::llround(static_cast<double>(now_us - anchor_time_real_us_) *
@@ -151,7 +156,7 @@ status_t MediaClock::GetRealTimeFor(int64_t target_media_us,
     return NO_INIT;
   }
 
-  auto now_us = base::TimeMicros();
+  auto now_us = clock_->NowUs();
   int64_t now_media_us = 0;
   status_t status = GetMediaTime_l(now_us, &now_media_us, true);
   if (status != OK) {
@@ -246,7 +251,7 @@ status_t MediaClock::GetMediaTime_l(int64_t real_us,
 }
 
 void MediaClock::ProcessTimers() {
-  int64_t now_us = base::TimeMicros();
+  int64_t now_us = clock_->NowUs();
   int64_t now_media_us = 0;
   auto status = GetMediaTime_l(now_us, &now_media_us, false);
 
@@ -17,6 +17,8 @@
 #include "base/task_util/task_runner.h"
 #include "base/thread_annotation.h"
 
+#include "clock.h"
+
 namespace ave {
 namespace media {
 
@@ -61,7 +63,8 @@ class MediaClock {
                                  float playback_rate) = 0;
   };
 
-  explicit MediaClock();
+  // |clock| defaults to Clock::GetDefault()
+  explicit MediaClock(std::shared_ptr<Clock> clock = nullptr);
   ~MediaClock();
 
   void SetStartingTimeMedia(int64_t starting_time_media_us);
@@ -121,6 +124,8 @@ class MediaClock {
                                         float playback_rate) REQUIRES(mutex_);
   void NotifyDiscontinuity() REQUIRES(mutex_);
 
+  const std::shared_ptr<Clock> clock_;
+  int32_t clock_wakeup_id_;
   std::unique_ptr<TaskRunner> task_runner_;
   mutable std::mutex mutex_;
   int64_t starting_time_media_us_ GUARDED_BY(mutex_);
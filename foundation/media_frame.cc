@@ -7,6 +7,8 @@
 
 #include "media_frame.h"
 
+#include <utility>
+
 #include "base/checks.h"
 #include "media/foundation/media_utils.h"
 
@@ -17,13 +19,26 @@ MediaFrame MediaFrame::Create(size_t size) {
   return {size, protect_parameter()};
 }
 
+MediaFrame MediaFrame::Create(size_t size,
+                              const std::shared_ptr<BufferPool>& pool) {
+  return {pool->acquire(size), protect_parameter()};
+}
+
 MediaFrame MediaFrame::CreateWithHandle(void* handle) {
   return {handle, protect_parameter()};
 }
 
+MediaFrame MediaFrame::CreateWithBuffer(std::shared_ptr<Buffer> buffer) {
+  AVE_CHECK(buffer != nullptr);
+  return {std::move(buffer), protect_parameter()};
+}
+
 MediaFrame::MediaFrame(size_t size, protect_parameter)
-    : size_(size),
-      data_(std::make_shared<Buffer>(size)),
+    : MediaFrame(std::make_shared<Buffer>(size), protect_parameter()) {}
+
+MediaFrame::MediaFrame(std::shared_ptr<Buffer> buffer, protect_parameter)
+    : size_(buffer->size()),
+      data_(std::move(buffer)),
       native_handle_(nullptr),
       buffer_type_(FrameBufferType::kTypeNormal),
       media_type_(MediaType::UNKNOWN),
@@ -69,6 +84,13 @@ void MediaFrame::SetSize(size_t size) {
   size_ = data_->size();
 }
 
+void MediaFrame::SetSize(size_t size, const std::shared_ptr<BufferPool>& pool) {
+  AVE_DCHECK(buffer_type_ == FrameBufferType::kTypeNormal);
+  AVE_DCHECK(size > 0);
+  data_ = pool->acquire(size);
+  size_ = data_->size();
+}
+
 void MediaFrame::SetData(uint8_t* data, size_t size) {
   AVE_DCHECK(buffer_type_ == FrameBufferType::kTypeNormal);
   data_ = std::make_shared<Buffer>(data, size);
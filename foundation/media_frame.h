@@ -11,6 +11,7 @@
 #include <memory>
 
 #include "buffer.h"
+#include "buffer_pool.h"
 #include "media_utils.h"
 
 namespace ave {
@@ -45,7 +46,13 @@ class MediaFrame {
   };
 
   static MediaFrame Create(size_t size);
+  // the buffer comes from, and goes back to, |pool|
+  static MediaFrame Create(size_t size,
+                           const std::shared_ptr<BufferPool>& pool);
   static MediaFrame CreateWithHandle(void* handle);
+  // Wraps |buffer|, e.g. from SharedMemoryPool::importBuffer(), which must
+  // not be nullptr.
+  static MediaFrame CreateWithBuffer(std::shared_ptr<Buffer> buffer);
 
   MediaFrame(const MediaFrame& other);
   ~MediaFrame();
@@ -56,6 +63,7 @@ class MediaFrame {
 
   // Buffer operations
   void SetSize(size_t size);
+  void SetSize(size_t size, const std::shared_ptr<BufferPool>& pool);
   void SetData(uint8_t* data, size_t size);
   const uint8_t* data() const;
   size_t size() const { return size_; }
@@ -70,6 +78,7 @@ class MediaFrame {
 
  private:
   MediaFrame(size_t size, protect_parameter);
+  MediaFrame(std::shared_ptr<Buffer> buffer, protect_parameter);
   MediaFrame(void* handle, protect_parameter);
 
   size_t size_;
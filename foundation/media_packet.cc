@@ -6,6 +6,9 @@
  */
 
 #include "media_packet.h"
+
+#include <utility>
+
 #include "base/checks.h"
 
 namespace ave {
@@ -15,19 +18,48 @@ MediaPacket MediaPacket::Create(size_t size) {
   return MediaPacket(size, protect_parameter());
 }
 
+MediaPacket MediaPacket::Create(size_t size,
+                                const std::shared_ptr<BufferPool>& pool) {
+  return MediaPacket(pool->acquire(size), protect_parameter());
+}
+
 MediaPacket MediaPacket::CreateWithHandle(void* handle) {
   return MediaPacket(handle, protect_parameter());
 }
 
+MediaPacket MediaPacket::CreateWithBuffer(std::shared_ptr<Buffer> buffer) {
+  AVE_CHECK(buffer != nullptr);
+  return MediaPacket(std::move(buffer), protect_parameter());
+}
+
+MediaPacket MediaPacket::CreateWithChain(std::shared_ptr<BufferChain> chain) {
+  return MediaPacket(std::move(chain), protect_parameter());
+}
+
 MediaPacket::MediaPacket(size_t size, protect_parameter)
-    : size_(size),
-      data_(std::make_shared<Buffer>(size)),
+    : MediaPacket(std::make_shared<Buffer>(size), protect_parameter()) {}
+
+MediaPacket::MediaPacket(std::shared_ptr<Buffer> buffer, protect_parameter)
+    : size_(buffer->size()),
+      data_(std::move(buffer)),
       native_handle_(nullptr),
       buffer_type_(PacketBufferType::kTypeNormal),
       media_type_(MediaType::UNKNOWN),
       is_eos_(false),
       media_format_(MediaFormat::Create(MediaType::UNKNOWN)) {}
 
+MediaPacket::MediaPacket(std::shared_ptr<BufferChain> chain, protect_parameter)
+    : size_(0),
+      data_(nullptr),
+      chain_(std::move(chain)),
+      native_handle_(nullptr),
+      buffer_type_(PacketBufferType::kTypeChain),
+      media_type_(MediaType::UNKNOWN),
+      is_eos_(false),
+      media_format_(MediaFormat::Create(MediaType::UNKNOWN)) {
+  AVE_CHECK(chain_ != nullptr);
+}
+
 MediaPacket::MediaPacket(void* handle, protect_parameter)
     : size_(0),
       data_(nullptr),
@@ -48,6 +80,13 @@ MediaPacket::MediaPacket(const MediaPacket& other)
     data_ = other.data_;
     native_handle_ = nullptr;
     buffer_type_ = PacketBufferType::kTypeNormal;
+  } else if (other.buffer_type_ == PacketBufferType::kTypeChain) {
+    data_ = other.data_;
+    // linearize() rewrites the chain, a shared one would race
+    chain_ = std::make_shared<BufferChain>();
+    chain_->append(*other.chain_);
+    native_handle_ = nullptr;
+    buffer_type_ = PacketBufferType::kTypeChain;
   } else {
     data_ = nullptr;
     native_handle_ = other.native_handle_;
@@ -78,6 +117,14 @@ void MediaPacket::SetSize(size_t size) {
   size_ = data_->size();
 }
 
+void MediaPacket::SetSize(size_t size,
+                          const std::shared_ptr<BufferPool>& pool) {
+  AVE_DCHECK(buffer_type_ == PacketBufferType::kTypeNormal);
+  AVE_DCHECK(size > 0);
+  data_ = pool->acquire(size);
+  size_ = data_->size();
+}
+
 void MediaPacket::SetData(uint8_t* data, size_t size) {
   AVE_DCHECK(buffer_type_ == PacketBufferType::kTypeNormal);
   data_ = std::make_shared<Buffer>(data, size);
@@ -100,10 +147,28 @@ VideoSampleInfo* MediaPacket::video_info() {
   return &sample_info.video();
 }
 
+size_t MediaPacket::size() const {
+  if (buffer_type_ == PacketBufferType::kTypeChain) {
+    return chain_->size();
+  }
+  return size_;
+}
+
+std::shared_ptr<Buffer>& MediaPacket::buffer() {
+  if (buffer_type_ == PacketBufferType::kTypeChain) {
+    data_ = chain_->linearize();
+  }
+  return data_;
+}
+
 const uint8_t* MediaPacket::data() const {
   if (buffer_type_ == PacketBufferType::kTypeNormal) {
     return data_->data();
   }
+  if (buffer_type_ == PacketBufferType::kTypeChain) {
+    auto buffer = chain_->linearize();
+    return buffer != nullptr ? buffer->data() : nullptr;
+  }
   return nullptr;
 }
 
@@ -11,6 +11,8 @@
 #include <memory>
 
 #include "buffer.h"
+#include "buffer_chain.h"
+#include "buffer_pool.h"
 #include "media_format.h"
 #include "media_utils.h"
 #include "message_object.h"
@@ -29,14 +31,27 @@ class MediaPacket : MessageObject {
   enum class PacketBufferType {
     kTypeNormal,
     kTypeNativeHandle,
+    // fragments in a BufferChain, see chain()
+    kTypeChain,
   };
 
   static MediaPacket Create(size_t size);
+  // the buffer comes from, and goes back to, |pool|
+  static MediaPacket Create(size_t size,
+                            const std::shared_ptr<BufferPool>& pool);
   static MediaPacket CreateWithHandle(void* handle);
+  // Wraps |buffer|, e.g. from SharedMemoryPool::importBuffer(), which must
+  // not be nullptr.
+  static MediaPacket CreateWithBuffer(std::shared_ptr<Buffer> buffer);
+  // Copies get a chain of their own over the same fragments, so each copy
+  // can be linearized on its own thread.
+  static MediaPacket CreateWithChain(std::shared_ptr<BufferChain> chain);
 
  private:
   explicit MediaPacket(size_t size, protect_parameter);
+  explicit MediaPacket(std::shared_ptr<Buffer> buffer, protect_parameter);
   explicit MediaPacket(void* handle, protect_parameter);
+  explicit MediaPacket(std::shared_ptr<BufferChain> chain, protect_parameter);
 
  public:
   ~MediaPacket() override;
@@ -47,6 +62,7 @@ class MediaPacket : MessageObject {
 
   // will reset size and data
   void SetSize(size_t size);
+  void SetSize(size_t size, const std::shared_ptr<BufferPool>& pool);
   void SetData(uint8_t* data, size_t size);
 
   // get sample info
@@ -54,9 +70,14 @@ class MediaPacket : MessageObject {
   AudioSampleInfo* audio_info();
   VideoSampleInfo* video_info();
 
-  size_t size() const { return size_; }
-  std::shared_ptr<Buffer>& buffer() { return data_; }
+  size_t size() const;
+  // For kTypeChain packets buffer() and data() linearize the chain first,
+  // read it with chain() to avoid the copy. That changes the chain, so one
+  // chain packet must not be read from several threads at once; give each
+  // thread a copy.
+  std::shared_ptr<Buffer>& buffer();
   const uint8_t* data() const;
+  const std::shared_ptr<BufferChain>& chain() const { return chain_; }
 
   MediaType media_type() const { return media_type_; }
   PacketBufferType buffer_type() const { return buffer_type_; }
@@ -68,6 +89,7 @@ class MediaPacket : MessageObject {
  private:
   size_t size_;
   std::shared_ptr<Buffer> data_;
+  std::shared_ptr<BufferChain> chain_;
   void* native_handle_;
   PacketBufferType buffer_type_;
   MediaType media_type_;
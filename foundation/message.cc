@@ -7,10 +7,14 @@
 
 #include "message.h"
 
-#include <iostream>
+#include <atomic>
+#include <cstring>
 #include <memory>
+#include <string>
 
+#include "base/checks.h"
 #include "base/errors.h"
+#include "free_list.h"
 #include "handler.h"
 #include "looper.h"
 
@@ -18,29 +22,93 @@ namespace ave {
 namespace media {
 
 status_t ReplyToken::setReply(const std::shared_ptr<Message>& reply) {
-  if (replied_) {
-    return -1;
+  ResumeFn resume = nullptr;
+  void* resumeArg = nullptr;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (replied_) {
+      return -1;
+    }
+    reply_ = reply;
+    replied_ = true;
+    resume = resume_;
+    resumeArg = resume_arg_;
+    // a waiting thread has nothing to do before the lock is released
+    condition_.notify_one();
+  }
+  if (resume != nullptr) {
+    resume(resumeArg);
   }
-  std::cout << "setReply" << std::endl;
-  // AVE_CHECK(reply_ == nullptr);
-  reply_ = reply;
-  replied_ = true;
   return 0;
 }
 
+void ReplyToken::waitReply(std::shared_ptr<Message>& reply) {
+  std::unique_lock<std::mutex> l(mutex_);
+  condition_.wait(l, [this]() { return replied_; });
+  reply = std::move(reply_);
+}
+
+bool ReplyToken::getReply(std::shared_ptr<Message>& reply) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (replied_) {
+    reply = std::move(reply_);
+  }
+  return replied_;
+}
+
+bool ReplyToken::setResume(ResumeFn resume, void* arg) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (replied_) {
+    return false;
+  }
+  resume_ = resume;
+  resume_arg_ = arg;
+  return true;
+}
+
 Message::Message()
-    : what_(static_cast<uint32_t>(0)), handler_id_(static_cast<int32_t>(0)) {}
+    : what_(static_cast<uint32_t>(0)), handler_id_(static_cast<int32_t>(0)),
+      frozen_(false) {}
 
 Message::Message(uint32_t what, const std::shared_ptr<Handler> &handler)
-    : what_(what), handler_id_(static_cast<int32_t>(0)) {
+    : what_(what), handler_id_(static_cast<int32_t>(0)), frozen_(false) {
   setHandler(handler);
 }
 
-Message::~Message() {
-  clear();
+Message::~Message() = default;
+
+// static
+std::shared_ptr<Message> Message::Obtain() {
+  Message* message = FreeList<Message>::Get();
+  if (message == nullptr) {
+    message = new Message();
+  }
+  // the control block is pooled as well
+  return std::shared_ptr<Message>(message, &Message::recycle,
+                                  PooledAllocator<Message>());
+}
+
+// static
+std::shared_ptr<Message> Message::Obtain(
+    uint32_t what,
+    const std::shared_ptr<Handler>& handler) {
+  std::shared_ptr<Message> message = Obtain();
+  message->setWhat(what);
+  message->setHandler(handler);
+  return message;
+}
+
+// static
+void Message::recycle(Message* message) {
+  message->frozen_ = false;
+  message->what_ = static_cast<uint32_t>(0);
+  message->setHandler(nullptr);
+  message->clear();
+  FreeList<Message>::Put(message);
 }
 
 void Message::setWhat(uint32_t what) {
+  AVE_CHECK(!frozen_);
   what_ = what;
 }
 
@@ -49,6 +117,7 @@ uint32_t Message::what() const {
 }
 
 void Message::setHandler(const std::shared_ptr<Handler> &handler) {
+  AVE_CHECK(!frozen_);
   if (handler == nullptr) {
     handler_id_ = static_cast<int32_t>(0);
     handler_.reset();
@@ -68,6 +137,23 @@ status_t Message::post(int64_t delayUs) {
   return 0;
 }
 
+status_t Message::postCoalesced(int64_t delayUs) {
+  auto looper = looper_.lock();
+  if (looper != nullptr) {
+    looper->postCoalesced(shared_from_this(), delayUs);
+  }
+  return 0;
+}
+
+std::shared_ptr<Looper::PendingMessage> Message::postCancellable(
+    int64_t delayUs) {
+  auto looper = looper_.lock();
+  if (looper == nullptr) {
+    return nullptr;
+  }
+  return looper->postCancellable(shared_from_this(), delayUs);
+}
+
 status_t Message::postAndWaitResponse(std::shared_ptr<Message>& response) {
   std::shared_ptr<Looper> looper = looper_.lock();
   if (looper == nullptr) {
@@ -79,13 +165,27 @@ status_t Message::postAndWaitResponse(std::shared_ptr<Message>& response) {
     return -1;
   }
 
-  setReplyToken("replyID", replyToken);
+  setReplyToken(AVE_MESSAGE_KEY("replyID"), replyToken);
   looper->post(shared_from_this(), 0);
   return looper->awaitResponse(replyToken, response);
 }
 
+#if defined(AVE_MESSAGE_HAS_COROUTINES)
+ReplyAwaiter Message::postAsync() {
+  std::shared_ptr<Looper> looper = looper_.lock();
+  if (looper == nullptr) {
+    return ReplyAwaiter(nullptr);
+  }
+
+  std::shared_ptr<ReplyToken> replyToken = looper->createReplyToken();
+  setReplyToken(AVE_MESSAGE_KEY("replyID"), replyToken);
+  looper->post(shared_from_this(), 0);
+  return ReplyAwaiter(std::move(replyToken));
+}
+#endif
+
 bool Message::senderAwaitsResponse(std::shared_ptr<ReplyToken>& replyId) {
-  bool found = findReplyToken("replyID", replyId);
+  bool found = findReplyToken(AVE_MESSAGE_KEY("replyID"), replyId);
   if (!found) {
     return false;
   }
@@ -106,7 +206,15 @@ status_t Message::postReply(const std::shared_ptr<ReplyToken>& replyId) {
 }
 
 void Message::clear() {
-  items_.clear();
+  AVE_CHECK(!frozen_);
+  if (ownsItems()) {
+    // destroys the values, keeps the capacity
+    items_->entries.clear();
+    items_->index.clear();
+  } else {
+    items_.reset();
+  }
+  payload_.reset();
 }
 
 // void Message::setObject(const char* name, std::shared_ptr<MessageObject>&
@@ -124,48 +232,155 @@ void Message::clear() {
 //}
 //
 
-std::shared_ptr<Message::Item> Message::allocateItem(const char* name) {
-  auto search = items_.find(name);
-  if (search != items_.end()) {
-    items_.erase(search);
+// true if nobody else shares items_, it may be written in place
+bool Message::ownsItems() const {
+  if (items_ == nullptr || items_.use_count() != 1) {
+    return false;
+  }
+  // pairs with the release of the last other owner, its reads of the table
+  // happen before our writes
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return true;
+}
+
+// Copies the table first if a dup() still shares it.
+Message::ItemTable& Message::mutableItems() {
+  AVE_CHECK(!frozen_);
+  if (!ownsItems()) {
+    items_ = items_ != nullptr
+                 ? std::allocate_shared<ItemTable>(
+                       PooledAllocator<ItemTable>(), *items_)
+                 : std::allocate_shared<ItemTable>(
+                       PooledAllocator<ItemTable>());
+  }
+  return *items_;
+}
+
+Message::Item* Message::allocateItem(MessageKey key) {
+  ItemTable& table = mutableItems();
+  Item* item = const_cast<Item*>(lookupItem(key));
+  if (item != nullptr) {
+    return item;
+  }
+
+  if (table.entries.capacity() == 0) {
+    table.entries.reserve(kMaxLinearItems);
+  }
+  table.entries.push_back(Entry{key, Item()});
+  if (table.entries.size() > kMaxLinearItems) {
+    if (table.index.empty()) {
+      for (size_t i = 0; i < table.entries.size(); i++) {
+        table.index.emplace(table.entries[i].key, i);
+      }
+    } else {
+      table.index.emplace(key, table.entries.size() - 1);
+    }
   }
-  auto result = items_.emplace(name, std::make_shared<Message::Item>());
-  return result.first->second;
+  return &table.entries.back().item;
 }
 
-std::shared_ptr<Message::Item> Message::findItem(const char* name,
-                                                 Type type) const {
-  auto search = items_.find(name);
-  if (search != items_.end()) {
-    auto item = search->second;
-    if (item->mType == type) {
-      return item;
+const Message::Item* Message::lookupItem(MessageKey key) const {
+  if (items_ == nullptr) {
+    return nullptr;
+  }
+  const auto& entries = items_->entries;
+  if (entries.size() > kMaxLinearItems) {
+    auto search = items_->index.find(key);
+    return search != items_->index.end() ? &entries[search->second].item
+                                         : nullptr;
+  }
+  for (const auto& entry : entries) {
+    if (entry.key == key) {
+      return &entry.item;
     }
   }
   return nullptr;
 }
 
+const Message::Item* Message::lookupItem(const char* name) const {
+  if (items_ == nullptr) {
+    return nullptr;
+  }
+  const auto& entries = items_->entries;
+  if (entries.size() > kMaxLinearItems) {
+    MessageKey key = MessageKey::Find(name);
+    return key.valid() ? lookupItem(key) : nullptr;
+  }
+  // few short names, cheaper than hashing |name| to intern it
+  for (const auto& entry : entries) {
+    if (entry.key.c_str() == name || strcmp(entry.key.c_str(), name) == 0) {
+      return &entry.item;
+    }
+  }
+  return nullptr;
+}
+
+const Message::Item* Message::findItem(MessageKey key, Type type) const {
+  const Item* item = lookupItem(key);
+  return (item != nullptr && item->mType == type) ? item : nullptr;
+}
+
+const Message::Item* Message::findItem(const char* name, Type type) const {
+  const Item* item = lookupItem(name);
+  return (item != nullptr && item->mType == type) ? item : nullptr;
+}
+
 bool Message::contains(const char* name) const {
-  auto search = items_.find(name);
-  return search != items_.end();
-}
-
-#define BASIC_TYPE(NAME, TYPENAME)                                    \
-  void Message::set##NAME(const char* name, TYPENAME value) {         \
-    std::shared_ptr<Message::Item> item = allocateItem(name);         \
-    item->mType = Message::kType##NAME;                               \
-    item->value = value;                                              \
-  }                                                                   \
-                                                                      \
-  bool Message::find##NAME(const char* name, TYPENAME* value) const { \
-    std::shared_ptr<Message::Item> item;                              \
-    item = findItem(name, Message::kType##NAME);                      \
-    if (item) {                                                       \
-      *value = std::get<TYPENAME>(item->value);                       \
-      return true;                                                    \
-    }                                                                 \
-    return false;                                                     \
+  return lookupItem(name) != nullptr;
+}
+
+bool Message::contains(MessageKey key) const {
+  return lookupItem(key) != nullptr;
+}
+
+size_t Message::countEntries() const {
+  return items_ != nullptr ? items_->entries.size() : 0;
+}
+
+const char* Message::getEntryNameAt(size_t index, Type* type) const {
+  if (index >= countEntries()) {
+    return nullptr;
   }
+  const Entry& entry = items_->entries[index];
+  *type = entry.item.mType;
+  return entry.key.c_str();
+}
+
+namespace {
+
+template <typename T>
+bool getItemValue(const Message::Item* item, T& value) {
+  if (item == nullptr) {
+    return false;
+  }
+  value = std::get<T>(item->value);
+  return true;
+}
+
+}  // namespace
+
+// OUT turns the find parameter |value| into a TYPENAME lvalue
+#define ITEM_TYPE(NAME, TYPENAME, SETTYPE, FINDTYPE, OUT, KTYPE)          \
+  void Message::set##NAME(const char* name, SETTYPE value) {              \
+    set##NAME(MessageKey::Intern(name), std::move(value));                \
+  }                                                                       \
+                                                                          \
+  void Message::set##NAME(MessageKey key, SETTYPE value) {                \
+    Item* item = allocateItem(key);                                       \
+    item->mType = Message::KTYPE;                                         \
+    item->value = std::move(value);                                       \
+  }                                                                       \
+                                                                          \
+  bool Message::find##NAME(const char* name, FINDTYPE value) const {      \
+    return getItemValue<TYPENAME>(findItem(name, Message::KTYPE), OUT);    \
+  }                                                                       \
+                                                                          \
+  bool Message::find##NAME(MessageKey key, FINDTYPE value) const {        \
+    return getItemValue<TYPENAME>(findItem(key, Message::KTYPE), OUT);     \
+  }
+
+#define BASIC_TYPE(NAME, TYPENAME) \
+  ITEM_TYPE(NAME, TYPENAME, TYPENAME, TYPENAME*, *value, kType##NAME)
 
 BASIC_TYPE(Int32, int32_t)
 BASIC_TYPE(Int64, int64_t)
@@ -176,146 +391,133 @@ BASIC_TYPE(Pointer, void*)
 
 #undef BASIC_TYPE
 
+#define OBJECT_TYPE(NAME, TYPENAME, KTYPE) \
+  ITEM_TYPE(NAME, TYPENAME, TYPENAME, TYPENAME&, value, KTYPE)
+
+OBJECT_TYPE(Message, std::shared_ptr<Message>, kTypeMessage)
+OBJECT_TYPE(ReplyToken, std::shared_ptr<ReplyToken>, kTypeToken)
+OBJECT_TYPE(Buffer, std::shared_ptr<Buffer>, kTypeBuffer)
+OBJECT_TYPE(Object, std::shared_ptr<MessageObject>, kTypeObject)
+
+#undef OBJECT_TYPE
+
+ITEM_TYPE(String,
+          std::string,
+          const std::string&,
+          std::string&,
+          value,
+          kTypeString)
+
+#undef ITEM_TYPE
+
+void Message::setString(const char* name, const char* s, ssize_t len) {
+  setString(MessageKey::Intern(name),
+            std::string(s, len > 0 ? len : strlen(s)));
+}
+
 void Message::setRect(const char* name,
                       int32_t left,
                       int32_t top,
                       int32_t right,
                       int32_t bottom) {
-  std::shared_ptr<Message::Item> item = allocateItem(name);
+  setRect(MessageKey::Intern(name), left, top, right, bottom);
+}
+
+void Message::setRect(MessageKey key,
+                      int32_t left,
+                      int32_t top,
+                      int32_t right,
+                      int32_t bottom) {
+  Item* item = allocateItem(key);
   item->mType = Message::kTypeRect;
   item->value = Rect{left, top, right, bottom};
 }
 
+namespace {
+
+bool getRect(const Message::Item* item,
+             int32_t* left,
+             int32_t* top,
+             int32_t* right,
+             int32_t* bottom) {
+  Message::Rect rect{};
+  if (!getItemValue<Message::Rect>(item, rect)) {
+    return false;
+  }
+  *left = rect.left_;
+  *top = rect.top_;
+  *right = rect.right_;
+  *bottom = rect.bottom_;
+  return true;
+}
+
+}  // namespace
+
 bool Message::findRect(const char* name,
                        int32_t* left,
                        int32_t* top,
                        int32_t* right,
                        int32_t* bottom) const {
-  std::shared_ptr<Message::Item> item;
-  item = findItem(name, Message::kTypeRect);
-  if (item) {
-    Rect rect = std::get<Rect>(item->value);
-    *left = rect.left_;
-    *top = rect.top_;
-    *right = rect.right_;
-    *bottom = rect.bottom_;
-    return true;
-  }
-  return false;
-}
-
-void Message::setString(const char* name, const std::string& s) {
-  std::shared_ptr<Message::Item> item = allocateItem(name);
-  item->mType = Message::kTypeString;
-  item->value = s;
+  return getRect(findItem(name, kTypeRect), left, top, right, bottom);
 }
 
-void Message::setString(const char* name, const char* s, ssize_t len) {
-  std::shared_ptr<Message::Item> item = allocateItem(name);
-  item->mType = Message::kTypeString;
-  item->value = std::string(s, len > 0 ? len : strlen(s));
-}
-
-bool Message::findString(const char* name, std::string& value) const {
-  std::shared_ptr<Message::Item> item;
-  item = findItem(name, kTypeString);
-  if (item) {
-    value = std::get<std::string>(item->value);
-    return true;
-  }
-
-  return false;
-}
-
-void Message::setMessage(const char *name, std::shared_ptr<Message> msg) {
-  std::shared_ptr<Message::Item> item = allocateItem(name);
-  item->mType = Message::kTypeMessage;
-  item->value = std::move(msg);
+bool Message::findRect(MessageKey key,
+                       int32_t* left,
+                       int32_t* top,
+                       int32_t* right,
+                       int32_t* bottom) const {
+  return getRect(findItem(key, kTypeRect), left, top, right, bottom);
 }
 
-bool Message::findMessage(const char* name,
-                          std::shared_ptr<Message>& msg) const {
-  std::shared_ptr<Message::Item> item;
-  item = findItem(name, kTypeMessage);
-  if (item) {
-    msg = std::get<std::shared_ptr<Message>>(item->value);
-    return true;
+std::shared_ptr<Message> Message::dup() const {
+  std::shared_ptr<Message> message = Obtain();
+  message->what_ = what_;
+  message->handler_id_ = handler_id_;
+  message->handler_ = handler_;
+  message->looper_ = looper_;
+  message->items_ = items_;
+  message->payload_.copyFrom(payload_);
+
+  if (items_ != nullptr) {
+    // the copy must not see changes made through our sub-messages
+    for (const auto& entry : items_->entries) {
+      if (entry.item.mType != kTypeMessage) {
+        continue;
+      }
+      const auto& sub = std::get<std::shared_ptr<Message>>(entry.item.value);
+      if (sub != nullptr && !sub->frozen_) {
+        message->setMessage(entry.key, sub->dup());
+      }
+    }
   }
-
-  return false;
-}
-
-void Message::setReplyToken(const char *name,
-                            std::shared_ptr<ReplyToken> token) {
-  std::shared_ptr<Message::Item> item = allocateItem(name);
-  item->mType = kTypeToken;
-  item->value = std::move(token);
+  return message;
 }
 
-bool Message::findReplyToken(const char* name,
-                             std::shared_ptr<ReplyToken>& token) const {
-  std::shared_ptr<Message::Item> item;
-  item = findItem(name, kTypeToken);
-  if (item) {
-    auto result = std::get<std::shared_ptr<ReplyToken>>(item->value);
-    token = std::move(result);
-    return true;
+void Message::freeze() {
+  // also ends cycles of sub-messages
+  if (frozen_) {
+    return;
   }
-  return false;
-}
-
-void Message::setBuffer(const char *name,
-                        std::shared_ptr<ave::media::Buffer> buffer) {
-  std::shared_ptr<Message::Item> item = allocateItem(name);
-  item->mType = kTypeBuffer;
-  item->value = std::move(buffer);
-}
-
-bool Message::findBuffer(const char* name,
-                         std::shared_ptr<ave::media::Buffer>& buffer) const {
-  std::shared_ptr<Message::Item> item;
-  item = findItem(name, kTypeBuffer);
-  if (item) {
-    auto result = std::get<std::shared_ptr<ave::media::Buffer>>(item->value);
-    buffer = std::move(result);
-    return true;
+  frozen_ = true;
+  if (items_ == nullptr) {
+    return;
   }
-  return false;
-}
-
-void Message::setObject(const char *name,
-                        std::shared_ptr<ave::media::MessageObject> obj) {
-  std::shared_ptr<Message::Item> item = allocateItem(name);
-  item->mType = kTypeObject;
-  item->value = std::move(obj);
-}
-
-bool Message::findObject(
-    const char* name,
-    std::shared_ptr<ave::media::MessageObject>& obj) const {
-  std::shared_ptr<Message::Item> item;
-  item = findItem(name, kTypeObject);
-  if (item) {
-    auto result =
-        std::get<std::shared_ptr<ave::media::MessageObject>>(item->value);
-    obj = std::move(result);
-    return true;
+  for (const auto& entry : items_->entries) {
+    if (entry.item.mType == kTypeMessage) {
+      const auto& sub = std::get<std::shared_ptr<Message>>(entry.item.value);
+      if (sub != nullptr) {
+        sub->freeze();
+      }
+    }
   }
-  return false;
-}
-
-std::shared_ptr<Message> Message::dup() const {
-  std::shared_ptr<Message> message =
-      std::make_shared<Message>(what_, handler_.lock());
-
-  return message;
 }
 
-void Message::deliver() {
+std::shared_ptr<Handler> Message::deliver() {
   auto handler = handler_.lock();
   if (handler != nullptr) {
     handler->deliverMessage(shared_from_this());
   }
+  return handler;
 }
 
 }  // namespace media
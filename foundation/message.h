@@ -8,15 +8,28 @@
 #ifndef AVE_MESSAGE_H
 #define AVE_MESSAGE_H
 
+#include <condition_variable>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <type_traits>
 #include <unordered_map>
 #include <variant>
+#include <vector>
 
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <coroutine>
+#define AVE_MESSAGE_HAS_COROUTINES 1
+#endif
+
+#include "base/checks.h"
 #include "base/constructor_magic.h"
 #include "base/errors.h"
 
 #include "looper.h"
+#include "message_key.h"
 #include "message_object.h"
+#include "message_payload.h"
 
 namespace ave {
 namespace media {
@@ -24,31 +37,77 @@ namespace media {
 class Handler;
 class Buffer;
 
+// One pending reply. Each token has its own lock and wait primitive, so a
+// reply wakes only the thread or coroutine waiting for it.
 class ReplyToken : public MessageObject {
  public:
   explicit ReplyToken(const std::shared_ptr<Looper>& looper)
-      : looper_(looper), replied_(false) {}
+      : looper_(looper), replied_(false), resume_(nullptr),
+        resume_arg_(nullptr) {}
   ~ReplyToken() override = default;
 
  private:
   friend class Message;
   friend class Looper;
+  friend class ReplyAwaiter;
+
+  using ResumeFn = void (*)(void* arg);
+
   std::weak_ptr<Looper> looper_;
+  std::mutex mutex_;
+  std::condition_variable condition_;
   std::shared_ptr<Message> reply_;
   bool replied_;
+  // run by setReply() instead of waking a thread, see setResume()
+  ResumeFn resume_;
+  void* resume_arg_;
 
   std::shared_ptr<Looper> getLooper() const { return looper_.lock(); }
 
   status_t setReply(const std::shared_ptr<Message>& reply);
 
-  bool getReply(std::shared_ptr<Message>& reply) {
-    if (replied_) {
-      reply = std::move(reply_);
-    }
+  // blocks until the reply was set
+  void waitReply(std::shared_ptr<Message>& reply);
+
+  bool getReply(std::shared_ptr<Message>& reply);
 
-    return replied_;
+  // Has setReply() call |resume(arg)| on the replying thread. Returns false
+  // if the reply is already there, the caller must not wait then.
+  bool setResume(ResumeFn resume, void* arg);
+};
+
+#if defined(AVE_MESSAGE_HAS_COROUTINES)
+// Awaitable returned by Message::postAsync(), yields the reply, or nullptr
+// if the message could not be posted. The awaiting coroutine is resumed on
+// the thread that posts the reply, usually the target's looper thread, so
+// it should hand heavy work back to its own looper.
+class ReplyAwaiter {
+ public:
+  explicit ReplyAwaiter(std::shared_ptr<ReplyToken> token)
+      : token_(std::move(token)) {}
+
+  bool await_ready() const noexcept { return token_ == nullptr; }
+
+  bool await_suspend(std::coroutine_handle<> handle) {
+    return token_->setResume(
+        [](void* address) {
+          std::coroutine_handle<>::from_address(address).resume();
+        },
+        handle.address());
   }
+
+  std::shared_ptr<Message> await_resume() {
+    std::shared_ptr<Message> reply;
+    if (token_ != nullptr) {
+      token_->getReply(reply);
+    }
+    return reply;
+  }
+
+ private:
+  std::shared_ptr<ReplyToken> token_;
 };
+#endif
 
 class Message : public std::enable_shared_from_this<Message> {
  public:
@@ -92,6 +151,13 @@ class Message : public std::enable_shared_from_this<Message> {
   explicit Message(uint32_t what, const std::shared_ptr<Handler> &handler);
   virtual ~Message();
 
+  // Returns a Message from the per-thread pool. Once the last reference is
+  // dropped it is cleared and goes back to the pool, keeping its item storage,
+  // so steady-state posting does not allocate.
+  static std::shared_ptr<Message> Obtain();
+  static std::shared_ptr<Message> Obtain(uint32_t what,
+                                         const std::shared_ptr<Handler>& handler);
+
   void setWhat(uint32_t what);
   uint32_t what() const;
   void setHandler(const std::shared_ptr<Handler> &handler);
@@ -118,6 +184,11 @@ class Message : public std::enable_shared_from_this<Message> {
 
   bool contains(const char* name) const;
 
+  // Items in the order they were first set, for code that walks a message,
+  // e.g. MessageRecorder. getEntryNameAt() returns nullptr past the end.
+  size_t countEntries() const;
+  const char* getEntryNameAt(size_t index, Type* type) const;
+
   bool findInt32(const char* name, int32_t* value) const;
   bool findInt64(const char* name, int64_t* value) const;
   bool findSize(const char* name, size_t* value) const;
@@ -136,17 +207,97 @@ class Message : public std::enable_shared_from_this<Message> {
                 int32_t* right,
                 int32_t* bottom) const;
 
+  // Same as above, keyed by an interned name. Lookups are pointer compares,
+  // prefer these with AVE_MESSAGE_KEY() on hot paths.
+  void setInt32(MessageKey key, int32_t value);
+  void setInt64(MessageKey key, int64_t value);
+  void setSize(MessageKey key, size_t value);
+  void setFloat(MessageKey key, float value);
+  void setDouble(MessageKey key, double value);
+  void setPointer(MessageKey key, void* value);
+  void setString(MessageKey key, const std::string& s);
+  void setMessage(MessageKey key, std::shared_ptr<Message> msg);
+  void setReplyToken(MessageKey key, std::shared_ptr<ReplyToken> token);
+  void setBuffer(MessageKey key, std::shared_ptr<Buffer> buffer);
+  void setObject(MessageKey key, std::shared_ptr<MessageObject> obj);
+  void setRect(MessageKey key,
+               int32_t left,
+               int32_t top,
+               int32_t right,
+               int32_t bottom);
+
+  bool contains(MessageKey key) const;
+
+  bool findInt32(MessageKey key, int32_t* value) const;
+  bool findInt64(MessageKey key, int64_t* value) const;
+  bool findSize(MessageKey key, size_t* value) const;
+  bool findFloat(MessageKey key, float* value) const;
+  bool findDouble(MessageKey key, double* value) const;
+  bool findPointer(MessageKey key, void** value) const;
+  bool findString(MessageKey key, std::string& value) const;
+  bool findMessage(MessageKey key, std::shared_ptr<Message>& msg) const;
+  bool findReplyToken(MessageKey key,
+                      std::shared_ptr<ReplyToken>& token) const;
+  bool findBuffer(MessageKey key, std::shared_ptr<Buffer>& buffer) const;
+  bool findObject(MessageKey key, std::shared_ptr<MessageObject>& obj) const;
+  bool findRect(MessageKey key,
+                int32_t* left,
+                int32_t* top,
+                int32_t* right,
+                int32_t* bottom) const;
+
+  // Attaches a statically typed payload, replacing any previous one. A
+  // TypedHandler gets it without any key/value lookup.
+  template <typename T>
+  std::decay_t<T>& setPayload(T&& payload) {
+    AVE_CHECK(!frozen_);
+    return payload_.emplace<std::decay_t<T>>(std::forward<T>(payload));
+  }
+
+  // nullptr if there is no payload of type T
+  template <typename T>
+  const T* payload() const {
+    return payload_.get<T>();
+  }
+
+  bool hasPayload() const { return payload_.has_value(); }
+
   status_t post(int64_t delayUs = 0LL);
 
+  // see Looper::postCoalesced()
+  status_t postCoalesced(int64_t delayUs = 0LL);
+
+  // see Looper::postCancellable(), nullptr if the handler has no looper
+  std::shared_ptr<Looper::PendingMessage> postCancellable(
+      int64_t delayUs = 0LL);
+
   status_t postAndWaitResponse(std::shared_ptr<Message>& response);
 
+#if defined(AVE_MESSAGE_HAS_COROUTINES)
+  // Posts the message without blocking, the reply is awaited with
+  //   std::shared_ptr<Message> response = co_await message->postAsync();
+  // so one thread can keep many requests in flight.
+  ReplyAwaiter postAsync();
+#endif
+
   bool senderAwaitsResponse(std::shared_ptr<ReplyToken>& replyId);
 
   status_t postReply(const std::shared_ptr<ReplyToken>& replyId);
 
-  // return a depp copy of Message
+  // Returns a copy of the message that shares the item storage until either
+  // side changes an item. Sub-messages that are not frozen are dup()ed as
+  // well, which copies the item storage right away if there are any; frozen
+  // ones are shared.
   std::shared_ptr<Message> dup() const;
 
+  // Makes the message, and the messages it holds, immutable: changing what,
+  // handler, items or payload is a fatal error from then on. A frozen
+  // message can be read from any number of threads without copies or locks,
+  // use dup() to get a mutable copy. Note postAndWaitResponse() and
+  // postAsync() add an item.
+  void freeze();
+  bool isFrozen() const { return frozen_; }
+
  private:
   friend class Looper;  // for deliver()
 
@@ -154,11 +305,37 @@ class Message : public std::enable_shared_from_this<Message> {
   Looper::handler_id handler_id_;
   std::weak_ptr<Handler> handler_;
   std::weak_ptr<Looper> looper_;
-  std::unordered_map<std::string, std::shared_ptr<Item>> items_;
 
-  std::shared_ptr<Item> allocateItem(const char* name);
-  std::shared_ptr<Item> findItem(const char* name, Type) const;
-  void deliver();
+  // Items live in one flat array, found by a linear scan of interned key
+  // pointers. Past kMaxLinearItems a hash index over the same array takes
+  // over. clear() keeps the capacity for the next user of a pooled message.
+  static constexpr size_t kMaxLinearItems = 16;
+
+  struct Entry {
+    MessageKey key;
+    Item item;
+  };
+
+  struct ItemTable {
+    std::vector<Entry> entries;
+    std::unordered_map<MessageKey, size_t, MessageKey::Hash> index;
+  };
+
+  // shared between dup()s until one of them writes, see mutableItems()
+  std::shared_ptr<ItemTable> items_;
+  MessagePayload payload_;
+  bool frozen_;
+
+  static void recycle(Message* message);
+  bool ownsItems() const;
+  ItemTable& mutableItems();
+  Item* allocateItem(MessageKey key);
+  const Item* lookupItem(MessageKey key) const;
+  const Item* lookupItem(const char* name) const;
+  const Item* findItem(MessageKey key, Type type) const;
+  const Item* findItem(const char* name, Type type) const;
+  // returns the handler the message was delivered to, if any
+  std::shared_ptr<Handler> deliver();
 
   AVE_DISALLOW_COPY_AND_ASSIGN(Message);
 };
@@ -0,0 +1,98 @@
+/*
+ * message_key.cc
+ * Copyright (C) 2024 youfa <vsyfar@gmail.com>
+ *
+ * Distributed under terms of the GPLv2 license.
+ */
+
+#include "message_key.h"
+
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_set>
+
+namespace ave {
+namespace media {
+
+namespace {
+
+struct InternTable {
+  std::shared_mutex mutex;
+  // node based, element addresses are stable
+  std::unordered_set<std::string> names;
+};
+
+// never destroyed, keys may be used during static destruction
+InternTable& GetInternTable() {
+  static InternTable* table = new InternTable();
+  return *table;
+}
+
+// Per thread cache of recent names, so a name passed as a literal over and
+// over skips the table lock and the std::string the lookup builds. Hashed
+// by address, but the name is compared too: the same address may hold
+// another name by now.
+struct CachedName {
+  const char* name;
+  const char* interned;
+};
+
+const size_t kCacheSize = 64;
+thread_local CachedName tls_cache[kCacheSize];
+
+CachedName& CacheSlot(const char* name) {
+  return tls_cache[(reinterpret_cast<uintptr_t>(name) >> 3) % kCacheSize];
+}
+
+bool CacheHit(const CachedName& cached, const char* name) {
+  return cached.name == name && strcmp(cached.interned, name) == 0;
+}
+
+// the canonical copy of |name|, nullptr if it was never interned
+const char* FindInTable(const char* name) {
+  InternTable& table = GetInternTable();
+  std::shared_lock<std::shared_mutex> guard(table.mutex);
+  auto search = table.names.find(name);
+  return search != table.names.end() ? search->c_str() : nullptr;
+}
+
+}  // namespace
+
+// static
+MessageKey MessageKey::Intern(const char* name) {
+  CachedName& cached = CacheSlot(name);
+  if (CacheHit(cached, name)) {
+    return MessageKey(cached.interned);
+  }
+
+  const char* interned = FindInTable(name);
+  if (interned == nullptr) {
+    InternTable& table = GetInternTable();
+    std::unique_lock<std::shared_mutex> guard(table.mutex);
+    interned = table.names.emplace(name).first->c_str();
+  }
+  cached = {name, interned};
+  return MessageKey(interned);
+}
+
+// static
+MessageKey MessageKey::Find(const char* name) {
+  CachedName& cached = CacheSlot(name);
+  if (CacheHit(cached, name)) {
+    return MessageKey(cached.interned);
+  }
+
+  // a miss is not cached, the name may be interned later
+  const char* interned = FindInTable(name);
+  if (interned == nullptr) {
+    return MessageKey();
+  }
+  cached = {name, interned};
+  return MessageKey(interned);
+}
+
+}  // namespace media
+}  // namespace ave
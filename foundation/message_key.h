@@ -0,0 +1,62 @@
+/*
+ * message_key.h
+ * Copyright (C) 2024 youfa <vsyfar@gmail.com>
+ *
+ * Distributed under terms of the GPLv2 license.
+ */
+
+#ifndef MESSAGE_KEY_H
+#define MESSAGE_KEY_H
+
+#include <cstddef>
+#include <functional>
+
+namespace ave {
+namespace media {
+
+// Interned Message item name. Two keys with the same name share one
+// canonical string, so comparing keys is a pointer compare.
+class MessageKey {
+ public:
+  MessageKey() : name_(nullptr) {}
+
+  // Returns the key for |name|, adding it to the process wide table on first
+  // use. Recent names are cached per thread, a repeated name takes no lock.
+  // Prefer AVE_MESSAGE_KEY() for literals, it interns once per call site.
+  static MessageKey Intern(const char* name);
+  // Returns an invalid key if |name| was never interned, no Message can hold
+  // an item with that name then.
+  static MessageKey Find(const char* name);
+
+  const char* c_str() const { return name_; }
+  bool valid() const { return name_ != nullptr; }
+
+  bool operator==(MessageKey other) const { return name_ == other.name_; }
+  bool operator!=(MessageKey other) const { return name_ != other.name_; }
+
+  struct Hash {
+    size_t operator()(MessageKey key) const {
+      return std::hash<const char*>()(key.name_);
+    }
+  };
+
+ private:
+  explicit MessageKey(const char* name) : name_(name) {}
+
+  const char* name_;
+};
+
+}  // namespace media
+}  // namespace ave
+
+// Key for a string literal, interned the first time the call site runs and
+// cached in a function local static afterwards:
+//   msg->findInt32(AVE_MESSAGE_KEY("what"), &what);
+#define AVE_MESSAGE_KEY(name)                                        \
+  ([]() {                                                            \
+    static const ::ave::media::MessageKey key =                      \
+        ::ave::media::MessageKey::Intern(name);                      \
+    return key;                                                      \
+  }())
+
+#endif /* !MESSAGE_KEY_H */
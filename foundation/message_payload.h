@@ -0,0 +1,122 @@
+/*
+ * message_payload.h
+ * Copyright (C) 2024 youfa <vsyfar@gmail.com>
+ *
+ * Distributed under terms of the GPLv2 license.
+ */
+
+#ifndef MESSAGE_PAYLOAD_H
+#define MESSAGE_PAYLOAD_H
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "base/constructor_magic.h"
+
+namespace ave {
+namespace media {
+
+// Type erased holder for one statically typed Message payload. Payloads up
+// to kInlineSize bytes live inside the holder, larger ones on the heap. The
+// type check in get() is a single pointer compare.
+class MessagePayload {
+ public:
+  static constexpr size_t kInlineSize = 64;
+
+  MessagePayload() : data_(nullptr), ops_(nullptr) {}
+  ~MessagePayload() { reset(); }
+
+  template <typename T, typename... Args>
+  T& emplace(Args&&... args) {
+    static_assert(std::is_copy_constructible_v<T>,
+                  "payloads must be copy constructible");
+    reset();
+    if constexpr (fitsInline<T>()) {
+      data_ = new (storage_) T(std::forward<Args>(args)...);
+    } else {
+      data_ = new T(std::forward<Args>(args)...);
+    }
+    ops_ = opsFor<T>();
+    return *static_cast<T*>(data_);
+  }
+
+  // nullptr if empty or holding another type
+  template <typename T>
+  T* get() {
+    return ops_ == opsFor<T>() ? static_cast<T*>(data_) : nullptr;
+  }
+
+  template <typename T>
+  const T* get() const {
+    return ops_ == opsFor<T>() ? static_cast<const T*>(data_) : nullptr;
+  }
+
+  bool has_value() const { return ops_ != nullptr; }
+
+  void reset() {
+    if (ops_ != nullptr) {
+      ops_->destroy(data_);
+      ops_ = nullptr;
+      data_ = nullptr;
+    }
+  }
+
+  void copyFrom(const MessagePayload& other) {
+    reset();
+    if (other.ops_ != nullptr) {
+      data_ = other.ops_->copy(other.data_, storage_);
+      ops_ = other.ops_;
+    }
+  }
+
+ private:
+  struct Ops {
+    void (*destroy)(void* data);
+    // copies |data| into |storage| if it fits, returns the copy
+    void* (*copy)(const void* data, void* storage);
+  };
+
+  template <typename T>
+  static constexpr bool fitsInline() {
+    return sizeof(T) <= kInlineSize &&
+           alignof(T) <= alignof(std::max_align_t);
+  }
+
+  template <typename T>
+  static void destroy(void* data) {
+    if constexpr (fitsInline<T>()) {
+      static_cast<T*>(data)->~T();
+    } else {
+      delete static_cast<T*>(data);
+    }
+  }
+
+  template <typename T>
+  static void* copy(const void* data, void* storage) {
+    if constexpr (fitsInline<T>()) {
+      return new (storage) T(*static_cast<const T*>(data));
+    } else {
+      return new T(*static_cast<const T*>(data));
+    }
+  }
+
+  // the address doubles as the type id
+  template <typename T>
+  static const Ops* opsFor() {
+    static constexpr Ops ops = {&destroy<T>, &copy<T>};
+    return &ops;
+  }
+
+  alignas(std::max_align_t) unsigned char storage_[kInlineSize];
+  void* data_;
+  const Ops* ops_;
+
+  AVE_DISALLOW_COPY_AND_ASSIGN(MessagePayload);
+};
+
+}  // namespace media
+}  // namespace ave
+
+#endif /* !MESSAGE_PAYLOAD_H */
@@ -0,0 +1,492 @@
+/*
+ * message_recorder.cc
+ * Copyright (C) 2024 youfa <vsyfar@gmail.com>
+ *
+ * Distributed under terms of the GPLv2 license.
+ */
+
+#include "message_recorder.h"
+
+#include <cstring>
+#include <type_traits>
+#include <utility>
+
+#include "buffer.h"
+#include "looper.h"
+#include "media_errors.h"
+#include "message.h"
+
+namespace ave {
+namespace media {
+
+// Log layout, all integers varints, signed ones zigzag encoded:
+//   "AVEM" version
+//   per record: delivery time delta to the previous record, message
+//   message:    what, item count, items
+//   item:       name, type (Message::Type), value
+//   name:       index into the name table, an index one past its end is
+//               followed by length and bytes of a new name
+// Floats and doubles are stored as the little endian bytes of their bits,
+// on any host.
+
+namespace {
+
+const char kMagic[4] = {'A', 'V', 'E', 'M'};
+const uint8_t kVersion = 1;
+// sub-message nesting the replayer accepts
+const int kMaxDepth = 16;
+// anything longer is taken for corruption
+const uint64_t kMaxStringSize = 16 * 1024 * 1024;
+
+uint64_t ZigZag(int64_t value) {
+  return (static_cast<uint64_t>(value) << 1) ^
+         static_cast<uint64_t>(value >> 63);
+}
+
+int64_t UnZigZag(uint64_t value) {
+  return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+void PutVarint(std::vector<uint8_t>& out, uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<uint8_t>(value) | 0x80);
+    value >>= 7;
+  }
+  out.push_back(static_cast<uint8_t>(value));
+}
+
+void PutBytes(std::vector<uint8_t>& out, const void* data, size_t size) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  out.insert(out.end(), bytes, bytes + size);
+}
+
+// the bits of a float or double, little endian whatever the host
+template <typename T>
+using Bits = std::conditional_t<sizeof(T) == 4, uint32_t, uint64_t>;
+
+template <typename T>
+void PutLittleEndian(std::vector<uint8_t>& out, T value) {
+  Bits<T> bits = 0;
+  memcpy(&bits, &value, sizeof(T));
+  for (size_t i = 0; i < sizeof(T); i++) {
+    out.push_back(static_cast<uint8_t>(bits >> (8 * i)));
+  }
+}
+
+template <typename T>
+T GetLittleEndian(const uint8_t* bytes) {
+  Bits<T> bits = 0;
+  for (size_t i = 0; i < sizeof(T); i++) {
+    bits |= static_cast<Bits<T>>(bytes[i]) << (8 * i);
+  }
+  T value;
+  memcpy(&value, &bits, sizeof(T));
+  return value;
+}
+
+// items that mean something once replayed
+bool Recordable(const Message& message, const char* name, Message::Type type) {
+  switch (type) {
+    case Message::kTypePointer:
+    case Message::kTypeToken:
+    case Message::kTypeObject:
+      return false;
+    case Message::kTypeMessage: {
+      std::shared_ptr<Message> sub;
+      return message.findMessage(name, sub) && sub != nullptr;
+    }
+    case Message::kTypeBuffer: {
+      std::shared_ptr<Buffer> buffer;
+      return message.findBuffer(name, buffer) && buffer != nullptr;
+    }
+    default:
+      return true;
+  }
+}
+
+}  // namespace
+
+MessageRecorder::MessageRecorder() : file_(nullptr), count_(0), last_us_(0) {}
+
+MessageRecorder::~MessageRecorder() {
+  close();
+}
+
+status_t MessageRecorder::open(const std::string& path) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (file_ != nullptr) {
+    return INVALID_OPERATION;
+  }
+  file_ = fopen(path.c_str(), "wb");
+  if (file_ == nullptr) {
+    return ERROR_IO;
+  }
+  count_ = 0;
+  last_us_ = 0;
+  keys_.clear();
+  if (fwrite(kMagic, sizeof(kMagic), 1, file_) != 1 ||
+      fwrite(&kVersion, sizeof(kVersion), 1, file_) != 1) {
+    fclose(file_);
+    file_ = nullptr;
+    return ERROR_IO;
+  }
+  return OK;
+}
+
+status_t MessageRecorder::close() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (file_ == nullptr) {
+    return OK;
+  }
+  int result = fclose(file_);
+  file_ = nullptr;
+  if (result != 0) {
+    return ERROR_IO;
+  }
+  return OK;
+}
+
+size_t MessageRecorder::count() const {
+  std::lock_guard<std::mutex> guard(mutex_);
+  return count_;
+}
+
+void MessageRecorder::onMessageDelivered(const Handler& /* handler */,
+                                         const Message& message,
+                                         int64_t now_us) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (file_ == nullptr) {
+    return;
+  }
+  scratch_.clear();
+  PutVarint(scratch_, ZigZag(now_us - last_us_));
+  last_us_ = now_us;
+  encodeMessage(message);
+  // stdio buffers, the file sees large writes
+  fwrite(scratch_.data(), 1, scratch_.size(), file_);
+  count_++;
+}
+
+// Called with mutex_ held.
+void MessageRecorder::encodeMessage(const Message& message) {
+  PutVarint(scratch_, message.what());
+
+  size_t entries = message.countEntries();
+  size_t recorded = 0;
+  Message::Type type;
+  for (size_t i = 0; i < entries; i++) {
+    const char* name = message.getEntryNameAt(i, &type);
+    recorded += Recordable(message, name, type) ? 1 : 0;
+  }
+  PutVarint(scratch_, recorded);
+
+  for (size_t i = 0; i < entries; i++) {
+    const char* name = message.getEntryNameAt(i, &type);
+    if (!Recordable(message, name, type)) {
+      continue;
+    }
+    encodeKey(name);
+    scratch_.push_back(static_cast<uint8_t>(type));
+    switch (type) {
+      case Message::kTypeInt32: {
+        int32_t value = 0;
+        message.findInt32(name, &value);
+        PutVarint(scratch_, ZigZag(value));
+        break;
+      }
+      case Message::kTypeInt64: {
+        int64_t value = 0;
+        message.findInt64(name, &value);
+        PutVarint(scratch_, ZigZag(value));
+        break;
+      }
+      case Message::kTypeSize: {
+        size_t value = 0;
+        message.findSize(name, &value);
+        PutVarint(scratch_, value);
+        break;
+      }
+      case Message::kTypeFloat: {
+        float value = 0;
+        message.findFloat(name, &value);
+        PutLittleEndian(scratch_, value);
+        break;
+      }
+      case Message::kTypeDouble: {
+        double value = 0;
+        message.findDouble(name, &value);
+        PutLittleEndian(scratch_, value);
+        break;
+      }
+      case Message::kTypeRect: {
+        int32_t rect[4] = {0, 0, 0, 0};
+        message.findRect(name, &rect[0], &rect[1], &rect[2], &rect[3]);
+        for (int32_t value : rect) {
+          PutVarint(scratch_, ZigZag(value));
+        }
+        break;
+      }
+      case Message::kTypeString: {
+        std::string value;
+        message.findString(name, value);
+        PutVarint(scratch_, value.size());
+        PutBytes(scratch_, value.data(), value.size());
+        break;
+      }
+      case Message::kTypeMessage: {
+        std::shared_ptr<Message> sub;
+        message.findMessage(name, sub);
+        encodeMessage(*sub);
+        break;
+      }
+      case Message::kTypeBuffer: {
+        std::shared_ptr<Buffer> buffer;
+        message.findBuffer(name, buffer);
+        PutVarint(scratch_, buffer->size());
+        break;
+      }
+      default:
+        break;
+    }
+  }
+}
+
+// Called with mutex_ held.
+void MessageRecorder::encodeKey(const char* name) {
+  auto result = keys_.try_emplace(name, static_cast<uint32_t>(keys_.size()));
+  PutVarint(scratch_, result.first->second);
+  if (result.second) {
+    size_t length = strlen(name);
+    PutVarint(scratch_, length);
+    PutBytes(scratch_, name, length);
+  }
+}
+
+MessageReplayer::MessageReplayer() : file_(nullptr), last_us_(0) {}
+
+MessageReplayer::~MessageReplayer() {
+  if (file_ != nullptr) {
+    fclose(file_);
+  }
+}
+
+status_t MessageReplayer::open(const std::string& path) {
+  if (file_ != nullptr) {
+    return INVALID_OPERATION;
+  }
+  file_ = fopen(path.c_str(), "rb");
+  if (file_ == nullptr) {
+    return ERROR_IO;
+  }
+  char magic[sizeof(kMagic)];
+  uint8_t version = 0;
+  if (!readBytes(magic, sizeof(magic)) || !readBytes(&version, 1) ||
+      memcmp(magic, kMagic, sizeof(kMagic)) != 0 || version != kVersion) {
+    fclose(file_);
+    file_ = nullptr;
+    return ERROR_UNSUPPORTED;
+  }
+  last_us_ = 0;
+  keys_.clear();
+  return OK;
+}
+
+status_t MessageReplayer::next(std::shared_ptr<Message>& message,
+                               int64_t* when_us) {
+  if (file_ == nullptr) {
+    return NO_INIT;
+  }
+  int c = fgetc(file_);
+  if (c == EOF) {
+    return ERROR_END_OF_STREAM;
+  }
+  ungetc(c, file_);
+
+  uint64_t delta = 0;
+  if (!readVarint(&delta)) {
+    return ERROR_MALFORMED;
+  }
+  status_t err = decodeMessage(message, 0);
+  if (err != OK) {
+    return err;
+  }
+  last_us_ += UnZigZag(delta);
+  *when_us = last_us_;
+  return OK;
+}
+
+status_t MessageReplayer::replay(const std::shared_ptr<Handler>& handler,
+                                 Timing timing) {
+  std::shared_ptr<Looper> looper = handler->looper();
+  if (looper == nullptr) {
+    return NO_INIT;
+  }
+
+  bool first = true;
+  int64_t first_us = 0;
+  int64_t start_us = 0;
+  std::shared_ptr<Message> message;
+  int64_t when_us = 0;
+  status_t err = OK;
+  while ((err = next(message, &when_us)) == OK) {
+    message->setHandler(handler);
+    if (timing == Timing::kFullSpeed) {
+      message->post();
+      continue;
+    }
+    if (first) {
+      first = false;
+      first_us = when_us;
+      start_us = looper->clock()->NowUs();
+    }
+    int64_t delay_us =
+        (when_us - first_us) - (looper->clock()->NowUs() - start_us);
+    message->post(delay_us > 0 ? delay_us : 0);
+  }
+  return err == ERROR_END_OF_STREAM ? OK : err;
+}
+
+status_t MessageReplayer::decodeMessage(std::shared_ptr<Message>& message,
+                                        int depth) {
+  if (depth > kMaxDepth) {
+    return ERROR_MALFORMED;
+  }
+  uint64_t what = 0;
+  uint64_t count = 0;
+  if (!readVarint(&what) || !readVarint(&count)) {
+    return ERROR_MALFORMED;
+  }
+  message = Message::Obtain();
+  message->setWhat(static_cast<uint32_t>(what));
+
+  for (uint64_t i = 0; i < count; i++) {
+    MessageKey key;
+    uint8_t type = 0;
+    if (!readKey(&key) || !readBytes(&type, 1)) {
+      return ERROR_MALFORMED;
+    }
+    uint64_t value = 0;
+    switch (type) {
+      case Message::kTypeInt32:
+        if (!readVarint(&value)) {
+          return ERROR_MALFORMED;
+        }
+        message->setInt32(key, static_cast<int32_t>(UnZigZag(value)));
+        break;
+      case Message::kTypeInt64:
+        if (!readVarint(&value)) {
+          return ERROR_MALFORMED;
+        }
+        message->setInt64(key, UnZigZag(value));
+        break;
+      case Message::kTypeSize:
+        if (!readVarint(&value)) {
+          return ERROR_MALFORMED;
+        }
+        message->setSize(key, static_cast<size_t>(value));
+        break;
+      case Message::kTypeFloat: {
+        uint8_t bytes[sizeof(float)];
+        if (!readBytes(bytes, sizeof(bytes))) {
+          return ERROR_MALFORMED;
+        }
+        message->setFloat(key, GetLittleEndian<float>(bytes));
+        break;
+      }
+      case Message::kTypeDouble: {
+        uint8_t bytes[sizeof(double)];
+        if (!readBytes(bytes, sizeof(bytes))) {
+          return ERROR_MALFORMED;
+        }
+        message->setDouble(key, GetLittleEndian<double>(bytes));
+        break;
+      }
+      case Message::kTypeRect: {
+        int32_t rect[4];
+        for (int32_t& side : rect) {
+          if (!readVarint(&value)) {
+            return ERROR_MALFORMED;
+          }
+          side = static_cast<int32_t>(UnZigZag(value));
+        }
+        message->setRect(key, rect[0], rect[1], rect[2], rect[3]);
+        break;
+      }
+      case Message::kTypeString: {
+        if (!readVarint(&value) || value > kMaxStringSize) {
+          return ERROR_MALFORMED;
+        }
+        std::string s(static_cast<size_t>(value), '\0');
+        if (!readBytes(&s[0], s.size())) {
+          return ERROR_MALFORMED;
+        }
+        message->setString(key, s);
+        break;
+      }
+      case Message::kTypeMessage: {
+        std::shared_ptr<Message> sub;
+        status_t err = decodeMessage(sub, depth + 1);
+        if (err != OK) {
+          return err;
+        }
+        message->setMessage(key, std::move(sub));
+        break;
+      }
+      case Message::kTypeBuffer:
+        if (!readVarint(&value) || value > kMaxStringSize) {
+          return ERROR_MALFORMED;
+        }
+        // same size, zeroed contents
+        message->setBuffer(key,
+                           std::make_shared<Buffer>(static_cast<size_t>(value)));
+        break;
+      default:
+        return ERROR_MALFORMED;
+    }
+  }
+  return OK;
+}
+
+bool MessageReplayer::readVarint(uint64_t* value) {
+  *value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    int c = fgetc(file_);
+    if (c == EOF) {
+      return false;
+    }
+    *value |= static_cast<uint64_t>(c & 0x7f) << shift;
+    if ((c & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool MessageReplayer::readBytes(void* data, size_t size) {
+  return size == 0 || fread(data, size, 1, file_) == 1;
+}
+
+bool MessageReplayer::readKey(MessageKey* key) {
+  uint64_t index = 0;
+  if (!readVarint(&index) || index > keys_.size()) {
+    return false;
+  }
+  if (index < keys_.size()) {
+    *key = keys_[index];
+    return true;
+  }
+  uint64_t length = 0;
+  if (!readVarint(&length) || length == 0 || length > kMaxStringSize) {
+    return false;
+  }
+  std::string name(static_cast<size_t>(length), '\0');
+  if (!readBytes(&name[0], name.size())) {
+    return false;
+  }
+  *key = MessageKey::Intern(name.c_str());
+  keys_.push_back(*key);
+  return true;
+}
+
+}  // namespace media
+}  // namespace ave
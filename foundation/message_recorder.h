@@ -0,0 +1,117 @@
+/*
+ * message_recorder.h
+ * Copyright (C) 2024 youfa <vsyfar@gmail.com>
+ *
+ * Distributed under terms of the GPLv2 license.
+ */
+
+#ifndef MESSAGE_RECORDER_H
+#define MESSAGE_RECORDER_H
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "base/constructor_magic.h"
+#include "base/errors.h"
+
+#include "handler.h"
+#include "message_key.h"
+
+namespace ave {
+namespace media {
+
+class Message;
+
+// Writes the messages delivered to the handlers it observes to a compact
+// binary log, for MessageReplayer:
+//   auto recorder = std::make_shared<MessageRecorder>();
+//   recorder->open("/data/decoder.msglog");
+//   decoder_handler->setObserver(recorder);
+//
+// Per message the log keeps the delivery time, what and the items: numbers,
+// rects and strings by value, sub-messages recursively and buffers by size
+// only. Pointers, reply tokens, objects and typed payloads mean nothing in
+// another process and are left out. Item names are written once per log,
+// numbers as varints, so a typical message takes a few dozen bytes.
+class MessageRecorder : public MessageObserver {
+ public:
+  MessageRecorder();
+  ~MessageRecorder() override;
+
+  // Creates, or truncates, the log at |path|.
+  status_t open(const std::string& path);
+  // Flushes and closes the log, records arriving later are dropped.
+  status_t close();
+
+  // messages recorded so far
+  size_t count() const;
+
+  void onMessageDelivered(const Handler& handler,
+                          const Message& message,
+                          int64_t now_us) override;
+
+ private:
+  void encodeMessage(const Message& message);
+  void encodeKey(const char* name);
+
+  mutable std::mutex mutex_;
+  FILE* file_;
+  size_t count_;
+  int64_t last_us_;
+  // interned item name to its index in the log's name table
+  std::unordered_map<const char*, uint32_t> keys_;
+  // one record, reused
+  std::vector<uint8_t> scratch_;
+
+  AVE_DISALLOW_COPY_AND_ASSIGN(MessageRecorder);
+};
+
+// Reads a log written by MessageRecorder, and replays it against a handler.
+class MessageReplayer {
+ public:
+  enum class Timing {
+    // post every message right away
+    kFullSpeed,
+    // keep the gaps between the recorded delivery times, on the clock of
+    // the handler's looper
+    kOriginal,
+  };
+
+  MessageReplayer();
+  virtual ~MessageReplayer();
+
+  status_t open(const std::string& path);
+
+  // Reads the next message, without handler, and its recorded delivery
+  // time. ERROR_END_OF_STREAM after the last one, ERROR_MALFORMED if the
+  // log is cut short or corrupt.
+  status_t next(std::shared_ptr<Message>& message, int64_t* when_us);
+
+  // Posts the rest of the log to |handler| and returns once everything is
+  // posted, i.e. with kOriginal while the messages are still pending as
+  // delayed messages on the looper.
+  status_t replay(const std::shared_ptr<Handler>& handler, Timing timing);
+
+ private:
+  status_t decodeMessage(std::shared_ptr<Message>& message, int depth);
+  bool readVarint(uint64_t* value);
+  bool readBytes(void* data, size_t size);
+  bool readKey(MessageKey* key);
+
+  FILE* file_;
+  int64_t last_us_;
+  // the log's name table
+  std::vector<MessageKey> keys_;
+
+  AVE_DISALLOW_COPY_AND_ASSIGN(MessageReplayer);
+};
+
+}  // namespace media
+}  // namespace ave
+
+#endif /* !MESSAGE_RECORDER_H */
@@ -0,0 +1,92 @@
+/*
+ * mpsc_queue.h
+ * Copyright (C) 2024 youfa <vsyfar@gmail.com>
+ *
+ * Distributed under terms of the GPLv2 license.
+ */
+
+#ifndef MPSC_QUEUE_H
+#define MPSC_QUEUE_H
+
+#include <atomic>
+#include <utility>
+
+#include "base/constructor_magic.h"
+
+#include "free_list.h"
+
+namespace ave {
+namespace media {
+
+// Unbounded lock-free multi-producer/single-consumer FIFO (Vyukov style).
+// Push() may be called from any thread, Pop() and Empty() only from the
+// single consumer thread. Nodes are recycled through FreeList.
+template <typename T>
+class MpscQueue {
+ public:
+  MpscQueue() : head_(&stub_), tail_(&stub_) {}
+
+  ~MpscQueue() {
+    T value;
+    while (Pop(value)) {
+    }
+    if (tail_ != &stub_) {
+      delete tail_;
+    }
+  }
+
+  void Push(T value) {
+    Node* node = FreeList<Node>::Get();
+    if (node != nullptr) {
+      node->next.store(nullptr, std::memory_order_relaxed);
+      node->value = std::move(value);
+    } else {
+      node = new Node(std::move(value));
+    }
+    Node* prev = head_.exchange(node, std::memory_order_acq_rel);
+    // seq_cst pairs with the consumer's parked check, see
+    // Looper::waitForEvent().
+    prev->next.store(node, std::memory_order_seq_cst);
+  }
+
+  // Returns false if the queue is empty, or if a producer is in the middle
+  // of linking its node; the caller will be woken again in that case.
+  bool Pop(T& value) {
+    Node* tail = tail_;
+    Node* next = tail->next.load(std::memory_order_acquire);
+    if (next == nullptr) {
+      return false;
+    }
+    value = std::move(next->value);
+    // |next| becomes the new stub, its value has been moved out.
+    tail_ = next;
+    if (tail != &stub_) {
+      FreeList<Node>::Put(tail);
+    }
+    return true;
+  }
+
+  bool Empty() const {
+    return tail_->next.load(std::memory_order_seq_cst) == nullptr;
+  }
+
+ private:
+  struct Node {
+    Node() : next(nullptr) {}
+    explicit Node(T v) : next(nullptr), value(std::move(v)) {}
+    std::atomic<Node*> next;
+    T value;
+  };
+
+  Node stub_;
+  std::atomic<Node*> head_;
+  // only touched by the consumer
+  Node* tail_;
+
+  AVE_DISALLOW_COPY_AND_ASSIGN(MpscQueue);
+};
+
+}  // namespace media
+}  // namespace ave
+
+#endif /* !MPSC_QUEUE_H */
@@ -0,0 +1,192 @@
+/*
+ * poller.cc
+ * Copyright (C) 2024 youfa <vsyfar@gmail.com>
+ *
+ * Distributed under terms of the GPLv2 license.
+ */
+
+#include "poller.h"
+
+#include <limits>
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <cerrno>
+#endif
+
+namespace ave {
+namespace media {
+
+#if defined(__linux__)
+
+namespace {
+
+const int kMaxEventsPerWait = 32;
+
+uint32_t ToEpoll(uint32_t events) {
+  uint32_t epoll_events = 0;
+  if (events & kFdInput) {
+    epoll_events |= EPOLLIN;
+  }
+  if (events & kFdOutput) {
+    epoll_events |= EPOLLOUT;
+  }
+  // EPOLLERR and EPOLLHUP are always reported
+  return epoll_events;
+}
+
+uint32_t FromEpoll(uint32_t epoll_events) {
+  uint32_t events = 0;
+  if (epoll_events & (EPOLLIN | EPOLLPRI)) {
+    events |= kFdInput;
+  }
+  if (epoll_events & EPOLLOUT) {
+    events |= kFdOutput;
+  }
+  if (epoll_events & EPOLLERR) {
+    events |= kFdError;
+  }
+  if (epoll_events & (EPOLLHUP | EPOLLRDHUP)) {
+    events |= kFdHangup;
+  }
+  return events;
+}
+
+void Drain(int fd) {
+  uint64_t count = 0;
+  while (read(fd, &count, sizeof(count)) < 0 && errno == EINTR) {
+  }
+}
+
+}  // namespace
+
+Poller::Poller()
+    : epoll_fd_(epoll_create1(EPOLL_CLOEXEC)),
+      event_fd_(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)),
+      timer_fd_(timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK)),
+      timer_deadline_us_(std::numeric_limits<int64_t>::max()) {
+  if (initCheck() == OK) {
+    add(event_fd_, kFdInput);
+    add(timer_fd_, kFdInput);
+  }
+}
+
+Poller::~Poller() {
+  for (int fd : {epoll_fd_, event_fd_, timer_fd_}) {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+}
+
+status_t Poller::initCheck() const {
+  return (epoll_fd_ >= 0 && event_fd_ >= 0 && timer_fd_ >= 0) ? OK : NO_INIT;
+}
+
+status_t Poller::add(int fd, uint32_t events) {
+  struct epoll_event event = {};
+  event.events = ToEpoll(events);
+  event.data.fd = fd;
+  return epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) == 0 ? OK
+                                                              : BAD_VALUE;
+}
+
+status_t Poller::modify(int fd, uint32_t events) {
+  struct epoll_event event = {};
+  event.events = ToEpoll(events);
+  event.data.fd = fd;
+  return epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &event) == 0 ? OK
+                                                              : BAD_VALUE;
+}
+
+status_t Poller::remove(int fd) {
+  return epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr) == 0
+             ? OK
+             : NAME_NOT_FOUND;
+}
+
+status_t Poller::wait(int64_t deadline_us, std::vector<Ready>& ready) {
+  armTimer(deadline_us);
+
+  struct epoll_event events[kMaxEventsPerWait];
+  int count = epoll_wait(epoll_fd_, events, kMaxEventsPerWait, -1);
+  if (count < 0) {
+    return errno == EINTR ? OK : UNKNOWN_ERROR;
+  }
+  for (int i = 0; i < count; i++) {
+    int fd = events[i].data.fd;
+    if (fd == event_fd_) {
+      Drain(event_fd_);
+    } else if (fd == timer_fd_) {
+      Drain(timer_fd_);
+      timer_deadline_us_ = std::numeric_limits<int64_t>::max();
+    } else {
+      ready.push_back(Ready{fd, FromEpoll(events[i].events)});
+    }
+  }
+  return OK;
+}
+
+void Poller::wake() {
+  uint64_t one = 1;
+  while (write(event_fd_, &one, sizeof(one)) < 0 && errno == EINTR) {
+  }
+}
+
+// only re-armed when the deadline changes, most waits cost no syscall here
+void Poller::armTimer(int64_t deadline_us) {
+  if (deadline_us == timer_deadline_us_) {
+    return;
+  }
+  struct itimerspec spec = {};
+  if (deadline_us != std::numeric_limits<int64_t>::max()) {
+    // 0 would disarm the timer, a deadline in the past fires at once
+    int64_t us = deadline_us > 0 ? deadline_us : 1;
+    spec.it_value.tv_sec = us / 1000000;
+    spec.it_value.tv_nsec = (us % 1000000) * 1000;
+  }
+  timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &spec, nullptr);
+  timer_deadline_us_ = deadline_us;
+}
+
+#else
+
+Poller::Poller()
+    : epoll_fd_(-1), event_fd_(-1), timer_fd_(-1),
+      timer_deadline_us_(std::numeric_limits<int64_t>::max()) {}
+
+Poller::~Poller() = default;
+
+status_t Poller::initCheck() const {
+  return INVALID_OPERATION;
+}
+
+status_t Poller::add(int /* fd */, uint32_t /* events */) {
+  return INVALID_OPERATION;
+}
+
+status_t Poller::modify(int /* fd */, uint32_t /* events */) {
+  return INVALID_OPERATION;
+}
+
+status_t Poller::remove(int /* fd */) {
+  return INVALID_OPERATION;
+}
+
+status_t Poller::wait(int64_t /* deadline_us */,
+                      std::vector<Ready>& /* ready */) {
+  return INVALID_OPERATION;
+}
+
+void Poller::wake() {}
+
+void Poller::armTimer(int64_t /* deadline_us */) {}
+
+#endif
+
+}  // namespace media
+}  // namespace ave
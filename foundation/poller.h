@@ -0,0 +1,71 @@
+/*
+ * poller.h
+ * Copyright (C) 2024 youfa <vsyfar@gmail.com>
+ *
+ * Distributed under terms of the GPLv2 license.
+ */
+
+#ifndef POLLER_H
+#define POLLER_H
+
+#include <cstdint>
+#include <vector>
+
+#include "base/constructor_magic.h"
+#include "base/errors.h"
+
+namespace ave {
+namespace media {
+
+// fd readiness, as registered with Looper::addFd() and reported in the
+// "events" item of its messages
+enum FdEvents : uint32_t {
+  kFdInput = 1 << 0,
+  kFdOutput = 1 << 1,
+  kFdError = 1 << 2,
+  kFdHangup = 1 << 3,
+};
+
+// An epoll set plus an eventfd for wakeups and a timerfd for deadlines on
+// CLOCK_MONOTONIC, the time base of SteadyClock. Fds are level triggered.
+// Linux only, elsewhere initCheck() fails.
+class Poller {
+ public:
+  struct Ready {
+    int fd;
+    uint32_t events;
+  };
+
+  Poller();
+  virtual ~Poller();
+
+  status_t initCheck() const;
+
+  status_t add(int fd, uint32_t events);
+  status_t modify(int fd, uint32_t events);
+  status_t remove(int fd);
+
+  // Blocks until a registered fd is ready, wake() is called, or
+  // |deadline_us| on CLOCK_MONOTONIC is reached, INT64_MAX for none. Ready
+  // fds are appended to |ready|.
+  status_t wait(int64_t deadline_us, std::vector<Ready>& ready);
+
+  // Any thread. Makes the current or next wait() return.
+  void wake();
+
+ private:
+  void armTimer(int64_t deadline_us);
+
+  int epoll_fd_;
+  int event_fd_;
+  int timer_fd_;
+  // deadline the timerfd is armed for, INT64_MAX if disarmed
+  int64_t timer_deadline_us_;
+
+  AVE_DISALLOW_COPY_AND_ASSIGN(Poller);
+};
+
+}  // namespace media
+}  // namespace ave
+
+#endif /* !POLLER_H */
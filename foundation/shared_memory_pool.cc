@@ -0,0 +1,369 @@
+/*
+ * shared_memory_pool.cc
+ * Copyright (C) 2024 youfa <vsyfar@gmail.com>
+ *
+ * Distributed under terms of the GPLv2 license.
+ */
+
+#include "shared_memory_pool.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <limits>
+#include <new>
+#include <random>
+
+#include "base/logging.h"
+
+#include "media_errors.h"
+
+namespace ave {
+namespace media {
+
+namespace {
+const uint32_t kMagic = 0x4d485341;  // "ASHM"
+const uint32_t kVersion = 1;
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free,
+              "reference counts are shared between processes");
+
+size_t PageSize() {
+  static const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  return page_size;
+}
+
+size_t RoundUp(size_t value, size_t alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+struct Header {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t id;
+  uint64_t slot_size;
+  uint64_t slot_count;
+  uint64_t slots_offset;
+  // followed by slot_count std::atomic<uint32_t> reference counts, and the
+  // slots at slots_offset
+};
+
+// Offset of the first slot, or 0 if the geometry does not fit.
+size_t SlotsOffset(size_t slot_count) {
+  if (slot_count == 0 || slot_count > std::numeric_limits<uint32_t>::max()) {
+    return 0;
+  }
+  return RoundUp(sizeof(Header) + slot_count * sizeof(std::atomic<uint32_t>),
+                 PageSize());
+}
+
+// Size of the whole pool, or 0 if it does not fit.
+size_t PoolSize(size_t slot_size, size_t slot_count) {
+  size_t slots_offset = SlotsOffset(slot_count);
+  if (slots_offset == 0 || slot_size == 0 ||
+      slot_size > std::numeric_limits<uint32_t>::max() ||
+      slot_size % PageSize() != 0 ||
+      slot_count > (std::numeric_limits<size_t>::max() - slots_offset) /
+                       slot_size) {
+    return 0;
+  }
+  return slots_offset + slot_size * slot_count;
+}
+}  // namespace
+
+// static
+std::shared_ptr<SharedMemoryPool> SharedMemoryPool::Create(size_t slot_size,
+                                                           size_t slot_count) {
+#if defined(__linux__)
+  slot_size = RoundUp(slot_size, PageSize());
+  size_t size = PoolSize(slot_size, slot_count);
+  if (size == 0) {
+    return nullptr;
+  }
+  size_t slots_offset = SlotsOffset(slot_count);
+
+  int fd = memfd_create("ave-shared-memory-pool",
+                        MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd < 0) {
+    AVE_LOG(LS_WARNING) << "memfd_create failed: " << strerror(errno);
+    return nullptr;
+  }
+  if (ftruncate(fd, static_cast<off_t>(size)) != 0 ||
+      fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != 0) {
+    AVE_LOG(LS_WARNING) << "sizing the pool failed: " << strerror(errno);
+    close(fd);
+    return nullptr;
+  }
+  void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED) {
+    AVE_LOG(LS_WARNING) << "mmap failed: " << strerror(errno);
+    close(fd);
+    return nullptr;
+  }
+
+  // a fresh memfd reads as zeros, so every slot starts free
+  std::random_device random;
+  uint64_t id = (static_cast<uint64_t>(random()) << 32) | random();
+  auto* header = new (base)
+      Header{kMagic, kVersion, id, slot_size, slot_count, slots_offset};
+  for (size_t i = 0; i < slot_count; i++) {
+    new (reinterpret_cast<std::atomic<uint32_t>*>(header + 1) + i)
+        std::atomic<uint32_t>(0);
+  }
+  return std::shared_ptr<SharedMemoryPool>(
+      new SharedMemoryPool(fd, static_cast<uint8_t*>(base), size, id,
+                           slot_size, slot_count, slots_offset));
+#else
+  return nullptr;
+#endif
+}
+
+// static
+std::shared_ptr<SharedMemoryPool> SharedMemoryPool::Attach(int fd) {
+#if defined(__linux__)
+  // without the seals the peer could truncate the memfd under us
+  int seals = fcntl(fd, F_GET_SEALS);
+  if (seals < 0 || (seals & F_SEAL_SHRINK) == 0) {
+    AVE_LOG(LS_WARNING) << "not a sealed shared memory pool";
+    return nullptr;
+  }
+  struct stat st = {};
+  if (fstat(fd, &st) != 0 ||
+      static_cast<size_t>(st.st_size) < sizeof(Header)) {
+    return nullptr;
+  }
+  auto size = static_cast<size_t>(st.st_size);
+  void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED) {
+    AVE_LOG(LS_WARNING) << "mmap failed: " << strerror(errno);
+    return nullptr;
+  }
+
+  // copied once, the peer may write to the header meanwhile
+  Header header;
+  memcpy(&header, base, sizeof(header));
+  if (header.magic != kMagic || header.version != kVersion ||
+      header.slot_count > std::numeric_limits<size_t>::max() ||
+      header.slot_size > std::numeric_limits<size_t>::max() ||
+      PoolSize(header.slot_size, header.slot_count) != size ||
+      header.slots_offset != SlotsOffset(header.slot_count)) {
+    AVE_LOG(LS_WARNING) << "not a shared memory pool";
+    munmap(base, size);
+    return nullptr;
+  }
+  int own_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+  if (own_fd < 0) {
+    munmap(base, size);
+    return nullptr;
+  }
+  return std::shared_ptr<SharedMemoryPool>(new SharedMemoryPool(
+      own_fd, static_cast<uint8_t*>(base), size, header.id, header.slot_size,
+      header.slot_count, header.slots_offset));
+#else
+  (void)fd;
+  return nullptr;
+#endif
+}
+
+SharedMemoryPool::SharedMemoryPool(int fd,
+                                   uint8_t* base,
+                                   size_t mapped_size,
+                                   uint64_t id,
+                                   size_t slot_size,
+                                   size_t slot_count,
+                                   size_t slots_offset)
+    : fd_(fd),
+      base_(base),
+      mapped_size_(mapped_size),
+      id_(id),
+      slot_size_(slot_size),
+      slot_count_(slot_count),
+      slots_(base + slots_offset),
+      next_slot_(0) {}
+
+SharedMemoryPool::~SharedMemoryPool() {
+  munmap(base_, mapped_size_);
+  close(fd_);
+}
+
+status_t SharedMemoryPool::sendTo(int socket) const {
+#if defined(__linux__)
+  char byte = 'M';
+  struct iovec iov = {&byte, 1};
+  union {
+    struct cmsghdr header;
+    char data[CMSG_SPACE(sizeof(int))];
+  } control = {};
+  struct msghdr message = {};
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+  message.msg_control = control.data;
+  message.msg_controllen = sizeof(control.data);
+  struct cmsghdr* cmsg = CMSG_FIRSTHDR(&message);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &fd_, sizeof(int));
+
+  ssize_t sent;
+  do {
+    sent = sendmsg(socket, &message, MSG_NOSIGNAL);
+  } while (sent < 0 && errno == EINTR);
+  if (sent != 1) {
+    return ERROR_IO;
+  }
+  return OK;
+#else
+  (void)socket;
+  return INVALID_OPERATION;
+#endif
+}
+
+// static
+std::shared_ptr<SharedMemoryPool> SharedMemoryPool::ReceiveFrom(int socket) {
+#if defined(__linux__)
+  char byte = 0;
+  struct iovec iov = {&byte, 1};
+  union {
+    struct cmsghdr header;
+    char data[CMSG_SPACE(sizeof(int))];
+  } control = {};
+  struct msghdr message = {};
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+  message.msg_control = control.data;
+  message.msg_controllen = sizeof(control.data);
+
+  ssize_t received;
+  do {
+    received = recvmsg(socket, &message, MSG_CMSG_CLOEXEC);
+  } while (received < 0 && errno == EINTR);
+  struct cmsghdr* cmsg = CMSG_FIRSTHDR(&message);
+  if (received != 1 || cmsg == nullptr || cmsg->cmsg_level != SOL_SOCKET ||
+      cmsg->cmsg_type != SCM_RIGHTS ||
+      cmsg->cmsg_len != CMSG_LEN(sizeof(int))) {
+    return nullptr;
+  }
+  int fd = -1;
+  memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+  auto pool = Attach(fd);
+  close(fd);
+  return pool;
+#else
+  (void)socket;
+  return nullptr;
+#endif
+}
+
+std::atomic<uint32_t>& SharedMemoryPool::refs(uint32_t slot) const {
+  return reinterpret_cast<std::atomic<uint32_t>*>(base_ + sizeof(Header))[slot];
+}
+
+uint8_t* SharedMemoryPool::slotData(uint32_t slot) const {
+  return slots_ + slot * slot_size_;
+}
+
+bool SharedMemoryPool::locate(const uint8_t* data,
+                              uint32_t* slot,
+                              uint32_t* offset) const {
+  if (data < slots_ || data >= slots_ + slot_size_ * slot_count_) {
+    return false;
+  }
+  auto position = static_cast<size_t>(data - slots_);
+  *slot = static_cast<uint32_t>(position / slot_size_);
+  *offset = static_cast<uint32_t>(position % slot_size_);
+  return true;
+}
+
+std::shared_ptr<Buffer> SharedMemoryPool::acquire(size_t size) {
+  if (size > slot_size_) {
+    return nullptr;
+  }
+  auto start = next_slot_.load(std::memory_order_relaxed);
+  for (size_t i = 0; i < slot_count_; i++) {
+    auto slot = static_cast<uint32_t>((start + i) % slot_count_);
+    uint32_t expected = 0;
+    // acquire pairs with the release of the last owner, in any process
+    if (refs(slot).compare_exchange_strong(expected, 1,
+                                           std::memory_order_acquire,
+                                           std::memory_order_relaxed)) {
+      next_slot_.store(static_cast<uint32_t>((slot + 1) % slot_count_),
+                       std::memory_order_relaxed);
+      return wrap(slot, 0, size);
+    }
+  }
+  return nullptr;
+}
+
+status_t SharedMemoryPool::exportBuffer(const std::shared_ptr<Buffer>& buffer,
+                                        SharedBufferHandle* handle) {
+  uint32_t slot = 0;
+  uint32_t offset = 0;
+  // an empty range may point past its slot
+  if (buffer == nullptr || buffer->size() == 0 ||
+      !locate(buffer->data(), &slot, &offset) ||
+      buffer->size() > slot_size_ - offset) {
+    return BAD_VALUE;
+  }
+  // |buffer| holds a reference, so the slot cannot be freed meanwhile
+  refs(slot).fetch_add(1, std::memory_order_relaxed);
+  handle->pool_id = id_;
+  handle->slot = slot;
+  handle->offset = offset;
+  handle->size = static_cast<uint32_t>(buffer->size());
+  return OK;
+}
+
+std::shared_ptr<Buffer> SharedMemoryPool::importBuffer(
+    const SharedBufferHandle& handle) {
+  if (handle.pool_id != id_ || handle.slot >= slot_count_ ||
+      handle.offset > slot_size_ || handle.size > slot_size_ - handle.offset) {
+    AVE_LOG(LS_WARNING) << "handle of another pool";
+    return nullptr;
+  }
+  // the producer's writes happened before the handle was sent
+  if (refs(handle.slot).load(std::memory_order_acquire) == 0) {
+    AVE_LOG(LS_WARNING) << "handle of a free slot";
+    return nullptr;
+  }
+  return wrap(handle.slot, handle.offset, handle.size);
+}
+
+size_t SharedMemoryPool::freeSlots() const {
+  size_t count = 0;
+  for (size_t i = 0; i < slot_count_; i++) {
+    if (refs(static_cast<uint32_t>(i)).load(std::memory_order_relaxed) == 0) {
+      count++;
+    }
+  }
+  return count;
+}
+
+std::shared_ptr<Buffer> SharedMemoryPool::wrap(uint32_t slot,
+                                               uint32_t offset,
+                                               size_t size) {
+  auto self = shared_from_this();
+  return std::shared_ptr<Buffer>(new Buffer(slotData(slot) + offset, size),
+                                 [self, slot](Buffer* buffer) {
+                                   delete buffer;
+                                   self->release(slot);
+                                 });
+}
+
+void SharedMemoryPool::release(uint32_t slot) {
+  // publishes this owner's writes to the next one
+  if (refs(slot).fetch_sub(1, std::memory_order_acq_rel) == 0) {
+    // a peer released more than it held
+    AVE_LOG(LS_WARNING) << "reference count of slot " << slot
+                        << " went below 0";
+  }
+}
+
+}  // namespace media
+}  // namespace ave
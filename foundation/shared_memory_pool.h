@@ -0,0 +1,132 @@
+/*
+ * shared_memory_pool.h
+ * Copyright (C) 2024 youfa <vsyfar@gmail.com>
+ *
+ * Distributed under terms of the GPLv2 license.
+ */
+
+#ifndef SHARED_MEMORY_POOL_H
+#define SHARED_MEMORY_POOL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "base/constructor_magic.h"
+#include "base/errors.h"
+
+#include "buffer.h"
+
+namespace ave {
+namespace media {
+
+// Names a range of a SharedMemoryPool buffer, small enough to go through
+// any channel, a socket or a Message alike.
+struct SharedBufferHandle {
+  uint64_t pool_id;
+  uint32_t slot;
+  uint32_t offset;
+  uint32_t size;
+};
+
+// Buffers in a memfd shared between processes, so a MediaPacket or
+// MediaFrame moves from a demuxer process to a decoder process by
+// reference. The producer:
+//   auto pool = SharedMemoryPool::Create(1024 * 1024, 32);
+//   pool->sendTo(socket);
+//   auto buffer = pool->acquire(size);
+//   ... fill buffer ...
+//   SharedBufferHandle handle;
+//   pool->exportBuffer(buffer, &handle);
+//   ... send handle ...
+// and the consumer:
+//   auto pool = SharedMemoryPool::ReceiveFrom(socket);
+//   ... receive handle ...
+//   auto packet = MediaPacket::CreateWithBuffer(pool->importBuffer(handle));
+//
+// The pool is split in |slot_count| slots of |slot_size| bytes, page
+// aligned. Every slot has a reference count in the shared memory, counting
+// the Buffers of it in all processes plus the handles in flight:
+// exportBuffer() adds a reference for the handle and importBuffer() hands
+// it to the Buffer it returns. A slot is free again once the count drops to
+// 0, in any process. A handle that is never imported leaks its slot, and
+// so does a process that dies holding one.
+//
+// The memfd is sealed against resizing, so a peer cannot make the other
+// side fault by truncating it. Linux only, Create() and ReceiveFrom()
+// return nullptr elsewhere.
+class SharedMemoryPool
+    : public std::enable_shared_from_this<SharedMemoryPool> {
+ public:
+  static std::shared_ptr<SharedMemoryPool> Create(size_t slot_size,
+                                                  size_t slot_count);
+  // Maps the pool in |fd|, which the caller still owns, nullptr if it is
+  // not one.
+  static std::shared_ptr<SharedMemoryPool> Attach(int fd);
+
+  ~SharedMemoryPool();
+
+  // Passes the memfd over the unix domain |socket|, with SCM_RIGHTS.
+  status_t sendTo(int socket) const;
+  // Receives a memfd sent by sendTo() and attaches it.
+  static std::shared_ptr<SharedMemoryPool> ReceiveFrom(int socket);
+
+  size_t slotSize() const { return slot_size_; }
+  size_t slotCount() const { return slot_count_; }
+  uint64_t id() const { return id_; }
+
+  // A buffer of |size| bytes in a free slot, nullptr if none is free or
+  // |size| is larger than a slot. The contents are undefined.
+  std::shared_ptr<Buffer> acquire(size_t size);
+
+  // Describes the current range of |buffer|, which must come from this
+  // pool, from acquire() or importBuffer() or a Buffer::Slice() of one.
+  // The slot stays in use until the handle is imported and released.
+  status_t exportBuffer(const std::shared_ptr<Buffer>& buffer,
+                        SharedBufferHandle* handle);
+
+  // Takes over the reference of a handle from exportBuffer(), once.
+  // nullptr if the handle does not belong to this pool.
+  std::shared_ptr<Buffer> importBuffer(const SharedBufferHandle& handle);
+
+  // slots with a reference count of 0
+  size_t freeSlots() const;
+
+ private:
+  SharedMemoryPool(int fd,
+                   uint8_t* base,
+                   size_t mapped_size,
+                   uint64_t id,
+                   size_t slot_size,
+                   size_t slot_count,
+                   size_t slots_offset);
+
+  std::atomic<uint32_t>& refs(uint32_t slot) const;
+  uint8_t* slotData(uint32_t slot) const;
+  // slot and offset of |data|, false if it is outside the slots
+  bool locate(const uint8_t* data, uint32_t* slot, uint32_t* offset) const;
+  // A Buffer over |size| bytes at |offset| of |slot|, owning one of its
+  // references.
+  std::shared_ptr<Buffer> wrap(uint32_t slot, uint32_t offset, size_t size);
+  void release(uint32_t slot);
+
+  const int fd_;
+  uint8_t* const base_;
+  const size_t mapped_size_;
+  // the geometry as checked by Attach(), never read back from the shared
+  // header a peer can write to
+  const uint64_t id_;
+  const size_t slot_size_;
+  const size_t slot_count_;
+  uint8_t* const slots_;
+  // where acquire() starts looking for a free slot
+  std::atomic<uint32_t> next_slot_;
+
+  AVE_DISALLOW_COPY_AND_ASSIGN(SharedMemoryPool);
+};
+
+}  // namespace media
+}  // namespace ave
+
+#endif /* !SHARED_MEMORY_POOL_H */
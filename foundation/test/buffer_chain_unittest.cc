@@ -0,0 +1,118 @@
+/*
+ * buffer_chain_unittest.cc
+ * Copyright (C) 2024 youfa <vsyfar@gmail.com>
+ *
+ * Distributed under terms of the GPLv2 license.
+ */
+
+#include "../buffer_chain.h"
+
+#include <sys/uio.h>
+
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "test/gtest.h"
+
+namespace ave {
+namespace media {
+
+namespace {
+std::shared_ptr<Buffer> MakeBuffer(std::vector<uint8_t> bytes) {
+  return Buffer::CreateAsCopy(bytes.data(), bytes.size());
+}
+}  // namespace
+
+TEST(BufferChainTest, AppendAndCopy) {
+  auto first = MakeBuffer({0, 1, 2, 3, 4});
+  first->setRange(1, 3);
+  BufferChain chain;
+  chain.append(first);
+  chain.append(MakeBuffer({}));
+  chain.append(MakeBuffer({4, 5}));
+  EXPECT_EQ(5u, chain.size());
+  EXPECT_EQ(2u, chain.count());
+  // no copy
+  EXPECT_EQ(first->data(), chain.fragmentData(0));
+
+  // the fragment keeps the range it had
+  first->setRange(0, 5);
+  EXPECT_EQ(3u, chain.fragmentSize(0));
+
+  uint8_t out[8] = {};
+  EXPECT_EQ(5u, chain.copyTo(0, out, sizeof(out)));
+  EXPECT_EQ(0, memcmp(out, "\x01\x02\x03\x04\x05", 5));
+  EXPECT_EQ(3u, chain.copyTo(2, out, 3));
+  EXPECT_EQ(0, memcmp(out, "\x03\x04\x05", 3));
+  EXPECT_EQ(0u, chain.copyTo(5, out, 3));
+
+  struct iovec iov[4];
+  ASSERT_EQ(2u, chain.toIovec(iov, 4));
+  EXPECT_EQ(first->data() + 1, iov[0].iov_base);
+  EXPECT_EQ(3u, iov[0].iov_len);
+  EXPECT_EQ(2u, iov[1].iov_len);
+  EXPECT_EQ(1u, chain.toIovec(iov, 1));
+
+  BufferChain other;
+  other.append(chain);
+  other.append(MakeBuffer({6}));
+  EXPECT_EQ(6u, other.size());
+  EXPECT_EQ(3u, other.count());
+  EXPECT_EQ(5u, chain.size());
+
+  BufferChain moved(std::move(other));
+  EXPECT_EQ(6u, moved.size());
+  EXPECT_TRUE(other.empty());
+}
+
+TEST(BufferChainTest, Linearize) {
+  BufferChain chain;
+  EXPECT_EQ(nullptr, chain.linearize());
+
+  auto single = MakeBuffer({1, 2, 3});
+  chain.append(single);
+  EXPECT_EQ(single, chain.linearize());
+
+  chain.append(MakeBuffer({4, 5}));
+  auto pool = BufferPool::Create();
+  auto flat = chain.linearize(pool);
+  ASSERT_NE(nullptr, flat);
+  EXPECT_EQ(5u, flat->size());
+  EXPECT_EQ(0, memcmp(flat->data(), "\x01\x02\x03\x04\x05", 5));
+  EXPECT_EQ(1u, chain.count());
+  EXPECT_EQ(flat, chain.linearize());
+  EXPECT_EQ(1u, pool->stats().misses);
+}
+
+TEST(BufferChainTest, BitReaderAcrossFragments) {
+  BufferChain chain;
+  chain.append(MakeBuffer({0xab}));
+  chain.append(MakeBuffer({0xcd, 0xef}));
+  chain.append(MakeBuffer({0x12, 0x34, 0x56, 0x78, 0x9a}));
+
+  BufferChainBitReader reader(chain);
+  EXPECT_EQ(64u, reader.numBitsLeft());
+  EXPECT_EQ(0xau, reader.getBits(4));
+  EXPECT_EQ(0xbcdu, reader.getBits(12));
+  EXPECT_EQ(48u, reader.numBitsLeft());
+  reader.putBits(0xd, 4);
+  EXPECT_EQ(0xdef1u, reader.getBits(16));
+  EXPECT_TRUE(reader.skipBits(12));
+  EXPECT_EQ(0x5678u, reader.getBits(16));
+  EXPECT_EQ(8u, reader.numBitsLeft());
+  EXPECT_EQ(0x9au, reader.getBits(8));
+  EXPECT_EQ(0u, reader.numBitsLeft());
+
+  uint32_t value = 0;
+  EXPECT_FALSE(reader.getBitsGraceful(1, &value));
+  EXPECT_TRUE(reader.overRead());
+
+  BufferChain empty;
+  BufferChainBitReader empty_reader(empty);
+  EXPECT_EQ(0u, empty_reader.numBitsLeft());
+  EXPECT_FALSE(empty_reader.getBitsGraceful(1, &value));
+}
+
+}  // namespace media
+}  // namespace ave
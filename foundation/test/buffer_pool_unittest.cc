@@ -0,0 +1,122 @@
+/*
+ * buffer_pool_unittest.cc
+ * Copyright (C) 2024 youfa <vsyfar@gmail.com>
+ *
+ * Distributed under terms of the GPLv2 license.
+ */
+
+#include "../buffer_pool.h"
+
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "test/gtest.h"
+
+namespace ave {
+namespace media {
+
+TEST(BufferPoolTest, SizeClasses) {
+  EXPECT_EQ(BufferPool::kMinClassSize, BufferPool::ClassSize(1));
+  EXPECT_EQ(BufferPool::kMinClassSize,
+            BufferPool::ClassSize(BufferPool::kMinClassSize));
+  EXPECT_EQ(320u, BufferPool::ClassSize(257));
+  EXPECT_EQ(1024u, BufferPool::ClassSize(1000));
+  EXPECT_EQ(1280u, BufferPool::ClassSize(1025));
+  // a 4K NV12 frame
+  EXPECT_EQ(12u * 1024 * 1024, BufferPool::ClassSize(3840 * 2160 * 3 / 2));
+  EXPECT_EQ(BufferPool::kMaxClassSize,
+            BufferPool::ClassSize(BufferPool::kMaxClassSize));
+  EXPECT_EQ(0u, BufferPool::ClassSize(BufferPool::kMaxClassSize + 1));
+}
+
+TEST(BufferPoolTest, ReusesReleasedBuffers) {
+  auto pool = BufferPool::Create();
+  auto buffer = pool->acquire(1000);
+  EXPECT_EQ(1000u, buffer->size());
+  EXPECT_EQ(1024u, buffer->capacity());
+  uint8_t* base = buffer->base();
+  EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(base) % Buffer::kAlignment);
+  buffer->setRange(10, 20);
+  buffer->setInt32Data(7);
+  buffer->meta()->setInt32("key", 1);
+
+  auto copy = buffer;
+  buffer.reset();
+  EXPECT_EQ(0u, pool->stats().cached_buffers);
+  copy.reset();
+  EXPECT_EQ(1u, pool->stats().cached_buffers);
+  EXPECT_EQ(1024u, pool->stats().cached_bytes);
+
+  // same class, comes back reset
+  buffer = pool->acquire(900);
+  EXPECT_EQ(base, buffer->base());
+  EXPECT_EQ(0u, buffer->offset());
+  EXPECT_EQ(900u, buffer->size());
+  EXPECT_EQ(0, buffer->int32Data());
+  EXPECT_FALSE(buffer->meta()->contains("key"));
+
+  // another class allocates
+  auto other = pool->acquire(100);
+  EXPECT_NE(base, other->base());
+  BufferPool::Stats stats = pool->stats();
+  EXPECT_EQ(1u, stats.hits);
+  EXPECT_EQ(2u, stats.misses);
+  EXPECT_EQ(0u, stats.cached_buffers);
+}
+
+TEST(BufferPoolTest, KeepsAtMostTheLimit) {
+  auto pool = BufferPool::Create(4096);
+  std::vector<std::shared_ptr<Buffer>> buffers;
+  for (int i = 0; i < 8; i++) {
+    buffers.push_back(pool->acquire(1024));
+  }
+  buffers.clear();
+  EXPECT_EQ(4u, pool->stats().cached_buffers);
+  EXPECT_EQ(4096u, pool->stats().cached_bytes);
+
+  pool->trim();
+  EXPECT_EQ(0u, pool->stats().cached_buffers);
+  EXPECT_EQ(0u, pool->stats().cached_bytes);
+
+  // too large to pool
+  auto large = pool->acquire(BufferPool::kMaxClassSize + 1);
+  EXPECT_EQ(BufferPool::kMaxClassSize + 1, large->size());
+  large.reset();
+  EXPECT_EQ(0u, pool->stats().cached_buffers);
+}
+
+TEST(BufferPoolTest, BuffersOutliveThePool) {
+  auto pool = BufferPool::Create();
+  auto buffer = pool->acquire(1000);
+  pool.reset();
+  buffer->data()[0] = 1;
+  buffer.reset();
+}
+
+TEST(BufferPoolTest, ConcurrentAcquireAndRelease) {
+  auto pool = BufferPool::Create();
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([pool, t]() {
+      std::vector<std::shared_ptr<Buffer>> held;
+      for (int i = 0; i < 1000; i++) {
+        held.push_back(pool->acquire(256 + (i + t) % 4 * 512));
+        held.back()->data()[0] = static_cast<uint8_t>(i);
+        if (held.size() > 8) {
+          held.erase(held.begin());
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  BufferPool::Stats stats = pool->stats();
+  EXPECT_EQ(4000u, stats.hits + stats.misses);
+  EXPECT_GT(stats.hits, stats.misses);
+}
+
+}  // namespace media
+}  // namespace ave
@@ -0,0 +1,103 @@
+/*
+ * buffer_unittest.cc
+ * Copyright (C) 2024 youfa <vsyfar@gmail.com>
+ *
+ * Distributed under terms of the GPLv2 license.
+ */
+
+#include "../buffer.h"
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+#include "test/gtest.h"
+
+namespace ave {
+namespace media {
+
+namespace {
+bool IsAligned(const void* data, size_t alignment) {
+  return reinterpret_cast<uintptr_t>(data) % alignment == 0;
+}
+}  // namespace
+
+TEST(BufferTest, AlignedWithZeroedPadding) {
+  for (size_t capacity : {0, 1, 63, 64, 1000}) {
+    auto buffer = Buffer::CreateAligned(capacity, 32);
+    EXPECT_TRUE(IsAligned(buffer->base(), Buffer::kAlignment));
+    EXPECT_EQ(capacity, buffer->capacity());
+    EXPECT_EQ(capacity, buffer->size());
+    EXPECT_EQ(32u, buffer->padding());
+    for (size_t i = 0; i < 32; i++) {
+      EXPECT_EQ(0, buffer->base()[capacity + i]);
+    }
+  }
+  EXPECT_EQ(0u, Buffer(16).padding());
+}
+
+TEST(BufferTest, AlignedKeepsAlignmentWhenGrowing) {
+  auto buffer = Buffer::CreateAligned(100);
+  memset(buffer->data(), 0xab, 100);
+  buffer->ensureCapacity(5000, true);
+  EXPECT_EQ(5000u, buffer->capacity());
+  EXPECT_TRUE(IsAligned(buffer->base(), Buffer::kAlignment));
+  EXPECT_EQ(0xab, buffer->data()[99]);
+  for (size_t i = 0; i < Buffer::kDefaultPadding; i++) {
+    EXPECT_EQ(0, buffer->base()[5000 + i]);
+  }
+}
+
+TEST(BufferTest, HugePages) {
+  auto small = Buffer::CreateAligned(4096, Buffer::kDefaultPadding, true);
+  EXPECT_TRUE(IsAligned(small->base(), Buffer::kAlignment));
+
+  auto large =
+      Buffer::CreateAligned(Buffer::kHugePageSize, Buffer::kDefaultPadding,
+                            true);
+  EXPECT_TRUE(IsAligned(large->base(), Buffer::kHugePageSize));
+  large->data()[Buffer::kHugePageSize - 1] = 1;
+}
+
+TEST(BufferTest, SliceSharesMemory) {
+  std::weak_ptr<Buffer> weak_parent;
+  std::shared_ptr<Buffer> slice;
+  {
+    auto parent = std::make_shared<Buffer>(100);
+    for (size_t i = 0; i < 100; i++) {
+      parent->data()[i] = static_cast<uint8_t>(i);
+    }
+    parent->setRange(10, 80);
+    weak_parent = parent;
+
+    // relative to the parent's range
+    slice = Buffer::Slice(parent, 5, 20);
+    EXPECT_EQ(parent->data() + 5, slice->data());
+    EXPECT_EQ(20u, slice->size());
+    EXPECT_EQ(15, slice->data()[0]);
+
+    slice->data()[0] = 0xff;
+    EXPECT_EQ(0xff, parent->data()[5]);
+
+    // the slice's range is its own
+    slice->setRange(2, 4);
+    EXPECT_EQ(10u, parent->offset());
+    EXPECT_EQ(80u, parent->size());
+
+    auto empty = Buffer::Slice(parent, 80, 0);
+    EXPECT_EQ(0u, empty->size());
+  }
+  // the slice keeps the parent alive
+  EXPECT_FALSE(weak_parent.expired());
+  EXPECT_EQ(17, slice->data()[0]);
+
+  auto nested = Buffer::Slice(slice, 1, 2);
+  slice.reset();
+  EXPECT_FALSE(weak_parent.expired());
+  EXPECT_EQ(18, nested->data()[0]);
+  nested.reset();
+  EXPECT_TRUE(weak_parent.expired());
+}
+
+}  // namespace media
+}  // namespace ave
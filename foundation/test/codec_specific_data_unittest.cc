@@ -0,0 +1,143 @@
+/*
+ * codec_specific_data_unittest.cc
+ * Copyright (C) 2024 youfa <vsyfar@gmail.com>
+ *
+ * Distributed under terms of the GPLv2 license.
+ */
+
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "../avc_utils.h"
+#include "../buffer.h"
+#include "../hevc_utils.h"
+#include "test/gtest.h"
+
+namespace ave {
+namespace media {
+
+namespace {
+
+const uint8_t kStartCode[] = {0x00, 0x00, 0x00, 0x01};
+
+// 1280x720 Main profile, level 3.1, as emitted by x265.
+const uint8_t kHevcVps[] = {0x40, 0x01, 0x0c, 0x01, 0xff, 0xff, 0x01, 0x60,
+                            0x00, 0x00, 0x03, 0x00, 0x90, 0x00, 0x00, 0x03,
+                            0x00, 0x00, 0x03, 0x00, 0x5d, 0x95, 0x98, 0x09};
+const uint8_t kHevcSps[] = {0x42, 0x01, 0x01, 0x01, 0x60, 0x00, 0x00, 0x03,
+                            0x00, 0x90, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03,
+                            0x00, 0x5d, 0xa0, 0x02, 0x80, 0x80, 0x2d, 0x16,
+                            0x59, 0x59, 0xa4, 0x93, 0x2b, 0xc0, 0x5a, 0x70,
+                            0x80, 0x00, 0x01, 0xf4, 0x80, 0x00, 0x3a, 0x98,
+                            0x04};
+const uint8_t kHevcPps[] = {0x44, 0x01, 0xc1, 0x72, 0xb4, 0x62, 0x40};
+const uint8_t kHevcSlice[] = {0x26, 0x01, 0xaf};
+
+// 640x480 Baseline profile, level 3.0.
+const uint8_t kAvcSps[] = {0x67, 0x42, 0x00, 0x1e, 0x95,
+                           0xa8, 0x28, 0x0f, 0x64};
+const uint8_t kAvcPps[] = {0x68, 0xce, 0x3c, 0x80};
+const uint8_t kAvcSlice[] = {0x65, 0x88, 0x84};
+
+void Append(std::vector<uint8_t>* out, const uint8_t* data, size_t size) {
+  out->insert(out->end(), data, data + size);
+}
+
+template <size_t N>
+void AppendNal(std::vector<uint8_t>* out, const uint8_t (&nal)[N]) {
+  Append(out, kStartCode, sizeof(kStartCode));
+  Append(out, nal, N);
+}
+
+std::shared_ptr<Buffer> MakeAccessUnit(const std::vector<uint8_t>& bytes) {
+  auto buffer = std::make_shared<Buffer>(bytes.size());
+  memcpy(buffer->data(), bytes.data(), bytes.size());
+  return buffer;
+}
+
+std::vector<uint8_t> ToVector(const std::shared_ptr<Buffer>& buffer) {
+  return std::vector<uint8_t>(buffer->data(), buffer->data() + buffer->size());
+}
+
+}  // namespace
+
+TEST(CodecSpecificDataTest, HevcFromAnnexBAccessUnit) {
+  std::vector<uint8_t> bytes;
+  AppendNal(&bytes, kHevcVps);
+  AppendNal(&bytes, kHevcSps);
+  AppendNal(&bytes, kHevcPps);
+  AppendNal(&bytes, kHevcSlice);
+  auto accessUnit = MakeAccessUnit(bytes);
+
+  int32_t width = 0;
+  int32_t height = 0;
+  auto csd = MakeHEVCCodecSpecificData(accessUnit, &width, &height);
+  ASSERT_NE(csd, nullptr);
+  EXPECT_EQ(width, 1280);
+  EXPECT_EQ(height, 720);
+
+  std::vector<uint8_t> expected = {
+      0x01,                                // configurationVersion
+      0x01, 0x60, 0x00, 0x00, 0x00,        // profile, compatibility flags
+      0x90, 0x00, 0x00, 0x00, 0x00, 0x00,  // constraint flags
+      0x5d,                                // general_level_idc
+      0xf0, 0x00,                          // min_spatial_segmentation
+      0xfc, 0xfd, 0xf8, 0xf8,              // parallelism, format, depths
+      0x00, 0x00,                          // avgFrameRate
+      0x03,                                // lengthSizeMinusOne
+      0x03,                                // numOfArrays
+  };
+  expected.insert(expected.end(), {0xa0, 0x00, 0x01, 0x00, sizeof(kHevcVps)});
+  Append(&expected, kHevcVps, sizeof(kHevcVps));
+  expected.insert(expected.end(), {0xa1, 0x00, 0x01, 0x00, sizeof(kHevcSps)});
+  Append(&expected, kHevcSps, sizeof(kHevcSps));
+  expected.insert(expected.end(), {0xa2, 0x00, 0x01, 0x00, sizeof(kHevcPps)});
+  Append(&expected, kHevcPps, sizeof(kHevcPps));
+  EXPECT_EQ(ToVector(csd), expected);
+
+  // the parameter sets are written out, not kept as slices of the input
+  EXPECT_EQ(accessUnit.use_count(), 1);
+}
+
+TEST(CodecSpecificDataTest, HevcWithoutSpsFails) {
+  std::vector<uint8_t> bytes;
+  AppendNal(&bytes, kHevcVps);
+  AppendNal(&bytes, kHevcPps);
+  AppendNal(&bytes, kHevcSlice);
+
+  int32_t width = 0;
+  int32_t height = 0;
+  EXPECT_EQ(MakeHEVCCodecSpecificData(MakeAccessUnit(bytes), &width, &height),
+            nullptr);
+}
+
+TEST(CodecSpecificDataTest, AvcFromAnnexBAccessUnit) {
+  std::vector<uint8_t> bytes;
+  AppendNal(&bytes, kAvcSps);
+  AppendNal(&bytes, kAvcPps);
+  AppendNal(&bytes, kAvcSlice);
+  auto accessUnit = MakeAccessUnit(bytes);
+
+  int32_t width = 0;
+  int32_t height = 0;
+  auto csd = MakeAVCCodecSpecificData(accessUnit, &width, &height);
+  ASSERT_NE(csd, nullptr);
+  EXPECT_EQ(width, 640);
+  EXPECT_EQ(height, 480);
+
+  std::vector<uint8_t> expected = {
+      0x01,              // configurationVersion
+      0x42, 0x00, 0x1e,  // profile, compatibility, level
+      0xfd,              // lengthSizeMinusOne
+      0xe1,              // numOfSequenceParameterSets
+      0x00, sizeof(kAvcSps),
+  };
+  Append(&expected, kAvcSps, sizeof(kAvcSps));
+  expected.insert(expected.end(), {0x01, 0x00, sizeof(kAvcPps)});
+  Append(&expected, kAvcPps, sizeof(kAvcPps));
+  EXPECT_EQ(ToVector(csd), expected);
+}
+
+}  // namespace media
+}  // namespace ave
@@ -0,0 +1,64 @@
+/*
+ * dispatch_stats_unittest.cc
+ * Copyright (C) 2024 youfa <vsyfar@gmail.com>
+ *
+ * Distributed under terms of the GPLv2 license.
+ */
+
+#include "../dispatch_stats.h"
+
+#include "test/gtest.h"
+
+namespace ave {
+namespace media {
+
+TEST(LatencyHistogramTest, Buckets) {
+  LatencyHistogram histogram;
+  histogram.Record(0);
+  histogram.Record(1);
+  histogram.Record(3);
+  histogram.Record(1000);
+  histogram.Record(-5);
+
+  auto snapshot = histogram.snapshot();
+  EXPECT_EQ(5u, snapshot.count);
+  EXPECT_EQ(2u, snapshot.counts[0]);
+  EXPECT_EQ(1u, snapshot.counts[1]);
+  EXPECT_EQ(1u, snapshot.counts[2]);
+  EXPECT_EQ(1u, snapshot.counts[10]);
+  EXPECT_EQ(1000, snapshot.max_us);
+  EXPECT_EQ(1004, snapshot.sum_us);
+
+  histogram.reset();
+  EXPECT_EQ(0u, histogram.snapshot().count);
+}
+
+TEST(LatencyHistogramTest, Percentiles) {
+  LatencyHistogram histogram;
+  for (int i = 0; i < 99; i++) {
+    histogram.Record(10);
+  }
+  histogram.Record(5000);
+
+  auto snapshot = histogram.snapshot();
+  // upper bound of the [8, 16) bucket
+  EXPECT_EQ(16, snapshot.PercentileUs(0.5));
+  EXPECT_EQ(16, snapshot.PercentileUs(0.98));
+  // capped by the largest sample
+  EXPECT_EQ(5000, snapshot.PercentileUs(1.0));
+}
+
+TEST(DispatchStatsTest, MessagesPerSecond) {
+  DispatchStats stats;
+  auto earlier = stats.snapshot(1000000);
+  for (int i = 0; i < 500; i++) {
+    stats.Record(1, 1);
+  }
+  auto later = stats.snapshot(1500000);
+  EXPECT_EQ(500u, later.messages);
+  EXPECT_DOUBLE_EQ(1000.0, DispatchStats::MessagesPerSecond(earlier, later));
+  EXPECT_DOUBLE_EQ(0.0, DispatchStats::MessagesPerSecond(later, later));
+}
+
+}  // namespace media
+}  // namespace ave
@@ -0,0 +1,110 @@
+/*
+ * handler_roster_unittest.cc
+ * Copyright (C) 2024 youfa <vsyfar@gmail.com>
+ *
+ * Distributed under terms of the GPLv2 license.
+ */
+
+#include "../handler_roster.h"
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "../handler.h"
+#include "../looper.h"
+
+#include "test/gtest.h"
+
+namespace ave {
+namespace media {
+
+namespace {
+
+class NopHandler : public Handler {
+ protected:
+  void onMessageReceived(
+      const std::shared_ptr<Message>& /* message */) override {}
+};
+
+}  // namespace
+
+TEST(HandlerRosterTest, IdsAreUniqueAndIncreasing) {
+  HandlerRoster roster;
+  auto looper = std::make_shared<Looper>();
+  std::vector<std::shared_ptr<NopHandler>> handlers;
+  Looper::handler_id last = 0;
+  for (int i = 0; i < 100; i++) {
+    handlers.push_back(std::make_shared<NopHandler>());
+    Looper::handler_id id = roster.registerHandler(looper, handlers.back());
+    EXPECT_GT(id, last);
+    EXPECT_EQ(id, handlers.back()->id());
+    last = id;
+  }
+
+  // registering twice is refused
+  EXPECT_EQ(-1, roster.registerHandler(looper, handlers.front()));
+
+  for (auto& handler : handlers) {
+    EXPECT_EQ(handler, roster.findHandler(handler->id()));
+    EXPECT_EQ(looper, roster.findLooper(handler->id()));
+  }
+}
+
+TEST(HandlerRosterTest, Unregister) {
+  HandlerRoster roster;
+  auto looper = std::make_shared<Looper>();
+  auto handler = std::make_shared<NopHandler>();
+  Looper::handler_id id = roster.registerHandler(looper, handler);
+
+  roster.unregisterHandler(id);
+  EXPECT_EQ(0, handler->id());
+  EXPECT_EQ(nullptr, roster.findHandler(id));
+  // unknown ids are ignored
+  roster.unregisterHandler(id);
+
+  // an unregistered handler gets a new id
+  EXPECT_GT(roster.registerHandler(looper, handler), id);
+}
+
+TEST(HandlerRosterTest, LookupsDuringChurn) {
+  HandlerRoster roster;
+  auto looper = std::make_shared<Looper>();
+  auto stable = std::make_shared<NopHandler>();
+  Looper::handler_id stable_id = roster.registerHandler(looper, stable);
+
+  std::atomic<bool> done(false);
+  std::atomic<int32_t> misses(0);
+  std::vector<std::thread> readers;
+  for (int i = 0; i < 4; i++) {
+    readers.emplace_back([&]() {
+      while (!done.load()) {
+        if (roster.findHandler(stable_id) != stable) {
+          misses++;
+        }
+      }
+    });
+  }
+
+  std::vector<std::thread> writers;
+  for (int i = 0; i < 4; i++) {
+    writers.emplace_back([&]() {
+      for (int j = 0; j < 500; j++) {
+        auto handler = std::make_shared<NopHandler>();
+        roster.unregisterHandler(roster.registerHandler(looper, handler));
+      }
+    });
+  }
+  for (auto& writer : writers) {
+    writer.join();
+  }
+  done.store(true);
+  for (auto& reader : readers) {
+    reader.join();
+  }
+  EXPECT_EQ(0, misses.load());
+}
+
+}  // namespace media
+}  // namespace ave
@@ -0,0 +1,328 @@
+/*
+ * looper_benchmark.cc
+ * Copyright (C) 2024 youfa <vsyfar@gmail.com>
+ *
+ * Distributed under terms of the GPLv2 license.
+ */
+
+// Baseline numbers for the messaging core: post throughput with one and
+// many producers, post-to-deliver latency, delayed message accuracy,
+// postAndWaitResponse() round trips and handler fan-out.
+//
+//   looper_benchmark [scale]
+//
+// |scale|, 1 by default, multiplies the message counts. Results go to
+// stdout, one table per section, times in microseconds.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "../handler.h"
+#include "../looper.h"
+#include "../message.h"
+
+namespace ave {
+namespace media {
+namespace {
+
+const uint32_t kWhatCount = 1;
+const uint32_t kWhatStamped = 2;
+const uint32_t kWhatEcho = 3;
+const size_t kBatchSize = 32;
+
+// Counts deliveries, and the post-to-deliver latency of stamped messages.
+class SinkHandler : public Handler {
+ public:
+  void Expect(size_t count, bool record) {
+    std::lock_guard<std::mutex> l(mutex_);
+    received_.store(0, std::memory_order_relaxed);
+    expected_ = count;
+    record_ = record;
+    latencies_us_.clear();
+    latencies_us_.reserve(record ? count : 0);
+  }
+
+  std::vector<int64_t> Wait() {
+    std::unique_lock<std::mutex> l(mutex_);
+    condition_.wait(l, [this]() {
+      return received_.load(std::memory_order_acquire) >= expected_;
+    });
+    return std::move(latencies_us_);
+  }
+
+ protected:
+  void onMessageReceived(const std::shared_ptr<Message>& message) override {
+    if (record_) {
+      int64_t due_us = 0;
+      message->findInt64(AVE_MESSAGE_KEY("due"), &due_us);
+      latencies_us_.push_back(Looper::getNowUs() - due_us);
+    }
+    // release publishes latencies_us_ to Wait()
+    size_t received = received_.fetch_add(1, std::memory_order_release) + 1;
+    if (received >= expected_) {
+      std::lock_guard<std::mutex> l(mutex_);
+      condition_.notify_all();
+    }
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  std::atomic<size_t> received_{0};
+  size_t expected_ = 0;
+  bool record_ = false;
+  std::vector<int64_t> latencies_us_;
+};
+
+class EchoHandler : public Handler {
+ protected:
+  void onMessageReceived(const std::shared_ptr<Message>& message) override {
+    std::shared_ptr<ReplyToken> reply_id;
+    if (message->senderAwaitsResponse(reply_id)) {
+      Message::Obtain()->postReply(reply_id);
+    }
+  }
+};
+
+int64_t Percentile(const std::vector<int64_t>& sorted, double p) {
+  size_t index = static_cast<size_t>(p * (sorted.size() - 1));
+  return sorted[index];
+}
+
+void PrintPercentiles(const char* name, std::vector<int64_t> samples) {
+  std::sort(samples.begin(), samples.end());
+  printf("%-28s %8lld %8lld %8lld %8lld %8lld\n", name,
+         static_cast<long long>(Percentile(samples, 0.5)),
+         static_cast<long long>(Percentile(samples, 0.9)),
+         static_cast<long long>(Percentile(samples, 0.99)),
+         static_cast<long long>(Percentile(samples, 0.999)),
+         static_cast<long long>(samples.back()));
+}
+
+void PrintPercentileHeader(const char* section) {
+  printf("\n%s\n%-28s %8s %8s %8s %8s %8s\n", section, "", "p50", "p90",
+         "p99", "p99.9", "max");
+}
+
+struct Target {
+  Target() : looper(std::make_shared<Looper>()),
+             handler(std::make_shared<SinkHandler>()) {
+    looper->setName("bench");
+    looper->registerHandler(handler);
+    looper->start();
+  }
+
+  ~Target() {
+    looper->stop();
+    Looper::unregisterHandler(handler->id());
+  }
+
+  std::shared_ptr<Looper> looper;
+  std::shared_ptr<SinkHandler> handler;
+};
+
+// |producers| threads post |count| messages each as fast as they can.
+void PostThroughput(size_t producers, size_t count, bool batch) {
+  Target target;
+  target.handler->Expect(producers * count, false);
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (size_t p = 0; p < producers; p++) {
+    threads.emplace_back([&target, count, batch]() {
+      std::vector<std::shared_ptr<Message>> messages;
+      for (size_t i = 0; i < count; i++) {
+        auto message = Message::Obtain(kWhatCount, target.handler);
+        if (!batch) {
+          message->post();
+          continue;
+        }
+        messages.push_back(std::move(message));
+        if (messages.size() == kBatchSize || i + 1 == count) {
+          target.looper->postBatch(messages);
+          messages.clear();
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  target.handler->Wait();
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+
+  char name[64];
+  snprintf(name, sizeof(name), "%zu producer%s%s", producers,
+           producers > 1 ? "s" : "", batch ? ", postBatch" : "");
+  printf("%-28s %12.0f %10.1f\n", name, producers * count / seconds,
+         seconds * 1e9 / static_cast<double>(producers * count));
+}
+
+// |producers| threads post stamped messages, |interval_us| apart, 0 for
+// back to back.
+void PostLatency(size_t producers, size_t count, int64_t interval_us) {
+  Target target;
+  target.handler->Expect(producers * count, true);
+
+  std::vector<std::thread> threads;
+  for (size_t p = 0; p < producers; p++) {
+    threads.emplace_back([&target, count, interval_us]() {
+      for (size_t i = 0; i < count; i++) {
+        if (interval_us > 0) {
+          std::this_thread::sleep_for(std::chrono::microseconds(interval_us));
+        }
+        auto message = Message::Obtain(kWhatStamped, target.handler);
+        message->setInt64(AVE_MESSAGE_KEY("due"), Looper::getNowUs());
+        message->post();
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  char name[64];
+  snprintf(name, sizeof(name), "%zu producer%s, %s", producers,
+           producers > 1 ? "s" : "", interval_us > 0 ? "paced" : "flood");
+  PrintPercentiles(name, target.handler->Wait());
+}
+
+// Lateness of delayed messages with random delays of up to 50ms.
+void DelayedAccuracy(Looper::DelayedQueueType type,
+                     const char* name,
+                     size_t count) {
+  auto looper = std::make_shared<Looper>(type);
+  looper->setName("bench");
+  auto handler = std::make_shared<SinkHandler>();
+  looper->registerHandler(handler);
+  looper->start();
+  handler->Expect(count, true);
+
+  std::mt19937 rng(1);
+  std::uniform_int_distribution<int64_t> delay(1000, 50000);
+  for (size_t i = 0; i < count; i++) {
+    int64_t delay_us = delay(rng);
+    auto message = Message::Obtain(kWhatStamped, handler);
+    message->setInt64(AVE_MESSAGE_KEY("due"), Looper::getNowUs() + delay_us);
+    message->post(delay_us);
+  }
+  PrintPercentiles(name, handler->Wait());
+
+  looper->stop();
+  Looper::unregisterHandler(handler->id());
+}
+
+void RoundTrip(size_t count) {
+  auto looper = std::make_shared<Looper>();
+  looper->setName("bench");
+  auto handler = std::make_shared<EchoHandler>();
+  looper->registerHandler(handler);
+  looper->start();
+
+  std::vector<int64_t> samples;
+  samples.reserve(count);
+  for (size_t i = 0; i < count; i++) {
+    auto message = Message::Obtain(kWhatEcho, handler);
+    std::shared_ptr<Message> response;
+    int64_t start_us = Looper::getNowUs();
+    message->postAndWaitResponse(response);
+    samples.push_back(Looper::getNowUs() - start_us);
+  }
+  PrintPercentiles("postAndWaitResponse", std::move(samples));
+
+  looper->stop();
+  Looper::unregisterHandler(handler->id());
+}
+
+// One producer posts |rounds| messages to each of |handlers| handlers,
+// spread over |loopers| loopers.
+void FanOut(size_t loopers, size_t handlers, size_t rounds) {
+  std::vector<std::shared_ptr<Looper>> looper_list;
+  for (size_t i = 0; i < loopers; i++) {
+    looper_list.push_back(std::make_shared<Looper>());
+    looper_list.back()->setName("bench");
+    looper_list.back()->start();
+  }
+  std::vector<std::shared_ptr<SinkHandler>> handler_list;
+  for (size_t i = 0; i < handlers; i++) {
+    handler_list.push_back(std::make_shared<SinkHandler>());
+    looper_list[i % loopers]->registerHandler(handler_list.back());
+    handler_list.back()->Expect(rounds, false);
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  for (size_t round = 0; round < rounds; round++) {
+    for (const auto& handler : handler_list) {
+      Message::Obtain(kWhatCount, handler)->post();
+    }
+  }
+  for (const auto& handler : handler_list) {
+    handler->Wait();
+  }
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+
+  char name[64];
+  snprintf(name, sizeof(name), "%zu handlers / %zu looper%s", handlers,
+           loopers, loopers > 1 ? "s" : "");
+  printf("%-28s %12.0f %10.1f\n", name, handlers * rounds / seconds,
+         seconds * 1e9 / static_cast<double>(handlers * rounds));
+
+  for (const auto& looper : looper_list) {
+    looper->stop();
+  }
+  for (const auto& handler : handler_list) {
+    Looper::unregisterHandler(handler->id());
+  }
+}
+
+}  // namespace
+}  // namespace media
+}  // namespace ave
+
+int main(int argc, char* argv[]) {
+  using namespace ave::media;
+  size_t scale = argc > 1 ? static_cast<size_t>(atoi(argv[1])) : 1;
+  scale = std::max<size_t>(scale, 1);
+
+  printf("post throughput\n%-28s %12s %10s\n", "", "msgs/s", "ns/msg");
+  for (size_t producers : {1, 2, 4, 8}) {
+    PostThroughput(producers, 200000 * scale / producers, false);
+  }
+  PostThroughput(1, 200000 * scale, true);
+  PostThroughput(4, 50000 * scale, true);
+
+  PrintPercentileHeader("post-to-deliver latency (us)");
+  PostLatency(1, 2000 * scale, 100);
+  PostLatency(4, 2000 * scale, 100);
+  PostLatency(1, 100000 * scale, 0);
+  PostLatency(4, 25000 * scale, 0);
+
+  PrintPercentileHeader("delayed message lateness (us)");
+  DelayedAccuracy(Looper::DelayedQueueType::kPriorityQueue, "priority queue",
+                  5000 * scale);
+  DelayedAccuracy(Looper::DelayedQueueType::kTimingWheel, "timing wheel",
+                  5000 * scale);
+
+  PrintPercentileHeader("round trip (us)");
+  RoundTrip(10000 * scale);
+
+  printf("\nfan-out\n%-28s %12s %10s\n", "", "msgs/s", "ns/msg");
+  FanOut(1, 1, 100000 * scale);
+  FanOut(1, 64, 2000 * scale);
+  FanOut(4, 64, 2000 * scale);
+  FanOut(4, 1024, 100 * scale);
+  return 0;
+}
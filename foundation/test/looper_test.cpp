@@ -5,12 +5,855 @@
  * Distributed under terms of the GPLv2 license.
  */
 
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../clock.h"
+#include "../handler.h"
+#include "../looper.h"
+#include "../looper_group.h"
+#include "../message.h"
+#include "../typed_handler.h"
+
 #include "test/gtest.h"
 
-TEST(LooperTest, testInt) {
-  ASSERT_TRUE(1 > 0);
+namespace ave {
+namespace media {
+
+namespace {
+
+const uint32_t kWhatPing = 1;
+
+class RecordingHandler : public Handler {
+ public:
+  void WaitForCount(size_t count) {
+    std::unique_lock<std::mutex> l(mutex_);
+    condition_.wait(l, [this, count]() { return received_.size() >= count; });
+  }
+
+  std::vector<int32_t> received() {
+    std::lock_guard<std::mutex> l(mutex_);
+    return received_;
+  }
+
+ protected:
+  void onMessageReceived(const std::shared_ptr<Message>& message) override {
+    int32_t value = 0;
+    message->findInt32("value", &value);
+    std::lock_guard<std::mutex> l(mutex_);
+    received_.push_back(value);
+    condition_.notify_all();
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  std::vector<int32_t> received_;
+};
+
+struct Progress {
+  int64_t position_us;
+  int32_t percent;
+};
+
+// larger than MessagePayload::kInlineSize, stored on the heap
+struct Report {
+  std::string text;
+  int64_t samples[16];
+};
+
+class TypedRecordingHandler : public TypedHandler<Progress, Report> {
+ public:
+  void WaitForCount(size_t count) {
+    std::unique_lock<std::mutex> l(mutex_);
+    condition_.wait(l, [this, count]() { return events_.size() >= count; });
+  }
+
+  std::vector<std::string> events() {
+    std::lock_guard<std::mutex> l(mutex_);
+    return events_;
+  }
+
+ protected:
+  void onPayload(const Progress& progress,
+                 const std::shared_ptr<Message>& message) override {
+    Record("progress " + std::to_string(message->what()) + " " +
+           std::to_string(progress.percent));
+  }
+
+  void onPayload(const Report& report,
+                 const std::shared_ptr<Message>& message) override {
+    Record("report " + std::to_string(message->what()) + " " + report.text);
+  }
+
+  void onMessageReceived(const std::shared_ptr<Message>& message) override {
+    Record("dynamic " + std::to_string(message->what()));
+  }
+
+ private:
+  void Record(std::string event) {
+    std::lock_guard<std::mutex> l(mutex_);
+    events_.push_back(std::move(event));
+    condition_.notify_all();
+  }
+
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  std::vector<std::string> events_;
+};
+
+// replies with twice the value
+class EchoHandler : public Handler {
+ protected:
+  void onMessageReceived(const std::shared_ptr<Message>& message) override {
+    std::shared_ptr<ReplyToken> token;
+    if (!message->senderAwaitsResponse(token)) {
+      return;
+    }
+    int32_t value = 0;
+    message->findInt32("value", &value);
+    auto reply = Message::Obtain();
+    reply->setInt32("value", value * 2);
+    reply->postReply(token);
+  }
+};
+
+// re-posts to itself from inside the handler
+class ChainHandler : public RecordingHandler {
+ public:
+  std::atomic<int32_t> reentered{0};
+  std::atomic<int32_t> chain_end{0};
+
+ protected:
+  void onMessageReceived(const std::shared_ptr<Message>& message) override {
+    if (in_handler_.exchange(true)) {
+      reentered++;
+    }
+    RecordingHandler::onMessageReceived(message);
+    int32_t value = 0;
+    message->findInt32("value", &value);
+    if (value < chain_end.load()) {
+      auto next = Message::Obtain(kWhatPing, shared_from_this());
+      next->setInt32("value", value + 1);
+      next->post();
+    }
+    in_handler_.store(false);
+  }
+
+ private:
+  std::atomic<bool> in_handler_{false};
+};
+
+// posts 1 and 2 from inside the handler, removes 1 and posts 3
+class SelfRemovingHandler : public RecordingHandler {
+ protected:
+  void onMessageReceived(const std::shared_ptr<Message>& message) override {
+    RecordingHandler::onMessageReceived(message);
+    int32_t value = 0;
+    message->findInt32("value", &value);
+    if (value != 0) {
+      return;
+    }
+    auto post = [this](uint32_t what, int32_t next) {
+      auto message = Message::Obtain(what, shared_from_this());
+      message->setInt32("value", next);
+      message->post();
+    };
+    post(kWhatPing, 1);
+    post(kWhatPing + 1, 2);
+    looper()->removeMessages(shared_from_this(), kWhatPing);
+    post(kWhatPing, 3);
+  }
+};
+
+#if defined(__linux__)
+// one read per message, level triggering reports whatever is left
+class FdReadingHandler : public Handler {
+ public:
+  void WaitForBytes(size_t count) {
+    std::unique_lock<std::mutex> l(mutex_);
+    condition_.wait(l, [this, count]() { return bytes_.size() >= count; });
+  }
+
+  std::string bytes() {
+    std::lock_guard<std::mutex> l(mutex_);
+    return bytes_;
+  }
+
+ protected:
+  void onMessageReceived(const std::shared_ptr<Message>& message) override {
+    int32_t fd = -1;
+    int32_t events = 0;
+    ASSERT_TRUE(message->findInt32("fd", &fd));
+    ASSERT_TRUE(message->findInt32("events", &events));
+    EXPECT_TRUE(events & kFdInput);
+    char buffer[2];
+    ssize_t size = read(fd, buffer, sizeof(buffer));
+    if (size > 0) {
+      std::lock_guard<std::mutex> l(mutex_);
+      bytes_.append(buffer, static_cast<size_t>(size));
+      condition_.notify_all();
+    }
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  std::string bytes_;
+};
+#endif
+
+#if defined(AVE_MESSAGE_HAS_COROUTINES)
+// starts running at once and owns itself
+struct DetachedTask {
+  struct promise_type {
+    DetachedTask get_return_object() { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+};
+#endif
+
+}  // namespace
+
+class LooperTest
+    : public ::testing::TestWithParam<Looper::DelayedQueueType> {
+ protected:
+  void SetUp() override {
+    looper_ = std::make_shared<Looper>(GetParam());
+    looper_->setName("LooperTest");
+    handler_ = std::make_shared<RecordingHandler>();
+    looper_->registerHandler(handler_);
+    looper_->start();
+  }
+
+  void TearDown() override {
+    looper_->stop();
+    Looper::unregisterHandler(handler_->id());
+  }
+
+  void Post(int32_t value, int64_t delay_us = 0) {
+    auto message = std::make_shared<Message>(kWhatPing, handler_);
+    message->setInt32("value", value);
+    message->post(delay_us);
+  }
+
+  std::shared_ptr<Looper> looper_;
+  std::shared_ptr<RecordingHandler> handler_;
+};
+
+TEST_P(LooperTest, ImmediateMessagesKeepFifoOrder) {
+  const int32_t kCount = 1000;
+  for (int32_t i = 0; i < kCount; i++) {
+    Post(i);
+  }
+  handler_->WaitForCount(kCount);
+
+  auto received = handler_->received();
+  ASSERT_EQ(static_cast<size_t>(kCount), received.size());
+  for (int32_t i = 0; i < kCount; i++) {
+    EXPECT_EQ(i, received[i]);
+  }
+}
+
+TEST_P(LooperTest, MultipleProducersDeliverEverything) {
+  const int32_t kProducers = 8;
+  const int32_t kPerProducer = 2000;
+  std::vector<std::thread> producers;
+  for (int32_t p = 0; p < kProducers; p++) {
+    producers.emplace_back([this, p]() {
+      for (int32_t i = 0; i < kPerProducer; i++) {
+        Post(p * kPerProducer + i);
+      }
+    });
+  }
+  for (auto& producer : producers) {
+    producer.join();
+  }
+  handler_->WaitForCount(kProducers * kPerProducer);
+
+  // each producer's messages arrive in the order they were posted
+  std::vector<int32_t> last(kProducers, -1);
+  for (int32_t value : handler_->received()) {
+    int32_t p = value / kPerProducer;
+    EXPECT_LT(last[p], value);
+    last[p] = value;
+  }
+}
+
+TEST_P(LooperTest, DelayedMessagesDeliveredByDeadline) {
+  Post(3, 30000);
+  Post(2, 20000);
+  Post(1, 10000);
+  Post(0);
+  handler_->WaitForCount(4);
+
+  auto received = handler_->received();
+  ASSERT_EQ(4u, received.size());
+  for (int32_t i = 0; i < 4; i++) {
+    EXPECT_EQ(i, received[i]);
+  }
+}
+
+TEST_P(LooperTest, StopDrainsPendingMessages) {
+  Post(0);
+  Post(1, 10000);
+  looper_->stop();
+  EXPECT_EQ(2u, handler_->received().size());
 }
 
+TEST_P(LooperTest, PostBatch) {
+  std::vector<std::shared_ptr<Message>> delayed;
+  std::vector<std::shared_ptr<Message>> immediate;
+  for (int32_t i = 0; i < 100; i++) {
+    auto message = Message::Obtain(kWhatPing, handler_);
+    message->setInt32("value", i);
+    (i < 50 ? immediate : delayed).push_back(message);
+  }
+  looper_->postBatch(delayed, 10000);
+  looper_->postBatch(immediate);
+  handler_->WaitForCount(100);
+
+  auto received = handler_->received();
+  for (int32_t i = 0; i < 100; i++) {
+    EXPECT_EQ(i, received[i]);
+  }
+}
+
+TEST_P(LooperTest, PostCoalescedKeepsLatest) {
+  // not started yet, everything below is pending at once
+  auto looper = std::make_shared<Looper>(GetParam());
+  auto handler = std::make_shared<RecordingHandler>();
+  looper->registerHandler(handler);
+
+  auto first = Message::Obtain(kWhatPing, handler);
+  first->setInt32("value", -1);
+  first->post();
+  for (int32_t i = 0; i < 100; i++) {
+    auto progress = Message::Obtain(kWhatPing + 1, handler);
+    progress->setInt32("value", i);
+    progress->postCoalesced();
+  }
+  auto last = Message::Obtain(kWhatPing, handler);
+  last->setInt32("value", 1000);
+  last->post();
+
+  looper->start();
+  handler->WaitForCount(3);
+  looper->stop();
+
+  auto received = handler->received();
+  ASSERT_EQ(3u, received.size());
+  EXPECT_EQ(-1, received[0]);
+  EXPECT_EQ(99, received[1]);
+  EXPECT_EQ(1000, received[2]);
+
+  Looper::unregisterHandler(handler->id());
+}
+
+TEST_P(LooperTest, CancelPendingMessages) {
+  auto looper = std::make_shared<Looper>(GetParam());
+  auto handler = std::make_shared<RecordingHandler>();
+  looper->registerHandler(handler);
+
+  std::vector<std::shared_ptr<Looper::PendingMessage>> pending;
+  for (int32_t i = 0; i < 6; i++) {
+    auto message = Message::Obtain(kWhatPing, handler);
+    message->setInt32("value", i);
+    pending.push_back(message->postCancellable(i < 3 ? 0 : 50000));
+  }
+  EXPECT_TRUE(pending[1]->cancel());
+  EXPECT_TRUE(pending[4]->cancel());
+  EXPECT_FALSE(pending[4]->cancel());
+
+  looper->start();
+  handler->WaitForCount(4);
+  looper->stop();
+  EXPECT_EQ(std::vector<int32_t>({0, 2, 3, 5}), handler->received());
+  // too late once delivered
+  EXPECT_FALSE(pending[0]->cancel());
+
+  Looper::unregisterHandler(handler->id());
+}
+
+TEST_P(LooperTest, CancelUnlinksDelayedMessages) {
+  auto looper = std::make_shared<Looper>(GetParam());
+  auto handler = std::make_shared<RecordingHandler>();
+  looper->registerHandler(handler);
+
+  // deadlines out of posting order, so the heap moves events around
+  std::vector<std::shared_ptr<Looper::PendingMessage>> pending;
+  std::vector<int32_t> expected;
+  std::weak_ptr<Message> cancelled_message;
+  for (int32_t i = 0; i < 60; i++) {
+    int32_t order = (i * 37) % 60;
+    auto message = Message::Obtain(kWhatPing, handler);
+    message->setInt32("value", order);
+    pending.push_back(message->postCancellable(100000 + order * 5000));
+    if (i % 3 != 0) {
+      expected.push_back(order);
+    } else {
+      cancelled_message = message;
+    }
+  }
+  for (size_t i = 0; i < pending.size(); i += 3) {
+    EXPECT_TRUE(pending[i]->cancel());
+  }
+  // gone from the queue, message and all
+  EXPECT_EQ(40, looper->stats().queue_depth);
+  EXPECT_TRUE(cancelled_message.expired());
+
+  looper->start();
+  handler->WaitForCount(expected.size());
+  looper->stop();
+  std::sort(expected.begin(), expected.end());
+  EXPECT_EQ(expected, handler->received());
+
+  Looper::unregisterHandler(handler->id());
+}
+
+TEST_P(LooperTest, RemoveMessagesAndFlush) {
+  auto looper = std::make_shared<Looper>(GetParam());
+  auto handler = std::make_shared<RecordingHandler>();
+  auto other = std::make_shared<RecordingHandler>();
+  looper->registerHandler(handler);
+  looper->registerHandler(other);
+
+  auto post = [](const std::shared_ptr<Handler>& target, uint32_t what,
+                 int32_t value, int64_t delay_us) {
+    auto message = Message::Obtain(what, target);
+    message->setInt32("value", value);
+    message->post(delay_us);
+  };
+  for (int64_t delay_us : {0, 50000}) {
+    post(handler, kWhatPing, 1, delay_us);
+    post(handler, kWhatPing + 1, 2, delay_us);
+    post(other, kWhatPing, 3, delay_us);
+  }
+  looper->removeMessages(handler, kWhatPing);
+  // posted after the removal, still delivered
+  post(handler, kWhatPing, 4, 0);
+
+  looper->start();
+  handler->WaitForCount(3);
+  other->WaitForCount(2);
+
+  looper->flush(other);
+  post(other, kWhatPing, 5, 1000000);
+  post(other, kWhatPing, 6, 1000000);
+  looper->flush(other);
+  EXPECT_EQ(0, looper->stats().queue_depth);
+  looper->stop();
+
+  EXPECT_EQ(std::vector<int32_t>({2, 4, 2}), handler->received());
+  EXPECT_EQ(std::vector<int32_t>({3, 3}), other->received());
+
+  Looper::unregisterHandler(handler->id());
+  Looper::unregisterHandler(other->id());
+}
+
+TEST_P(LooperTest, DirectDispatchRunsAfterTheHandler) {
+  auto handler = std::make_shared<ChainHandler>();
+  handler->chain_end = 1000;
+  looper_->registerHandler(handler);
+  looper_->setDirectDispatch(true);
+
+  auto first = Message::Obtain(kWhatPing, handler);
+  first->setInt32("value", 0);
+  first->post();
+  handler->WaitForCount(1001);
+
+  auto received = handler->received();
+  for (int32_t i = 0; i <= 1000; i++) {
+    EXPECT_EQ(i, received[i]);
+  }
+  EXPECT_EQ(0, handler->reentered.load());
+
+  Looper::unregisterHandler(handler->id());
+}
+
+TEST_P(LooperTest, DirectDispatchHonorsRemovals) {
+  auto handler = std::make_shared<SelfRemovingHandler>();
+  looper_->registerHandler(handler);
+  looper_->setDirectDispatch(true);
+
+  auto first = Message::Obtain(kWhatPing, handler);
+  first->setInt32("value", 0);
+  first->post();
+  handler->WaitForCount(3);
+  // a removed message would have been delivered before 3
+  EXPECT_EQ(std::vector<int32_t>({0, 2, 3}), handler->received());
+  EXPECT_EQ(0, looper_->stats().queue_depth);
+
+  Looper::unregisterHandler(handler->id());
+}
+
+TEST_P(LooperTest, DirectDispatchKeepsQueuedOrder) {
+  auto looper = std::make_shared<Looper>(GetParam());
+  auto handler = std::make_shared<ChainHandler>();
+  handler->chain_end = 1;
+  looper->registerHandler(handler);
+  looper->setDirectDispatch(true);
+
+  // queued before start, 0's follow-up must not overtake 10 and 20
+  for (int32_t value : {0, 10, 20}) {
+    auto message = Message::Obtain(kWhatPing, handler);
+    message->setInt32("value", value);
+    message->post();
+  }
+  looper->start();
+  handler->WaitForCount(4);
+  looper->stop();
+
+  EXPECT_EQ(std::vector<int32_t>({0, 10, 20, 1}), handler->received());
+  Looper::unregisterHandler(handler->id());
+}
+
+TEST_P(LooperTest, TypedPayloadsMixWithDynamicMessages) {
+  auto handler = std::make_shared<TypedRecordingHandler>();
+  looper_->registerHandler(handler);
+
+  auto progress = Message::Obtain(1, handler);
+  progress->setPayload(Progress{1000, 50});
+  progress->post();
+
+  auto dynamic = Message::Obtain(2, handler);
+  dynamic->setInt32("value", 1);
+  dynamic->post();
+
+  auto report = Message::Obtain(3, handler);
+  report->setPayload(Report{"done", {}});
+  report->post();
+
+  handler->WaitForCount(3);
+  auto events = handler->events();
+  ASSERT_EQ(3u, events.size());
+  EXPECT_EQ("progress 1 50", events[0]);
+  EXPECT_EQ("dynamic 2", events[1]);
+  EXPECT_EQ("report 3 done", events[2]);
+
+  Looper::unregisterHandler(handler->id());
+}
+
+TEST_P(LooperTest, ConcurrentRequestsGetTheirOwnReply) {
+  auto echo = std::make_shared<EchoHandler>();
+  looper_->registerHandler(echo);
+
+  const int32_t kThreads = 8;
+  const int32_t kPerThread = 200;
+  std::vector<std::thread> threads;
+  std::atomic<int32_t> mismatches(0);
+  for (int32_t t = 0; t < kThreads; t++) {
+    threads.emplace_back([&echo, &mismatches, t]() {
+      for (int32_t i = 0; i < kPerThread; i++) {
+        int32_t value = t * kPerThread + i;
+        auto request = Message::Obtain(kWhatPing, echo);
+        request->setInt32("value", value);
+        std::shared_ptr<Message> response;
+        request->postAndWaitResponse(response);
+        int32_t doubled = 0;
+        if (response == nullptr || !response->findInt32("value", &doubled) ||
+            doubled != value * 2) {
+          mismatches++;
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(0, mismatches.load());
+
+  Looper::unregisterHandler(echo->id());
+}
+
+#if defined(AVE_MESSAGE_HAS_COROUTINES)
+// one thread keeps every request in flight at once
+TEST_P(LooperTest, CoroutineRequests) {
+  auto echo = std::make_shared<EchoHandler>();
+  looper_->registerHandler(echo);
+
+  const int32_t kRequests = 100;
+  std::mutex mutex;
+  std::condition_variable condition;
+  int32_t done = 0;
+  int64_t sum = 0;
+  auto request = [&](int32_t value) -> DetachedTask {
+    auto message = Message::Obtain(kWhatPing, echo);
+    message->setInt32("value", value);
+    std::shared_ptr<Message> response = co_await message->postAsync();
+    int32_t doubled = 0;
+    response->findInt32("value", &doubled);
+    std::lock_guard<std::mutex> l(mutex);
+    sum += doubled;
+    done++;
+    condition.notify_all();
+  };
+  for (int32_t i = 0; i < kRequests; i++) {
+    request(i);
+  }
+
+  std::unique_lock<std::mutex> l(mutex);
+  condition.wait(l, [&done]() { return done == kRequests; });
+  EXPECT_EQ(kRequests * (kRequests - 1), sum);
+  l.unlock();
+
+  Looper::unregisterHandler(echo->id());
+}
+#endif
+
+TEST_P(LooperTest, StatsCountDispatches) {
+  auto clock = std::make_shared<SimulatedClock>(1000000);
+  auto looper = std::make_shared<Looper>(GetParam(), Looper::kDefaultTickUs,
+                                         clock);
+  auto handler = std::make_shared<RecordingHandler>();
+  looper->registerHandler(handler);
+  looper->enableStats(true);
+
+  // queued before the thread runs, so the depth is deterministic
+  for (int32_t i = 0; i < 10; i++) {
+    auto message = std::make_shared<Message>(kWhatPing, handler);
+    message->setInt32("value", i);
+    message->post();
+  }
+  auto delayed = std::make_shared<Message>(kWhatPing, handler);
+  delayed->post(5000);
+  EXPECT_EQ(11, looper->stats().queue_depth);
+
+  looper->start();
+  handler->WaitForCount(10);
+  clock->AdvanceUs(10000);
+  handler->WaitForCount(11);
+  looper->stop();
+
+  Looper::Stats stats = looper->stats();
+  EXPECT_EQ(11u, stats.dispatch.messages);
+  EXPECT_EQ(0, stats.queue_depth);
+  EXPECT_EQ(11, stats.peak_queue_depth);
+  // the delayed message ran 5ms late on the simulated clock
+  EXPECT_GE(stats.dispatch.latency.max_us, 5000);
+  EXPECT_EQ(11u, handler->stats().messages);
+
+  Looper::unregisterHandler(handler->id());
+}
+
+TEST_P(LooperTest, WatchdogReportsSlowDispatches) {
+  // blocks for "sleep_us" before recording the message
+  class SlowHandler : public RecordingHandler {
+   protected:
+    void onMessageReceived(const std::shared_ptr<Message>& message) override {
+      int64_t sleep_us = 0;
+      if (message->findInt64("sleep_us", &sleep_us)) {
+        std::this_thread::sleep_for(std::chrono::microseconds(sleep_us));
+      }
+      RecordingHandler::onMessageReceived(message);
+    }
+  };
+
+  auto looper = std::make_shared<Looper>(GetParam());
+  looper->setName("WatchdogTest");
+  auto handler = std::make_shared<SlowHandler>();
+  looper->registerHandler(handler);
+  std::mutex mutex;
+  std::vector<WatchdogReport> reports;
+  looper->setWatchdog(
+      20000,
+      [&mutex, &reports](const WatchdogReport& report) {
+        std::lock_guard<std::mutex> l(mutex);
+        reports.push_back(report);
+      },
+      true);
+
+  auto slow = std::make_shared<Message>(kWhatPing + 1, handler);
+  slow->setInt64("sleep_us", 200000);
+  slow->post();
+  for (int32_t i = 1; i <= 3; i++) {
+    auto message = std::make_shared<Message>(kWhatPing, handler);
+    message->setInt32("value", i);
+    message->post();
+  }
+  looper->start();
+  handler->WaitForCount(4);
+  looper->stop();
+
+  std::lock_guard<std::mutex> l(mutex);
+  ASSERT_EQ(1u, reports.size());
+  EXPECT_EQ("WatchdogTest", reports[0].looper_name);
+  EXPECT_EQ(handler->id(), reports[0].handler_id);
+  EXPECT_EQ(kWhatPing + 1, reports[0].what);
+  EXPECT_GE(reports[0].elapsed_us, 20000);
+  EXPECT_EQ(3, reports[0].queue_depth);
+#if defined(__linux__) && defined(__GLIBC__)
+  EXPECT_FALSE(reports[0].stack.empty());
+#endif
+
+  Looper::unregisterHandler(handler->id());
+}
+
+// a simulated clock fires delayed messages as soon as it is advanced, no
+// matter how long the delay
+TEST_P(LooperTest, SimulatedClockDrivesDelayedMessages) {
+  auto clock = std::make_shared<SimulatedClock>(1000000);
+  auto looper = std::make_shared<Looper>(GetParam(), Looper::kDefaultTickUs,
+                                         clock);
+  auto handler = std::make_shared<RecordingHandler>();
+  looper->registerHandler(handler);
+  looper->start();
+
+  const int64_t kHourUs = 3600LL * 1000 * 1000;
+  for (int32_t i = 0; i < 3; i++) {
+    auto message = std::make_shared<Message>(kWhatPing, handler);
+    message->setInt32("value", i);
+    message->post((i + 1) * kHourUs);
+  }
+
+  clock->AdvanceUs(kHourUs);
+  handler->WaitForCount(1);
+  clock->AdvanceUs(2 * kHourUs);
+  handler->WaitForCount(3);
+
+  auto received = handler->received();
+  ASSERT_EQ(3u, received.size());
+  for (int32_t i = 0; i < 3; i++) {
+    EXPECT_EQ(i, received[i]);
+  }
+
+  looper->stop();
+  Looper::unregisterHandler(handler->id());
+}
+
+#if defined(__linux__)
+// once an fd is registered the loop waits on epoll, messages and timers
+// keep working next to fd readiness
+TEST_P(LooperTest, FdReadinessAndMessagesShareTheLoop) {
+  int fds[2];
+  ASSERT_EQ(0, pipe2(fds, O_NONBLOCK | O_CLOEXEC));
+  auto fd_handler = std::make_shared<FdReadingHandler>();
+  looper_->registerHandler(fd_handler);
+  ASSERT_EQ(OK, looper_->addFd(fds[0], kFdInput, fd_handler, kWhatPing));
+
+  ASSERT_EQ(3, write(fds[1], "abc", 3));
+  fd_handler->WaitForBytes(3);
+  Post(1, 20000);
+  Post(0);
+  handler_->WaitForCount(2);
+  ASSERT_EQ(2, write(fds[1], "de", 2));
+  fd_handler->WaitForBytes(5);
+  EXPECT_EQ("abcde", fd_handler->bytes());
+  EXPECT_EQ((std::vector<int32_t>{0, 1}), handler_->received());
+
+  EXPECT_EQ(OK, looper_->removeFd(fds[0]));
+  EXPECT_EQ(NAME_NOT_FOUND, looper_->removeFd(fds[0]));
+  ASSERT_EQ(1, write(fds[1], "f", 1));
+  Post(2);
+  handler_->WaitForCount(3);
+  EXPECT_EQ("abcde", fd_handler->bytes());
+
+  close(fds[0]);
+  close(fds[1]);
+  Looper::unregisterHandler(fd_handler->id());
+}
+#endif
+
+// many loopers on few workers, every handler still sees its own messages in
+// the order they were posted
+TEST(LooperGroupTest, KeepsPerHandlerOrder) {
+  const size_t kLoopers = 32;
+  const int32_t kProducers = 4;
+  const int32_t kPerProducer = 500;
+  LooperGroup group(4);
+  std::vector<std::shared_ptr<Looper>> loopers;
+  std::vector<std::shared_ptr<RecordingHandler>> handlers;
+  for (size_t i = 0; i < kLoopers; i++) {
+    loopers.push_back(group.createLooper("LooperGroupTest"));
+    handlers.push_back(std::make_shared<RecordingHandler>());
+    loopers.back()->registerHandler(handlers.back());
+  }
+
+  std::vector<std::thread> producers;
+  for (int32_t p = 0; p < kProducers; p++) {
+    producers.emplace_back([&handlers, p]() {
+      for (int32_t i = 0; i < kPerProducer; i++) {
+        for (auto& handler : handlers) {
+          auto message = Message::Obtain(kWhatPing, handler);
+          message->setInt32("value", p * kPerProducer + i);
+          message->post();
+        }
+      }
+    });
+  }
+  for (auto& producer : producers) {
+    producer.join();
+  }
+
+  for (auto& handler : handlers) {
+    handler->WaitForCount(kProducers * kPerProducer);
+    std::vector<int32_t> last(kProducers, -1);
+    for (int32_t value : handler->received()) {
+      int32_t p = value / kPerProducer;
+      EXPECT_LT(last[p], value);
+      last[p] = value;
+    }
+  }
+
+  for (size_t i = 0; i < kLoopers; i++) {
+    loopers[i]->stop();
+    Looper::unregisterHandler(handlers[i]->id());
+  }
+}
+
+TEST(LooperGroupTest, DelayedMessages) {
+  auto clock = std::make_shared<SimulatedClock>(1000000);
+  LooperGroup group(2, clock);
+  auto looper = group.createLooper("LooperGroupTest");
+  auto handler = std::make_shared<RecordingHandler>();
+  looper->registerHandler(handler);
+
+  const int64_t kHourUs = 3600LL * 1000 * 1000;
+  for (int32_t i = 2; i >= 0; i--) {
+    auto message = std::make_shared<Message>(kWhatPing, handler);
+    message->setInt32("value", i);
+    message->post(i * kHourUs);
+  }
+  handler->WaitForCount(1);
+  clock->AdvanceUs(kHourUs);
+  handler->WaitForCount(2);
+  clock->AdvanceUs(kHourUs);
+  handler->WaitForCount(3);
+
+  auto received = handler->received();
+  ASSERT_EQ(3u, received.size());
+  for (int32_t i = 0; i < 3; i++) {
+    EXPECT_EQ(i, received[i]);
+  }
+
+  looper->stop();
+  Looper::unregisterHandler(handler->id());
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    DelayedQueueTypes,
+    LooperTest,
+    ::testing::Values(Looper::DelayedQueueType::kPriorityQueue,
+                      Looper::DelayedQueueType::kTimingWheel));
+
+}  // namespace media
+}  // namespace ave
+
 int main(int argc, char* argv[]) {
   ::testing::InitGoogleTest(&argc, argv);
 
@@ -0,0 +1,157 @@
+/*
+ * looper_wakeup_benchmark.cc
+ * Copyright (C) 2024 youfa <vsyfar@gmail.com>
+ *
+ * Distributed under terms of the GPLv2 license.
+ */
+
+// Measures how long a parked looper takes to run a message posted to it,
+// at each thread priority, while every cpu is kept busy by batch threads.
+//
+//   looper_wakeup_benchmark [samples]
+//
+// Real-time and negative nice priorities need CAP_SYS_NICE, rows the
+// process was not permitted to use are marked as fallbacks.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "../handler.h"
+#include "../looper.h"
+#include "../message.h"
+#include "../thread_priority.h"
+
+namespace ave {
+namespace media {
+namespace {
+
+const uint32_t kWhatWakeup = 1;
+const int64_t kPostIntervalUs = 1000;
+
+class LatencyHandler : public Handler {
+ public:
+  explicit LatencyHandler(size_t samples) : expected_(samples) {
+    latencies_us_.reserve(samples);
+  }
+
+  std::vector<int64_t> Wait() {
+    std::unique_lock<std::mutex> l(mutex_);
+    condition_.wait(l, [this]() { return latencies_us_.size() >= expected_; });
+    return latencies_us_;
+  }
+
+ protected:
+  void onMessageReceived(const std::shared_ptr<Message>& message) override {
+    int64_t now_us = Looper::getNowUs();
+    int64_t posted_us = 0;
+    message->findInt64("posted", &posted_us);
+    std::lock_guard<std::mutex> l(mutex_);
+    latencies_us_.push_back(now_us - posted_us);
+    condition_.notify_all();
+  }
+
+ private:
+  const size_t expected_;
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  std::vector<int64_t> latencies_us_;
+};
+
+struct Level {
+  const char* name;
+  int32_t priority;
+};
+
+int64_t Percentile(const std::vector<int64_t>& sorted, double p) {
+  size_t index = static_cast<size_t>(p * (sorted.size() - 1));
+  return sorted[index];
+}
+
+void RunLevel(const Level& level, size_t samples) {
+  // probe whether the priority is permitted on a throwaway thread
+  status_t permitted = OK;
+  std::thread([&permitted, &level]() {
+    permitted = SetCurrentThreadPriority(level.priority);
+  }).join();
+
+  auto looper = std::make_shared<Looper>();
+  looper->setName("wakeup_bench");
+  auto handler = std::make_shared<LatencyHandler>(samples);
+  looper->registerHandler(handler);
+  looper->start(level.priority);
+
+  for (size_t i = 0; i < samples; i++) {
+    // let the looper park again before the next post
+    std::this_thread::sleep_for(std::chrono::microseconds(kPostIntervalUs));
+    auto message = Message::Obtain(kWhatWakeup, handler);
+    message->setInt64("posted", Looper::getNowUs());
+    message->post();
+  }
+
+  std::vector<int64_t> latencies = handler->Wait();
+  looper->stop();
+  Looper::unregisterHandler(handler->id());
+
+  std::sort(latencies.begin(), latencies.end());
+  printf("%-20s %8lld %8lld %8lld %8lld %8lld%s\n", level.name,
+         static_cast<long long>(Percentile(latencies, 0.5)),
+         static_cast<long long>(Percentile(latencies, 0.9)),
+         static_cast<long long>(Percentile(latencies, 0.99)),
+         static_cast<long long>(Percentile(latencies, 0.999)),
+         static_cast<long long>(latencies.back()),
+         permitted == OK ? "" : "  (fallback)");
+}
+
+}  // namespace
+}  // namespace media
+}  // namespace ave
+
+int main(int argc, char* argv[]) {
+  using namespace ave::media;
+  size_t samples = argc > 1 ? static_cast<size_t>(atoi(argv[1])) : 2000;
+
+  // one spinning batch thread per cpu
+  std::atomic<bool> loaded(true);
+  std::vector<std::thread> load;
+  unsigned cpus = std::max(1u, std::thread::hardware_concurrency());
+  for (unsigned i = 0; i < cpus; i++) {
+    load.emplace_back([&loaded]() {
+      SetCurrentThreadPriority(kPriorityNormal);
+      volatile uint64_t sink = 0;
+      while (loaded.load(std::memory_order_relaxed)) {
+        sink = sink + 1;
+      }
+    });
+  }
+
+  const Level kLevels[] = {
+      {"background", kPriorityBackground},
+      {"normal", kPriorityNormal},
+      {"display", kPriorityDisplay},
+      {"urgent_display", kPriorityUrgentDisplay},
+      {"audio", kPriorityAudio},
+      {"urgent_audio", kPriorityUrgentAudio},
+      {"realtime_rr", kPriorityRealtimeRoundRobin},
+      {"realtime_fifo", kPriorityRealtimeFifo},
+  };
+  printf("wakeup latency (us), %zu samples, %u load threads\n", samples, cpus);
+  printf("%-20s %8s %8s %8s %8s %8s\n", "priority", "p50", "p90", "p99",
+         "p99.9", "max");
+  for (const Level& level : kLevels) {
+    RunLevel(level, samples);
+  }
+
+  loaded.store(false);
+  for (auto& thread : load) {
+    thread.join();
+  }
+  return 0;
+}
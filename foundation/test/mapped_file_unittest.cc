@@ -0,0 +1,138 @@
+/*
+ * mapped_file_unittest.cc
+ * Copyright (C) 2024 youfa <vsyfar@gmail.com>
+ *
+ * Distributed under terms of the GPLv2 license.
+ */
+
+#include "../mapped_file.h"
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "test/gtest.h"
+
+namespace ave {
+namespace media {
+
+namespace {
+
+class MappedFileTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    path_ = ::testing::TempDir() + "mapped_file_unittest.bin";
+    contents_.resize(3 * 1024 * 1024 + 17);
+    for (size_t i = 0; i < contents_.size(); i++) {
+      contents_[i] = static_cast<uint8_t>(i * 7);
+    }
+    FILE* file = fopen(path_.c_str(), "wb");
+    ASSERT_NE(nullptr, file);
+    ASSERT_EQ(1u, fwrite(contents_.data(), contents_.size(), 1, file));
+    fclose(file);
+  }
+
+  void TearDown() override { remove(path_.c_str()); }
+
+  std::string path_;
+  std::vector<uint8_t> contents_;
+};
+
+}  // namespace
+
+TEST_F(MappedFileTest, ViewsPointIntoTheMapping) {
+  auto file = MappedFile::Open(path_);
+  ASSERT_NE(nullptr, file);
+  EXPECT_EQ(contents_.size(), file->size());
+
+  auto first = file->view(0, 100);
+  auto second = file->view(1000000, 5000);
+  ASSERT_NE(nullptr, second);
+  EXPECT_EQ(first->data() + 1000000, second->data());
+  EXPECT_EQ(5000u, second->size());
+  EXPECT_EQ(0, memcmp(second->data(), contents_.data() + 1000000, 5000));
+
+  auto tail = file->view(contents_.size() - 17, 17);
+  ASSERT_NE(nullptr, tail);
+  EXPECT_EQ(contents_.back(), tail->data()[16]);
+  EXPECT_EQ(nullptr, file->view(contents_.size() - 17, 18));
+  EXPECT_EQ(nullptr, file->view(contents_.size() + 1, 0));
+
+  // a write stays private
+  second->data()[0] = ~contents_[1000000];
+  std::vector<uint8_t> on_disk(1);
+  FILE* stream = fopen(path_.c_str(), "rb");
+  ASSERT_NE(nullptr, stream);
+  fseek(stream, 1000000, SEEK_SET);
+  ASSERT_EQ(1u, fread(on_disk.data(), 1, 1, stream));
+  fclose(stream);
+  EXPECT_EQ(contents_[1000000], on_disk[0]);
+}
+
+TEST_F(MappedFileTest, ViewsKeepTheMapping) {
+  auto file = MappedFile::Open(path_);
+  ASSERT_NE(nullptr, file);
+  std::weak_ptr<MappedFile> weak_file = file;
+  auto sample = file->view(4096, 4096);
+  file.reset();
+  EXPECT_FALSE(weak_file.expired());
+  EXPECT_EQ(0, memcmp(sample->data(), contents_.data() + 4096, 4096));
+  sample.reset();
+  EXPECT_TRUE(weak_file.expired());
+}
+
+TEST_F(MappedFileTest, AccessHints) {
+  auto file = MappedFile::Open(path_);
+  ASSERT_NE(nullptr, file);
+  file->setAccessPattern(MappedFile::AccessPattern::kSequential);
+  for (size_t offset = 0; offset + 65536 <= file->size(); offset += 65536) {
+    auto sample = file->view(offset, 65536);
+    ASSERT_NE(nullptr, sample);
+    EXPECT_EQ(contents_[offset + 100], sample->data()[100]);
+    file->dontNeed(0, offset);
+  }
+  file->setAccessPattern(MappedFile::AccessPattern::kRandom);
+  file->willNeed(2 * 1024 * 1024, 1024 * 1024);
+  auto sample = file->view(2 * 1024 * 1024 + 1, 10);
+  EXPECT_EQ(contents_[2 * 1024 * 1024 + 1], sample->data()[0]);
+}
+
+TEST_F(MappedFileTest, DontNeedKeepsWritesNextToTheRange) {
+  auto file = MappedFile::Open(path_);
+  ASSERT_NE(nullptr, file);
+  const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  auto view = file->view(0, 4 * page);
+  ASSERT_NE(nullptr, view);
+  uint8_t* data = view->data();
+  data[page - 1] = ~contents_[page - 1];
+  data[2 * page + 1] = ~contents_[2 * page + 1];
+  data[3 * page + 1] = ~contents_[3 * page + 1];
+
+  // drops the second and third pages only, not the first or the fourth
+  file->dontNeed(page - 1, 2 * page + 2);
+  EXPECT_EQ(static_cast<uint8_t>(~contents_[page - 1]), data[page - 1]);
+  EXPECT_EQ(contents_[2 * page + 1], data[2 * page + 1]);
+  EXPECT_EQ(static_cast<uint8_t>(~contents_[3 * page + 1]),
+            data[3 * page + 1]);
+
+  // nothing is wholly inside
+  file->dontNeed(page - 1, 2);
+  EXPECT_EQ(static_cast<uint8_t>(~contents_[page - 1]), data[page - 1]);
+}
+
+TEST(MappedFileOpenTest, Failures) {
+  EXPECT_EQ(nullptr, MappedFile::Open("/nonexistent/mapped_file"));
+  std::string path = ::testing::TempDir() + "mapped_file_unittest.empty";
+  FILE* file = fopen(path.c_str(), "wb");
+  ASSERT_NE(nullptr, file);
+  fclose(file);
+  EXPECT_EQ(nullptr, MappedFile::Open(path));
+  remove(path.c_str());
+}
+
+}  // namespace media
+}  // namespace ave
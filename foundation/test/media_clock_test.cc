@@ -7,15 +7,26 @@
 
 #include "media/foundation/media_clock.h"
 
+#include "media/foundation/clock.h"
+
 #include "gtest/gtest.h"
 
 namespace ave {
 namespace media {
 
+namespace {
+// real time the simulated clock starts at
+const int64_t kStartRealUs = 2000000;
+}  // namespace
+
 class MediaClockTest : public ::testing::Test {
  protected:
-  void SetUp() override { media_clock_ = std::make_shared<MediaClock>(); }
+  void SetUp() override {
+    clock_ = std::make_shared<SimulatedClock>(kStartRealUs);
+    media_clock_ = std::make_shared<MediaClock>(clock_);
+  }
 
+  std::shared_ptr<SimulatedClock> clock_;
   std::shared_ptr<MediaClock> media_clock_;
 };
 
@@ -61,6 +61,48 @@ TEST(MediaPacketTest, BasicDataTest) {
   EXPECT_EQ(memcmp(copy.data(), kTestString, strlen(kTestString)), 0);
 }
 
+TEST(MediaPacketTest, PooledDataTest) {
+  auto pool = BufferPool::Create();
+  const uint8_t* data = nullptr;
+  {
+    MediaPacket packet = MediaPacket::Create(kSampleCount, pool);
+    EXPECT_EQ(packet.size(), kSampleCount);
+    data = packet.data();
+    MediaPacket copy = packet;
+    EXPECT_EQ(copy.data(), data);
+  }
+  // back in the pool once the last copy is gone
+  EXPECT_EQ(pool->stats().cached_buffers, (size_t)1);
+
+  MediaPacket packet = MediaPacket::Create(kSampleCount * 2, pool);
+  EXPECT_EQ(packet.data(), data);
+  packet.SetSize(kSampleCount, pool);
+  EXPECT_EQ(packet.size(), kSampleCount);
+  EXPECT_EQ(pool->stats().hits, (uint64_t)1);
+}
+
+TEST(MediaPacketTest, ChainDataTest) {
+  auto chain = std::make_shared<BufferChain>();
+  chain->append(Buffer::CreateAsCopy(kTestString, 5));
+  chain->append(Buffer::CreateAsCopy(kTestString + 5, strlen(kTestString) - 5));
+  MediaPacket packet = MediaPacket::CreateWithChain(chain);
+  EXPECT_EQ(packet.buffer_type(), MediaPacket::PacketBufferType::kTypeChain);
+  EXPECT_EQ(packet.size(), strlen(kTestString));
+  EXPECT_EQ(packet.chain()->count(), (size_t)2);
+
+  MediaPacket copy = packet;
+  EXPECT_NE(copy.chain(), chain);
+  EXPECT_EQ(copy.chain()->fragmentData(0), chain->fragmentData(0));
+
+  // linearized on demand, the copy's chain is left alone
+  EXPECT_EQ(memcmp(packet.data(), kTestString, strlen(kTestString)), 0);
+  EXPECT_EQ(chain->count(), (size_t)1);
+  EXPECT_EQ(packet.buffer()->size(), strlen(kTestString));
+  EXPECT_EQ(copy.chain()->count(), (size_t)2);
+  EXPECT_EQ(memcmp(copy.data(), kTestString, strlen(kTestString)), 0);
+  EXPECT_NE(copy.data(), packet.data());
+}
+
 TEST(MediaPacketTest, BasicNativeHandleTest) {
   MediaPacket packet = MediaPacket::CreateWithHandle((void*)kTestString);
   EXPECT_EQ(packet.buffer_type(),
@@ -0,0 +1,189 @@
+/*
+ * message_recorder_unittest.cc
+ * Copyright (C) 2024 youfa <vsyfar@gmail.com>
+ *
+ * Distributed under terms of the GPLv2 license.
+ */
+
+#include "../message_recorder.h"
+
+#include <condition_variable>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "../buffer.h"
+#include "../handler.h"
+#include "../looper.h"
+#include "../media_errors.h"
+#include "../message.h"
+
+#include "test/gtest.h"
+
+namespace ave {
+namespace media {
+
+namespace {
+
+const uint32_t kWhatFrame = 7;
+
+class KeepingHandler : public Handler {
+ public:
+  std::vector<std::shared_ptr<Message>> WaitForCount(size_t count) {
+    std::unique_lock<std::mutex> l(mutex_);
+    condition_.wait(l, [this, count]() { return messages_.size() >= count; });
+    return messages_;
+  }
+
+ protected:
+  void onMessageReceived(const std::shared_ptr<Message>& message) override {
+    std::lock_guard<std::mutex> l(mutex_);
+    messages_.push_back(message);
+    condition_.notify_all();
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  std::vector<std::shared_ptr<Message>> messages_;
+};
+
+std::string LogPath() {
+  return ::testing::TempDir() + "message_recorder_unittest.msglog";
+}
+
+}  // namespace
+
+TEST(MessageRecorderTest, RecordAndReplay) {
+  auto looper = std::make_shared<Looper>();
+  looper->start();
+  auto handler = std::make_shared<KeepingHandler>();
+  looper->registerHandler(handler);
+
+  auto recorder = std::make_shared<MessageRecorder>();
+  ASSERT_EQ(OK, recorder->open(LogPath()));
+  handler->setObserver(recorder);
+
+  for (int32_t i = 0; i < 3; i++) {
+    auto format = Message::Obtain();
+    format->setString("mime", "audio/raw");
+    format->setFloat("gain", 0.5f);
+
+    auto message = Message::Obtain(kWhatFrame, handler);
+    message->setInt32("index", -i);
+    message->setInt64("pts", 1000000000000LL + i);
+    message->setDouble("rate", 1.5);
+    message->setRect("crop", 0, 0, 1920, 1080);
+    message->setMessage("format", format);
+    message->setBuffer("data", std::make_shared<Buffer>(100 + i));
+    // left out of the log
+    message->setPointer("cookie", &i);
+    message->post();
+  }
+  handler->WaitForCount(3);
+  handler->setObserver(nullptr);
+  EXPECT_EQ(3u, recorder->count());
+  ASSERT_EQ(OK, recorder->close());
+
+  auto target = std::make_shared<KeepingHandler>();
+  looper->registerHandler(target);
+  MessageReplayer replayer;
+  ASSERT_EQ(OK, replayer.open(LogPath()));
+  ASSERT_EQ(OK, replayer.replay(target, MessageReplayer::Timing::kFullSpeed));
+
+  auto replayed = target->WaitForCount(3);
+  for (int32_t i = 0; i < 3; i++) {
+    const auto& message = replayed[i];
+    EXPECT_EQ(kWhatFrame, message->what());
+    int32_t index = 1;
+    int64_t pts = 0;
+    double rate = 0;
+    int32_t left, top, right, bottom;
+    EXPECT_TRUE(message->findInt32("index", &index));
+    EXPECT_EQ(-i, index);
+    EXPECT_TRUE(message->findInt64("pts", &pts));
+    EXPECT_EQ(1000000000000LL + i, pts);
+    EXPECT_TRUE(message->findDouble("rate", &rate));
+    EXPECT_EQ(1.5, rate);
+    EXPECT_TRUE(message->findRect("crop", &left, &top, &right, &bottom));
+    EXPECT_EQ(1920, right);
+    EXPECT_EQ(1080, bottom);
+
+    std::shared_ptr<Message> format;
+    std::string mime;
+    float gain = 0;
+    ASSERT_TRUE(message->findMessage("format", format));
+    EXPECT_TRUE(format->findString("mime", mime));
+    EXPECT_EQ("audio/raw", mime);
+    EXPECT_TRUE(format->findFloat("gain", &gain));
+    EXPECT_EQ(0.5f, gain);
+
+    std::shared_ptr<Buffer> data;
+    ASSERT_TRUE(message->findBuffer("data", data));
+    EXPECT_EQ(static_cast<size_t>(100 + i), data->size());
+    EXPECT_FALSE(message->contains("cookie"));
+  }
+
+  looper->stop();
+  Looper::unregisterHandler(handler->id());
+  Looper::unregisterHandler(target->id());
+  remove(LogPath().c_str());
+}
+
+TEST(MessageRecorderTest, KeepsDeliveryTimes) {
+  const std::string path = LogPath();
+  auto recorder = std::make_shared<MessageRecorder>();
+  ASSERT_EQ(OK, recorder->open(path));
+  auto handler = std::make_shared<KeepingHandler>();
+  auto message = Message::Obtain(kWhatFrame, nullptr);
+  recorder->onMessageDelivered(*handler, *message, 5000);
+  recorder->onMessageDelivered(*handler, *message, 4000);
+  recorder->onMessageDelivered(*handler, *message, 1000000);
+  ASSERT_EQ(OK, recorder->close());
+
+  MessageReplayer replayer;
+  ASSERT_EQ(OK, replayer.open(path));
+  std::shared_ptr<Message> replayed;
+  int64_t when_us = 0;
+  for (int64_t expected : {5000, 4000, 1000000}) {
+    ASSERT_EQ(OK, replayer.next(replayed, &when_us));
+    EXPECT_EQ(expected, when_us);
+    EXPECT_EQ(kWhatFrame, replayed->what());
+  }
+  EXPECT_EQ(ERROR_END_OF_STREAM, replayer.next(replayed, &when_us));
+  remove(path.c_str());
+}
+
+TEST(MessageRecorderTest, RejectsTruncatedLogs) {
+  const std::string path = LogPath();
+  auto recorder = std::make_shared<MessageRecorder>();
+  ASSERT_EQ(OK, recorder->open(path));
+  auto handler = std::make_shared<KeepingHandler>();
+  auto message = Message::Obtain(kWhatFrame, nullptr);
+  message->setString("name", "a fairly long string value");
+  recorder->onMessageDelivered(*handler, *message, 0);
+  ASSERT_EQ(OK, recorder->close());
+
+  // cut the string short
+  std::vector<char> bytes(4096);
+  FILE* file = fopen(path.c_str(), "rb");
+  ASSERT_NE(nullptr, file);
+  bytes.resize(fread(bytes.data(), 1, bytes.size(), file));
+  fclose(file);
+  file = fopen(path.c_str(), "wb");
+  ASSERT_NE(nullptr, file);
+  fwrite(bytes.data(), 1, bytes.size() - 4, file);
+  fclose(file);
+
+  MessageReplayer replayer;
+  ASSERT_EQ(OK, replayer.open(path));
+  std::shared_ptr<Message> replayed;
+  int64_t when_us = 0;
+  EXPECT_EQ(ERROR_MALFORMED, replayer.next(replayed, &when_us));
+  remove(path.c_str());
+}
+
+}  // namespace media
+}  // namespace ave
@@ -0,0 +1,270 @@
+/*
+ * message_unittest.cc
+ * Copyright (C) 2024 youfa <vsyfar@gmail.com>
+ *
+ * Distributed under terms of the GPLv2 license.
+ */
+
+#include "../message.h"
+
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "test/gtest.h"
+
+namespace ave {
+namespace media {
+
+TEST(MessageTest, SetAndFind) {
+  auto message = std::make_shared<Message>();
+  message->setInt32("int32", 1);
+  message->setInt64("int64", 2);
+  message->setString("string", "hello");
+
+  int32_t int32_value = 0;
+  int64_t int64_value = 0;
+  std::string string_value;
+  EXPECT_TRUE(message->findInt32("int32", &int32_value));
+  EXPECT_TRUE(message->findInt64("int64", &int64_value));
+  EXPECT_TRUE(message->findString("string", string_value));
+  EXPECT_EQ(1, int32_value);
+  EXPECT_EQ(2, int64_value);
+  EXPECT_EQ("hello", string_value);
+
+  // wrong type
+  EXPECT_FALSE(message->findInt64("int32", &int64_value));
+  EXPECT_FALSE(message->contains("missing"));
+}
+
+TEST(MessageTest, OverwriteChangesType) {
+  auto message = std::make_shared<Message>();
+  message->setInt32("value", 1);
+  message->setString("value", "now a string");
+
+  int32_t int32_value = 0;
+  std::string string_value;
+  EXPECT_FALSE(message->findInt32("value", &int32_value));
+  EXPECT_TRUE(message->findString("value", string_value));
+  EXPECT_EQ("now a string", string_value);
+}
+
+TEST(MessageTest, InternedKeys) {
+  MessageKey key = AVE_MESSAGE_KEY("interned");
+  EXPECT_EQ(key, MessageKey::Intern("interned"));
+  EXPECT_EQ(key, MessageKey::Find("interned"));
+  EXPECT_FALSE(MessageKey::Find("never interned in this test").valid());
+
+  auto message = std::make_shared<Message>();
+  message->setInt32(key, 3);
+
+  // both lookup flavours see the same item
+  int32_t value = 0;
+  EXPECT_TRUE(message->findInt32("interned", &value));
+  EXPECT_EQ(3, value);
+  value = 0;
+  EXPECT_TRUE(message->findInt32(key, &value));
+  EXPECT_EQ(3, value);
+}
+
+// the per thread cache must not trust an address alone
+TEST(MessageTest, InternedKeysOfReusedBuffers) {
+  char name[16] = "width";
+  MessageKey width = MessageKey::Intern(name);
+  EXPECT_EQ(width, MessageKey::Intern(name));
+  EXPECT_STREQ("width", width.c_str());
+
+  strcpy(name, "not interned");
+  EXPECT_FALSE(MessageKey::Find(name).valid());
+  strcpy(name, "height");
+  MessageKey height = MessageKey::Intern(name);
+  EXPECT_NE(width, height);
+  EXPECT_STREQ("height", height.c_str());
+  EXPECT_EQ(height, MessageKey::Find("height"));
+  EXPECT_EQ(width, MessageKey::Find("width"));
+}
+
+TEST(MessageTest, ManyItemsSwitchToIndex) {
+  auto message = std::make_shared<Message>();
+  const int32_t kCount = 64;
+  for (int32_t i = 0; i < kCount; i++) {
+    message->setInt32(("key" + std::to_string(i)).c_str(), i);
+  }
+  // overwrite after the index exists
+  message->setInt32("key0", 100);
+
+  for (int32_t i = 0; i < kCount; i++) {
+    int32_t value = -1;
+    std::string name = "key" + std::to_string(i);
+    EXPECT_TRUE(message->findInt32(name.c_str(), &value));
+    EXPECT_TRUE(message->findInt32(MessageKey::Find(name.c_str()), &value));
+    EXPECT_EQ(i == 0 ? 100 : i, value);
+  }
+  EXPECT_FALSE(message->contains("key64"));
+
+  message->clear();
+  EXPECT_FALSE(message->contains("key1"));
+}
+
+TEST(MessageTest, ObtainRecyclesClearedMessage) {
+  Message* raw = nullptr;
+  {
+    auto message = Message::Obtain(42, nullptr);
+    message->setInt32("value", 7);
+    raw = message.get();
+    EXPECT_EQ(42u, message->what());
+  }
+
+  // same thread, the released message is handed out again, empty
+  auto message = Message::Obtain();
+  EXPECT_EQ(raw, message.get());
+  EXPECT_EQ(0u, message->what());
+  EXPECT_FALSE(message->contains("value"));
+
+  message->setInt32("other", 8);
+  int32_t value = 0;
+  EXPECT_TRUE(message->findInt32("other", &value));
+  EXPECT_EQ(8, value);
+}
+
+TEST(MessageTest, ObtainReleasesItemValues) {
+  auto held = std::make_shared<Message>();
+  std::weak_ptr<Message> weak_held = held;
+  {
+    auto message = Message::Obtain();
+    message->setMessage("nested", std::move(held));
+  }
+  // the pooled message must not keep its items alive
+  EXPECT_TRUE(weak_held.expired());
+}
+
+TEST(MessageTest, Payload) {
+  struct Small {
+    int32_t value;
+  };
+  struct Large {
+    std::shared_ptr<Message> held;
+    char padding[128];
+  };
+
+  auto message = Message::Obtain();
+  EXPECT_FALSE(message->hasPayload());
+  EXPECT_EQ(nullptr, message->payload<Small>());
+
+  message->setPayload(Small{5});
+  ASSERT_NE(nullptr, message->payload<Small>());
+  EXPECT_EQ(5, message->payload<Small>()->value);
+  EXPECT_EQ(nullptr, message->payload<Large>());
+
+  // replacing and clearing destroy the previous payload
+  auto held = std::make_shared<Message>();
+  std::weak_ptr<Message> weak_held = held;
+  message->setPayload(Large{std::move(held), {}});
+  EXPECT_EQ(nullptr, message->payload<Small>());
+  ASSERT_NE(nullptr, message->payload<Large>());
+  EXPECT_FALSE(weak_held.expired());
+  message->clear();
+  EXPECT_FALSE(message->hasPayload());
+  EXPECT_TRUE(weak_held.expired());
+}
+
+TEST(MessageTest, DupCopiesOnWrite) {
+  auto message = Message::Obtain(7, nullptr);
+  message->setInt32("width", 1920);
+  message->setString("mime", "video/avc");
+
+  auto copy = message->dup();
+  EXPECT_EQ(7u, copy->what());
+  int32_t width = 0;
+  std::string mime;
+  EXPECT_TRUE(copy->findInt32("width", &width));
+  EXPECT_EQ(1920, width);
+  EXPECT_TRUE(copy->findString("mime", mime));
+  EXPECT_EQ("video/avc", mime);
+
+  // neither side sees the other's writes
+  copy->setInt32("width", 1280);
+  message->setInt32("height", 1080);
+  EXPECT_TRUE(message->findInt32("width", &width));
+  EXPECT_EQ(1920, width);
+  EXPECT_TRUE(copy->findInt32("width", &width));
+  EXPECT_EQ(1280, width);
+  EXPECT_FALSE(copy->contains("height"));
+
+  copy->clear();
+  EXPECT_TRUE(message->findString("mime", mime));
+}
+
+TEST(MessageTest, DupKeepsPayload) {
+  auto message = Message::Obtain();
+  message->setPayload(std::string("payload"));
+  auto copy = message->dup();
+  ASSERT_NE(nullptr, copy->payload<std::string>());
+  EXPECT_EQ("payload", *copy->payload<std::string>());
+}
+
+TEST(MessageTest, DupSharesOnlyFrozenSubMessages) {
+  auto format = Message::Obtain();
+  format->setInt32("rate", 48000);
+  format->freeze();
+  auto scratch = Message::Obtain();
+  scratch->setInt32("count", 1);
+
+  auto message = Message::Obtain();
+  message->setMessage("format", format);
+  message->setMessage("scratch", scratch);
+  auto copy = message->dup();
+
+  std::shared_ptr<Message> found;
+  EXPECT_TRUE(copy->findMessage("format", found));
+  EXPECT_EQ(format, found);
+  EXPECT_TRUE(copy->findMessage("scratch", found));
+  EXPECT_NE(scratch, found);
+  found->setInt32("count", 2);
+  int32_t count = 0;
+  EXPECT_TRUE(scratch->findInt32("count", &count));
+  EXPECT_EQ(1, count);
+}
+
+TEST(MessageTest, FreezeIsDeepAndDupIsMutable) {
+  auto nested = Message::Obtain();
+  auto message = Message::Obtain();
+  message->setMessage("nested", nested);
+  message->freeze();
+  EXPECT_TRUE(message->isFrozen());
+  EXPECT_TRUE(nested->isFrozen());
+
+  auto copy = message->dup();
+  EXPECT_FALSE(copy->isFrozen());
+  copy->setInt32("value", 1);
+  EXPECT_FALSE(message->contains("value"));
+}
+
+TEST(MessageTest, FrozenMessagesAreReadFromManyThreads) {
+  auto message = Message::Obtain();
+  for (int32_t i = 0; i < 32; i++) {
+    message->setInt32(("key" + std::to_string(i)).c_str(), i);
+  }
+  message->freeze();
+
+  std::vector<std::thread> readers;
+  for (int32_t t = 0; t < 4; t++) {
+    readers.emplace_back([message]() {
+      for (int32_t round = 0; round < 1000; round++) {
+        int32_t value = -1;
+        EXPECT_TRUE(message->findInt32("key17", &value));
+        EXPECT_EQ(17, value);
+        // copies taken and changed concurrently leave the original alone
+        auto copy = message->dup();
+        copy->setInt32("key17", round);
+      }
+    });
+  }
+  for (auto& reader : readers) {
+    reader.join();
+  }
+}
+
+}  // namespace media
+}  // namespace ave
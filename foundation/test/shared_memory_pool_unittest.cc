@@ -0,0 +1,181 @@
+/*
+ * shared_memory_pool_unittest.cc
+ * Copyright (C) 2024 youfa <vsyfar@gmail.com>
+ *
+ * Distributed under terms of the GPLv2 license.
+ */
+
+#include "../shared_memory_pool.h"
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "../media_errors.h"
+
+#include "test/gtest.h"
+
+namespace ave {
+namespace media {
+
+namespace {
+
+const size_t kSlotSize = 64 * 1024;
+const size_t kSlotCount = 4;
+
+class SharedMemoryPoolTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sockets_));
+    pool_ = SharedMemoryPool::Create(kSlotSize, kSlotCount);
+    ASSERT_NE(nullptr, pool_);
+  }
+
+  void TearDown() override {
+    close(sockets_[0]);
+    close(sockets_[1]);
+  }
+
+  int sockets_[2];
+  std::shared_ptr<SharedMemoryPool> pool_;
+};
+
+}  // namespace
+
+TEST_F(SharedMemoryPoolTest, PassesBuffersByReference) {
+  ASSERT_EQ(OK, pool_->sendTo(sockets_[0]));
+  // a second mapping of the same memory, as another process would have
+  auto peer = SharedMemoryPool::ReceiveFrom(sockets_[1]);
+  ASSERT_NE(nullptr, peer);
+  EXPECT_EQ(pool_->id(), peer->id());
+  EXPECT_EQ(kSlotSize, peer->slotSize());
+  EXPECT_EQ(kSlotCount, peer->slotCount());
+
+  auto buffer = pool_->acquire(1000);
+  ASSERT_NE(nullptr, buffer);
+  EXPECT_EQ(1000u, buffer->size());
+  for (size_t i = 0; i < 1000; i++) {
+    buffer->data()[i] = static_cast<uint8_t>(i);
+  }
+  EXPECT_EQ(kSlotCount - 1, pool_->freeSlots());
+
+  SharedBufferHandle handle;
+  ASSERT_EQ(OK, pool_->exportBuffer(Buffer::Slice(buffer, 100, 200), &handle));
+  buffer.reset();
+  // the handle keeps the slot
+  EXPECT_EQ(kSlotCount - 1, peer->freeSlots());
+
+  auto imported = peer->importBuffer(handle);
+  ASSERT_NE(nullptr, imported);
+  EXPECT_EQ(200u, imported->size());
+  EXPECT_EQ(100, imported->data()[0]);
+  EXPECT_EQ(static_cast<uint8_t>(299), imported->data()[199]);
+
+  // and back
+  imported->data()[0] = 0xff;
+  ASSERT_EQ(OK, peer->exportBuffer(imported, &handle));
+  imported.reset();
+  auto returned = pool_->importBuffer(handle);
+  ASSERT_NE(nullptr, returned);
+  EXPECT_EQ(0xff, returned->data()[0]);
+  returned.reset();
+  EXPECT_EQ(kSlotCount, pool_->freeSlots());
+}
+
+TEST_F(SharedMemoryPoolTest, RecyclesSlots) {
+  std::vector<std::shared_ptr<Buffer>> buffers;
+  for (size_t i = 0; i < kSlotCount; i++) {
+    buffers.push_back(pool_->acquire(kSlotSize));
+    ASSERT_NE(nullptr, buffers.back());
+  }
+  EXPECT_EQ(nullptr, pool_->acquire(1));
+  EXPECT_EQ(nullptr, pool_->acquire(kSlotSize + 1));
+  EXPECT_EQ(0u, pool_->freeSlots());
+
+  uint8_t* data = buffers[2]->data();
+  buffers[2].reset();
+  auto again = pool_->acquire(10);
+  ASSERT_NE(nullptr, again);
+  EXPECT_EQ(data, again->data());
+}
+
+TEST_F(SharedMemoryPoolTest, RejectsForeignBuffers) {
+  SharedBufferHandle handle;
+  EXPECT_EQ(BAD_VALUE,
+            pool_->exportBuffer(std::make_shared<Buffer>(10), &handle));
+  EXPECT_EQ(BAD_VALUE, pool_->exportBuffer(nullptr, &handle));
+
+  auto buffer = pool_->acquire(10);
+  ASSERT_EQ(OK, pool_->exportBuffer(buffer, &handle));
+  SharedBufferHandle bad = handle;
+  bad.pool_id++;
+  EXPECT_EQ(nullptr, pool_->importBuffer(bad));
+  bad = handle;
+  bad.slot = kSlotCount;
+  EXPECT_EQ(nullptr, pool_->importBuffer(bad));
+  bad = handle;
+  bad.size = kSlotSize + 1;
+  EXPECT_EQ(nullptr, pool_->importBuffer(bad));
+  // consume the good one
+  EXPECT_NE(nullptr, pool_->importBuffer(handle));
+
+  int pipes[2];
+  ASSERT_EQ(0, pipe(pipes));
+  EXPECT_EQ(nullptr, SharedMemoryPool::Attach(pipes[0]));
+  close(pipes[0]);
+  close(pipes[1]);
+}
+
+TEST_F(SharedMemoryPoolTest, CrossesProcesses) {
+  pid_t pid = fork();
+  ASSERT_GE(pid, 0);
+  if (pid == 0) {
+    // consumer: add up the buffer, hand the sum back in place
+    auto peer = SharedMemoryPool::ReceiveFrom(sockets_[1]);
+    SharedBufferHandle handle;
+    if (peer == nullptr ||
+        read(sockets_[1], &handle, sizeof(handle)) != sizeof(handle)) {
+      _exit(1);
+    }
+    auto buffer = peer->importBuffer(handle);
+    if (buffer == nullptr) {
+      _exit(2);
+    }
+    uint8_t sum = 0;
+    for (size_t i = 0; i < buffer->size(); i++) {
+      sum += buffer->data()[i];
+    }
+    buffer->data()[0] = sum;
+    buffer.reset();
+    _exit(0);
+  }
+
+  ASSERT_EQ(OK, pool_->sendTo(sockets_[0]));
+  auto buffer = pool_->acquire(100);
+  uint8_t sum = 0;
+  for (size_t i = 0; i < 100; i++) {
+    buffer->data()[i] = static_cast<uint8_t>(i * 3);
+    sum += buffer->data()[i];
+  }
+  SharedBufferHandle handle;
+  ASSERT_EQ(OK, pool_->exportBuffer(buffer, &handle));
+  ASSERT_EQ(static_cast<ssize_t>(sizeof(handle)),
+            write(sockets_[0], &handle, sizeof(handle)));
+
+  int status = 0;
+  ASSERT_EQ(pid, waitpid(pid, &status, 0));
+  ASSERT_TRUE(WIFEXITED(status));
+  EXPECT_EQ(0, WEXITSTATUS(status));
+  EXPECT_EQ(sum, buffer->data()[0]);
+  // the consumer's reference is gone
+  EXPECT_EQ(kSlotCount - 1, pool_->freeSlots());
+  buffer.reset();
+  EXPECT_EQ(kSlotCount, pool_->freeSlots());
+}
+
+}  // namespace media
+}  // namespace ave
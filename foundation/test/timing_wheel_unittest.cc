@@ -0,0 +1,149 @@
+/*
+ * timing_wheel_unittest.cc
+ * Copyright (C) 2024 youfa <vsyfar@gmail.com>
+ *
+ * Distributed under terms of the GPLv2 license.
+ */
+
+#include "../timing_wheel.h"
+
+#include <random>
+#include <vector>
+
+#include "test/gtest.h"
+
+namespace ave {
+namespace media {
+
+namespace {
+const int64_t kTickUs = 1000;
+}  // namespace
+
+TEST(TimingWheelTest, EmptyWheel) {
+  TimingWheel<int> wheel(kTickUs, 0);
+  EXPECT_TRUE(wheel.empty());
+  EXPECT_EQ(INT64_MAX, wheel.NextExpiryUs());
+
+  int count = 0;
+  wheel.Expire(1000000, [&count](int64_t, int&&) { count++; });
+  EXPECT_EQ(0, count);
+}
+
+TEST(TimingWheelTest, NeverExpiresEarly) {
+  TimingWheel<int> wheel(kTickUs, 0);
+  wheel.Insert(1500, 1);
+
+  std::vector<int> expired;
+  auto collect = [&expired](int64_t, int&& value) {
+    expired.push_back(value);
+  };
+  wheel.Expire(1000, collect);
+  EXPECT_TRUE(expired.empty());
+  EXPECT_EQ(2000, wheel.NextExpiryUs());
+
+  wheel.Expire(2000, collect);
+  ASSERT_EQ(1u, expired.size());
+  EXPECT_EQ(1, expired[0]);
+  EXPECT_TRUE(wheel.empty());
+}
+
+TEST(TimingWheelTest, SameTickKeepsInsertionOrder) {
+  TimingWheel<int> wheel(kTickUs, 0);
+  for (int i = 0; i < 10; i++) {
+    wheel.Insert(5000, i);
+  }
+
+  std::vector<int> expired;
+  wheel.Expire(5000,
+               [&expired](int64_t, int&& value) { expired.push_back(value); });
+  ASSERT_EQ(10u, expired.size());
+  for (int i = 0; i < 10; i++) {
+    EXPECT_EQ(i, expired[i]);
+  }
+}
+
+TEST(TimingWheelTest, Cancel) {
+  TimingWheel<int> wheel(kTickUs, 0);
+  auto* node = wheel.Insert(3000, 1);
+  wheel.Insert(3000, 2);
+  EXPECT_EQ(1, wheel.Cancel(node));
+  EXPECT_EQ(1u, wheel.size());
+
+  std::vector<int> expired;
+  wheel.Expire(3000,
+               [&expired](int64_t, int&& value) { expired.push_back(value); });
+  ASSERT_EQ(1u, expired.size());
+  EXPECT_EQ(2, expired[0]);
+}
+
+TEST(TimingWheelTest, RemoveIf) {
+  TimingWheel<int> wheel(kTickUs, 0);
+  for (int i = 0; i < 100; i++) {
+    // spread over the ready list and several levels
+    wheel.Insert(i * 10000, i);
+  }
+  EXPECT_EQ(50u, wheel.RemoveIf([](const int& value) { return value % 2; }));
+  EXPECT_EQ(50u, wheel.size());
+
+  std::vector<int> expired;
+  wheel.Expire(1000000000,
+               [&expired](int64_t, int&& value) { expired.push_back(value); });
+  ASSERT_EQ(50u, expired.size());
+  for (int i = 0; i < 50; i++) {
+    EXPECT_EQ(i * 2, expired[i]);
+  }
+}
+
+// every level, including cascades across level boundaries
+TEST(TimingWheelTest, MatchesReferenceAcrossLevels) {
+  std::mt19937 rng(42);
+  std::uniform_int_distribution<int64_t> delay(0, 100000000);
+  TimingWheel<int64_t> wheel(kTickUs, 0);
+
+  const int kCount = 2000;
+  for (int i = 0; i < kCount; i++) {
+    int64_t when_us = delay(rng);
+    wheel.Insert(when_us, when_us);
+  }
+
+  int64_t now_us = 0;
+  int expired = 0;
+  while (!wheel.empty()) {
+    now_us = wheel.NextExpiryUs();
+    ASSERT_NE(INT64_MAX, now_us);
+    wheel.Expire(now_us, [&](int64_t when_us, int64_t&& value) {
+      EXPECT_EQ(when_us, value);
+      EXPECT_LE(when_us, now_us);
+      EXPECT_GT(when_us + kTickUs, now_us);
+      expired++;
+    });
+  }
+  EXPECT_EQ(kCount, expired);
+}
+
+// Expire() at the fire time alone is enough, whatever the cascades in
+// between, which is how Looper sleeps after a post
+TEST(TimingWheelTest, FiresAtFireTime) {
+  std::mt19937 rng(7);
+  std::uniform_int_distribution<int64_t> delay(0, 100000000);
+  for (int i = 0; i < 200; i++) {
+    TimingWheel<int> wheel(kTickUs, 0);
+    int64_t when_us = delay(rng);
+    wheel.Insert(when_us, 1);
+    int64_t fire_us = wheel.FireTimeUs(when_us);
+    EXPECT_GE(fire_us, when_us);
+    EXPECT_LT(fire_us, when_us + kTickUs);
+    EXPECT_GE(fire_us, wheel.NextExpiryUs());
+
+    int expired = 0;
+    wheel.Expire(fire_us - 1, [&expired](int64_t, int&&) { expired++; });
+    EXPECT_EQ(0, expired);
+    wheel.Expire(fire_us, [&expired](int64_t, int&&) { expired++; });
+    EXPECT_EQ(1, expired);
+  }
+  TimingWheel<int> wheel(kTickUs, 0);
+  EXPECT_EQ(INT64_MAX, wheel.FireTimeUs(INT64_MAX));
+}
+
+}  // namespace media
+}  // namespace ave
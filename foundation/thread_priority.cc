@@ -0,0 +1,115 @@
+/*
+ * thread_priority.cc
+ * Copyright (C) 2024 youfa <vsyfar@gmail.com>
+ *
+ * Distributed under terms of the GPLv2 license.
+ */
+
+#include "thread_priority.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+#include <cerrno>
+
+namespace ave {
+namespace media {
+
+namespace {
+
+const size_t kMaxThreadNameLength = 15;
+
+// nice values apply to the whole process on some systems, on Linux
+// PRIO_PROCESS with a thread id targets just that thread
+status_t SetNice(int32_t nice) {
+#if defined(__linux__)
+  id_t id = static_cast<id_t>(syscall(SYS_gettid));
+#else
+  id_t id = 0;
+#endif
+  if (setpriority(PRIO_PROCESS, id, nice) == 0) {
+    return OK;
+  }
+  if (errno != EACCES && errno != EPERM) {
+    return BAD_VALUE;
+  }
+#if defined(__linux__)
+  // try the most urgent value RLIMIT_NICE still allows
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NICE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY) {
+    int32_t allowed = 20 - static_cast<int32_t>(limit.rlim_cur);
+    if (allowed > nice && allowed < kPriorityNormal) {
+      setpriority(PRIO_PROCESS, id, allowed);
+    }
+  }
+#endif
+  return PERMISSION_DENIED;
+}
+
+}  // namespace
+
+status_t SetCurrentThreadPriority(int32_t priority) {
+  if (priority == kPriorityRealtimeFifo ||
+      priority == kPriorityRealtimeRoundRobin) {
+    int policy =
+        priority == kPriorityRealtimeFifo ? SCHED_FIFO : SCHED_RR;
+    struct sched_param param = {};
+    param.sched_priority = kRealtimeSchedPriority;
+    int err = pthread_setschedparam(pthread_self(), policy, &param);
+    if (err == 0) {
+      return OK;
+    }
+    if (err != EPERM) {
+      return BAD_VALUE;
+    }
+    SetNice(kPriorityUrgentAudio);
+    return PERMISSION_DENIED;
+  }
+
+  if (priority < kPriorityUrgentAudio || priority > kPriorityLowest) {
+    return BAD_VALUE;
+  }
+  return SetNice(priority);
+}
+
+status_t SetCurrentThreadAffinity(const std::vector<int32_t>& cpus) {
+  if (cpus.empty()) {
+    return OK;
+  }
+#if defined(__linux__)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int32_t cpu : cpus) {
+    if (cpu < 0 || cpu >= CPU_SETSIZE) {
+      return BAD_VALUE;
+    }
+    CPU_SET(cpu, &set);
+  }
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0
+             ? OK
+             : BAD_VALUE;
+#else
+  return INVALID_OPERATION;
+#endif
+}
+
+void SetCurrentThreadName(const std::string& name) {
+  if (name.empty()) {
+    return;
+  }
+  std::string truncated = name.substr(0, kMaxThreadNameLength);
+#if defined(__APPLE__)
+  pthread_setname_np(truncated.c_str());
+#else
+  pthread_setname_np(pthread_self(), truncated.c_str());
+#endif
+}
+
+}  // namespace media
+}  // namespace ave
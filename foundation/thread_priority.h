@@ -0,0 +1,55 @@
+/*
+ * thread_priority.h
+ * Copyright (C) 2024 youfa <vsyfar@gmail.com>
+ *
+ * Distributed under terms of the GPLv2 license.
+ */
+
+#ifndef THREAD_PRIORITY_H
+#define THREAD_PRIORITY_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "base/errors.h"
+
+namespace ave {
+namespace media {
+
+// Thread priorities, e.g. for Looper::start(). Values from
+// kPriorityUrgentAudio to kPriorityLowest are nice values, the lower the
+// more urgent.
+constexpr int32_t kPriorityLowest = 19;
+constexpr int32_t kPriorityBackground = 10;
+constexpr int32_t kPriorityNormal = 0;
+constexpr int32_t kPriorityDisplay = -4;
+constexpr int32_t kPriorityUrgentDisplay = -8;
+constexpr int32_t kPriorityAudio = -16;
+constexpr int32_t kPriorityUrgentAudio = -19;
+// SCHED_RR / SCHED_FIFO at kRealtimeSchedPriority
+constexpr int32_t kPriorityRealtimeRoundRobin = -21;
+constexpr int32_t kPriorityRealtimeFifo = -22;
+
+// real-time priority used by the kPriorityRealtime* policies, low enough
+// to leave room for the kernel's and the audio server's threads
+constexpr int32_t kRealtimeSchedPriority = 2;
+
+// Applies |priority| to the calling thread. Real-time policies and
+// negative nice values need privileges (CAP_SYS_NICE or RLIMIT_RTPRIO /
+// RLIMIT_NICE on Linux). When they are not permitted the thread falls back
+// to the most urgent nice value it may use and PERMISSION_DENIED is
+// returned.
+status_t SetCurrentThreadPriority(int32_t priority);
+
+// Restricts the calling thread to |cpus|. An empty set is a no-op.
+status_t SetCurrentThreadAffinity(const std::vector<int32_t>& cpus);
+
+// Names the calling thread for debuggers and top, truncated to the 15
+// characters Linux keeps.
+void SetCurrentThreadName(const std::string& name);
+
+}  // namespace media
+}  // namespace ave
+
+#endif /* !THREAD_PRIORITY_H */
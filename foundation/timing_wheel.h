@@ -0,0 +1,364 @@
+/*
+ * timing_wheel.h
+ * Copyright (C) 2024 youfa <vsyfar@gmail.com>
+ *
+ * Distributed under terms of the GPLv2 license.
+ */
+
+#ifndef TIMING_WHEEL_H
+#define TIMING_WHEEL_H
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <utility>
+
+#include "base/constructor_magic.h"
+
+namespace ave {
+namespace media {
+
+// Hierarchical timing wheel with kLevels levels of kSlots slots each.
+// Insert and Cancel are O(1), RemoveIf walks the occupied slots, Expire
+// hands out every entry of a tick as one batch. Entries never expire before
+// their deadline, but may expire up to one tick after it. Entries of the
+// same tick expire in insertion order.
+// Not thread safe, callers provide their own locking.
+template <typename T>
+class TimingWheel {
+ private:
+  struct Slot;
+
+ public:
+  static constexpr int kLevels = 4;
+  static constexpr int kSlotBits = 8;
+  static constexpr int kSlots = 1 << kSlotBits;
+
+  struct Node;
+
+  explicit TimingWheel(int64_t tick_us, int64_t now_us)
+      : tick_us_(tick_us), current_tick_(now_us / tick_us), size_(0) {}
+
+  ~TimingWheel() {
+    for (auto& level : levels_) {
+      for (auto& slot : level.slots) {
+        DeleteAll(slot);
+      }
+    }
+    DeleteAll(ready_);
+    while (free_nodes_ != nullptr) {
+      Node* next = free_nodes_->next;
+      delete free_nodes_;
+      free_nodes_ = next;
+    }
+  }
+
+  // The returned node stays valid until it expires or is cancelled.
+  Node* Insert(int64_t when_us, T value) {
+    Node* node = free_nodes_;
+    if (node != nullptr) {
+      free_nodes_ = node->next;
+      node->when_us = when_us;
+      node->tick = TickFor(when_us);
+      node->value = std::move(value);
+    } else {
+      node = new Node(when_us, TickFor(when_us), std::move(value));
+    }
+    Place(node);
+    size_++;
+    return node;
+  }
+
+  // Removes a pending node, returns its value.
+  T Cancel(Node* node) {
+    Unlink(node);
+    size_--;
+    T value = std::move(node->value);
+    Recycle(node);
+    return value;
+  }
+
+  // Removes every entry |predicate(const T&)| is true for, returns how many.
+  template <typename Predicate>
+  size_t RemoveIf(Predicate&& predicate) {
+    size_t removed = RemoveFrom(ready_, predicate);
+    for (auto& level : levels_) {
+      for (int slot = 0; slot < kSlots; slot++) {
+        if (level.Occupied(slot)) {
+          removed += RemoveFrom(level.slots[slot], predicate);
+        }
+      }
+    }
+    return removed;
+  }
+
+  // Calls |callback(when_us, T&&)| for every entry due at |now_us|.
+  template <typename Callback>
+  void Expire(int64_t now_us, Callback&& callback) {
+    Advance(now_us / tick_us_);
+    while (ready_.head != nullptr) {
+      Node* node = ready_.head;
+      Unlink(node);
+      size_--;
+      int64_t when_us = node->when_us;
+      T value = std::move(node->value);
+      Recycle(node);
+      callback(when_us, std::move(value));
+    }
+  }
+
+  // When an entry inserted with |when_us| is handed out by an Expire() at
+  // that time, without any Expire() before. O(1), unlike NextExpiryUs().
+  int64_t FireTimeUs(int64_t when_us) const {
+    int64_t tick = TickFor(when_us);
+    if (tick > std::numeric_limits<int64_t>::max() / tick_us_) {
+      return std::numeric_limits<int64_t>::max();
+    }
+    return tick * tick_us_;
+  }
+
+  // Earliest time at which Expire() may have work to do, the start of a
+  // cascade counts as work. INT64_MAX if the wheel is empty.
+  int64_t NextExpiryUs() const {
+    if (ready_.head != nullptr) {
+      return current_tick_ * tick_us_;
+    }
+    // a higher level may cascade before the first level 0 entry, take the
+    // minimum over all levels
+    int64_t next_tick = std::numeric_limits<int64_t>::max();
+    for (int level = 0; level < kLevels; level++) {
+      int shift = kSlotBits * level;
+      int64_t index = current_tick_ >> shift;
+      int distance = levels_[level].NextOccupied(
+          static_cast<int>(index & (kSlots - 1)));
+      if (distance > 0) {
+        next_tick = std::min(next_tick, (index + distance) << shift);
+      }
+    }
+    if (next_tick == std::numeric_limits<int64_t>::max() ||
+        next_tick > std::numeric_limits<int64_t>::max() / tick_us_) {
+      return std::numeric_limits<int64_t>::max();
+    }
+    return next_tick * tick_us_;
+  }
+
+  bool empty() const { return size_ == 0; }
+  size_t size() const { return size_; }
+
+  struct Node {
+    Node(int64_t when, int64_t t, T v)
+        : when_us(when), tick(t), value(std::move(v)) {}
+
+    int64_t when_us;
+    int64_t tick;
+    T value;
+
+   private:
+    friend class TimingWheel;
+    Slot* owner = nullptr;
+    int level = -1;
+    int slot = -1;
+    Node* prev = nullptr;
+    Node* next = nullptr;
+  };
+
+ private:
+  struct Slot {
+    Node* head = nullptr;
+    Node* tail = nullptr;
+  };
+
+  struct Level {
+    std::array<Slot, kSlots> slots;
+    std::array<uint64_t, kSlots / 64> bitmap{};
+
+    bool Occupied(int64_t slot) const {
+      return (bitmap[slot >> 6] >> (slot & 63)) & 1;
+    }
+    // distance in 1..kSlots from |from| to the next occupied slot, going
+    // round, 0 if there is none. A word of the bitmap at a time.
+    int NextOccupied(int from) const {
+      for (int distance = 1; distance <= kSlots;) {
+        int slot = (from + distance) & (kSlots - 1);
+        uint64_t bits = bitmap[slot >> 6] >> (slot & 63);
+        if (bits != 0) {
+          return distance + __builtin_ctzll(bits);
+        }
+        distance += 64 - (slot & 63);
+      }
+      return 0;
+    }
+    void Mark(int slot) { bitmap[slot >> 6] |= (1ULL << (slot & 63)); }
+    void Clear(int slot) { bitmap[slot >> 6] &= ~(1ULL << (slot & 63)); }
+    bool Empty() const {
+      for (auto bits : bitmap) {
+        if (bits != 0) {
+          return false;
+        }
+      }
+      return true;
+    }
+  };
+
+  int64_t TickFor(int64_t when_us) const {
+    // round up, an entry must never fire before its deadline
+    int64_t tick = when_us / tick_us_;
+    return (when_us % tick_us_ == 0) ? tick : tick + 1;
+  }
+
+  void Place(Node* node) {
+    int64_t delta = node->tick - current_tick_;
+    if (delta <= 0) {
+      Append(ready_, node);
+      return;
+    }
+    int level = 0;
+    while (level < kLevels - 1 && delta >= (1LL << (kSlotBits * (level + 1)))) {
+      level++;
+    }
+    // beyond the top level, park in the farthest slot and cascade again later
+    int64_t tick = node->tick;
+    int64_t max_delta = (1LL << (kSlotBits * kLevels)) - 1;
+    if (delta > max_delta) {
+      tick = current_tick_ + max_delta;
+    }
+    int slot = static_cast<int>((tick >> (kSlotBits * level)) & (kSlots - 1));
+    node->level = level;
+    node->slot = slot;
+    Append(levels_[level].slots[slot], node);
+    levels_[level].Mark(slot);
+  }
+
+  void Append(Slot& list, Node* node) {
+    node->owner = &list;
+    node->prev = list.tail;
+    node->next = nullptr;
+    if (list.tail != nullptr) {
+      list.tail->next = node;
+    } else {
+      list.head = node;
+    }
+    list.tail = node;
+  }
+
+  void Unlink(Node* node) {
+    Slot& list = *node->owner;
+    if (node->prev != nullptr) {
+      node->prev->next = node->next;
+    } else {
+      list.head = node->next;
+    }
+    if (node->next != nullptr) {
+      node->next->prev = node->prev;
+    } else {
+      list.tail = node->prev;
+    }
+    if (list.head == nullptr && node->level >= 0) {
+      levels_[node->level].Clear(node->slot);
+    }
+    node->owner = nullptr;
+    node->prev = node->next = nullptr;
+    node->level = node->slot = -1;
+  }
+
+  // Moves every node of |level|/|slot| back through Place().
+  void Cascade(int level, int slot) {
+    Slot list = levels_[level].slots[slot];
+    levels_[level].slots[slot] = Slot();
+    levels_[level].Clear(slot);
+    for (Node* node = list.head; node != nullptr;) {
+      Node* next = node->next;
+      Place(node);
+      node = next;
+    }
+  }
+
+  void Advance(int64_t now_tick) {
+    while (current_tick_ < now_tick) {
+      if (WheelEmpty()) {
+        current_tick_ = now_tick;
+        return;
+      }
+      if (levels_[0].Empty()) {
+        // nothing on level 0, jump to the next cascade point
+        int64_t next_cascade = ((current_tick_ >> kSlotBits) + 1) << kSlotBits;
+        if (next_cascade > now_tick) {
+          current_tick_ = now_tick;
+          return;
+        }
+        current_tick_ = next_cascade - 1;
+      }
+      current_tick_++;
+      for (int level = kLevels - 1; level > 0; level--) {
+        int shift = kSlotBits * level;
+        if ((current_tick_ & ((1LL << shift) - 1)) == 0) {
+          Cascade(level,
+                  static_cast<int>((current_tick_ >> shift) & (kSlots - 1)));
+        }
+      }
+      int slot = static_cast<int>(current_tick_ & (kSlots - 1));
+      Slot& list = levels_[0].slots[slot];
+      while (list.head != nullptr) {
+        Node* node = list.head;
+        Unlink(node);
+        Append(ready_, node);
+      }
+    }
+  }
+
+  template <typename Predicate>
+  size_t RemoveFrom(Slot& list, Predicate& predicate) {
+    size_t removed = 0;
+    for (Node* node = list.head; node != nullptr;) {
+      Node* next = node->next;
+      if (predicate(static_cast<const T&>(node->value))) {
+        Cancel(node);
+        removed++;
+      }
+      node = next;
+    }
+    return removed;
+  }
+
+  // keeps the node for the next Insert(), the wheel does not allocate once
+  // it has seen its peak size
+  void Recycle(Node* node) {
+    node->next = free_nodes_;
+    free_nodes_ = node;
+  }
+
+  bool WheelEmpty() const {
+    for (const auto& level : levels_) {
+      if (!level.Empty()) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void DeleteAll(Slot& list) {
+    for (Node* node = list.head; node != nullptr;) {
+      Node* next = node->next;
+      delete node;
+      node = next;
+    }
+    list = Slot();
+  }
+
+  const int64_t tick_us_;
+  int64_t current_tick_;
+  size_t size_;
+  std::array<Level, kLevels> levels_;
+  // nodes whose tick has been reached, in expiry order
+  Slot ready_;
+  // singly linked through Node::next
+  Node* free_nodes_ = nullptr;
+
+  AVE_DISALLOW_COPY_AND_ASSIGN(TimingWheel);
+};
+
+}  // namespace media
+}  // namespace ave
+
+#endif /* !TIMING_WHEEL_H */
@@ -0,0 +1,84 @@
+/*
+ * typed_handler.h
+ * Copyright (C) 2024 youfa <vsyfar@gmail.com>
+ *
+ * Distributed under terms of the GPLv2 license.
+ */
+
+#ifndef TYPED_HANDLER_H
+#define TYPED_HANDLER_H
+
+#include <memory>
+
+#include "handler.h"
+#include "message.h"
+
+namespace ave {
+namespace media {
+
+template <typename... Payloads>
+class TypedHandler;
+
+template <typename Payload>
+class PayloadReceiver {
+ public:
+  virtual ~PayloadReceiver() = default;
+
+ protected:
+  // |message| carries what(), reply tokens and any dynamic items
+  virtual void onPayload(const Payload& payload,
+                         const std::shared_ptr<Message>& message) = 0;
+
+ private:
+  template <typename... Payloads>
+  friend class TypedHandler;
+};
+
+// Handler receiving statically typed payloads, see Message::setPayload().
+// Messages carrying one of Payloads go to the matching onPayload()
+// overload, every other message still goes to onMessageReceived(), so typed
+// and dynamic messages can be mixed on one handler.
+//
+//   struct Progress { int64_t position_us; int32_t percent; };
+//
+//   class Session : public TypedHandler<Progress> {
+//     void onPayload(const Progress& progress,
+//                    const std::shared_ptr<Message>& message) override;
+//   };
+//
+//   auto msg = Message::Obtain(kWhatProgress, session);
+//   msg->setPayload(Progress{position_us, percent});
+//   msg->post();
+template <typename... Payloads>
+class TypedHandler : public Handler, public PayloadReceiver<Payloads>... {
+ public:
+  TypedHandler() = default;
+  ~TypedHandler() override = default;
+
+ protected:
+  using PayloadReceiver<Payloads>::onPayload...;
+
+  // messages without a known payload, override to handle them
+  void onMessageReceived(
+      const std::shared_ptr<Message>& message AVE_MAYBE_UNUSED) override {}
+
+ private:
+  bool onPayloadReceived(const std::shared_ptr<Message>& message) final {
+    return (dispatch<Payloads>(message) || ...);
+  }
+
+  template <typename Payload>
+  bool dispatch(const std::shared_ptr<Message>& message) {
+    const Payload* payload = message->payload<Payload>();
+    if (payload == nullptr) {
+      return false;
+    }
+    static_cast<PayloadReceiver<Payload>*>(this)->onPayload(*payload, message);
+    return true;
+  }
+};
+
+}  // namespace media
+}  // namespace ave
+
+#endif /* !TYPED_HANDLER_H */